@@ -0,0 +1,471 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *      * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *      * Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived
+ *        from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_open.cpp -- pool open benchmark definition
+ */
+
+#include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#include "benchmark.hpp"
+#include "file.h"
+#include "libpmemobj.h"
+
+/* an internal libpmemobj code */
+#include "lane.h"
+#include "memops.h"
+#include "obj.h"
+#include "os.h"
+#include "ulog.h"
+
+#define LAYOUT_NAME "obj_open"
+
+/* the most entries that fit in the redo log of a lane, with its terminator */
+#define MAX_REDO_ENTRIES                                                       \
+	(LANE_REDO_EXTERNAL_SIZE / sizeof(struct ulog_entry_val) - 1)
+
+/*
+ * prog_args - command line parsed arguments
+ */
+struct prog_args {
+	unsigned lanes;		   /* lanes with a redo log to recover */
+	unsigned recovery_threads; /* threads recovering the redo logs */
+	unsigned redo_entries;	   /* entries in each of the redo logs */
+	unsigned partial;	   /* percentage of incomplete redo logs */
+	size_t undo_size;	   /* bytes in each of the undo logs */
+};
+
+/*
+ * obj_bench - variables used in benchmark, passed within functions
+ */
+struct obj_bench {
+	PMEMobjpool *pop;     /* persistent pool handle */
+	struct prog_args *pa; /* prog_args structure */
+	const char *fname;    /* pool file name */
+	uint64_t *value;      /* the words modified by the logs */
+	size_t root_size;     /* size of the root object */
+	char *old_threads;    /* PMEMOBJ_RECOVERY_THREADS before the init */
+};
+
+/*
+ * open_phases -- time spent in each phase of the recovery, summed over all
+ * the opens of all the repeats of a scenario
+ */
+static struct {
+	uint64_t redo_ns;
+	uint64_t heap_boot_ns;
+	uint64_t undo_ns;
+	uint64_t nopens;
+} open_phases;
+
+/*
+ * open_dirty_undo -- starts an undo log snapshotting pa->undo_size bytes in
+ * each of the first pa->lanes lanes and never finishes it, as if the pool was
+ * interrupted in the middle of the transactions
+ */
+static int
+open_dirty_undo(struct obj_bench *ob)
+{
+	PMEMobjpool *pop = ob->pop;
+
+	for (unsigned i = 0; i < ob->pa->lanes; ++i) {
+		struct operation_context *ctx = pop->lanes_desc.lane[i].undo;
+
+		/* recovery copies back the same data, every open is the same */
+		operation_start(ctx);
+		if (operation_add_buffer(ctx, ob->value, ob->value,
+					 ob->pa->undo_size,
+					 ULOG_OPERATION_BUF_CPY) != 0) {
+			fprintf(stderr, "cannot extend the undo log\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * open_dirty_redo -- stores a redo log in each of the first pa->lanes lanes,
+ * as if the pool was interrupted before applying them, the first pa->partial
+ * percent of them are left incomplete
+ */
+static void
+open_dirty_redo(struct obj_bench *ob)
+{
+	PMEMobjpool *pop = ob->pop;
+
+	/* the data of a ulog must be cacheline aligned */
+	alignas(CACHELINE_SIZE) char buf[SIZEOF_ULOG(LANE_REDO_EXTERNAL_SIZE)];
+	memset(buf, 0, sizeof(buf));
+	auto *shadow = (struct ulog *)buf;
+	shadow->capacity = LANE_REDO_EXTERNAL_SIZE;
+
+	struct ulog_next next;
+	VEC_INIT(&next);
+
+	unsigned npartial = ob->pa->lanes * ob->pa->partial / 100;
+
+	for (unsigned i = 0; i < ob->pa->lanes; ++i) {
+		auto *layout = (struct lane_layout *)((char *)pop +
+						      pop->lanes_offset) +
+			i;
+		auto *ulog = (struct ulog *)&layout->external;
+
+		/* the values are not changed, every open recovers the same */
+		for (unsigned e = 0; e < ob->pa->redo_entries; ++e)
+			ulog_entry_val_create(
+				shadow, e * sizeof(struct ulog_entry_val),
+				&ob->value[e], ob->value[e],
+				ULOG_OPERATION_SET, &pop->p_ops);
+		ulog_store(ulog, shadow,
+			   ob->pa->redo_entries *
+				   sizeof(struct ulog_entry_val),
+			   LANE_REDO_EXTERNAL_SIZE, &next, &pop->p_ops);
+
+		/* a store torn by the failure leaves a mismatched checksum */
+		if (i < npartial) {
+			ulog->checksum ^= 1;
+			pmemops_persist(&pop->p_ops, &ulog->checksum,
+					sizeof(ulog->checksum));
+		}
+	}
+
+	VEC_DELETE(&next);
+}
+
+/*
+ * open_root -- (re)initializes the pointer to the root object
+ */
+static int
+open_root(struct obj_bench *ob)
+{
+	ob->value = (uint64_t *)pmemobj_direct(
+		pmemobj_root(ob->pop, ob->root_size));
+	if (ob->value == nullptr) {
+		fprintf(stderr, "%s\n", pmemobj_errormsg());
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * open_set_threads -- sets PMEMOBJ_RECOVERY_THREADS to the number of recovery
+ * threads, remembering its previous value
+ */
+static int
+open_set_threads(struct obj_bench *ob)
+{
+	char *old = os_getenv("PMEMOBJ_RECOVERY_THREADS");
+	ob->old_threads = old ? strdup(old) : nullptr;
+	if (old && ob->old_threads == nullptr) {
+		perror("strdup");
+		return -1;
+	}
+
+	if (ob->pa->recovery_threads == 0)
+		return 0;
+
+	char threads[16];
+	snprintf(threads, sizeof(threads), "%u", ob->pa->recovery_threads);
+	if (os_setenv("PMEMOBJ_RECOVERY_THREADS", threads, 1) != 0) {
+		perror("os_setenv");
+		free(ob->old_threads);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * open_restore_threads -- restores the previous value of
+ * PMEMOBJ_RECOVERY_THREADS, so it does not leak into the next scenario
+ */
+static void
+open_restore_threads(struct obj_bench *ob)
+{
+	if (ob->old_threads) {
+		os_setenv("PMEMOBJ_RECOVERY_THREADS", ob->old_threads, 1);
+		free(ob->old_threads);
+	} else {
+		os_unsetenv("PMEMOBJ_RECOVERY_THREADS");
+	}
+}
+
+/*
+ * open_init -- benchmark initialization
+ */
+static int
+open_init(struct benchmark *bench, struct benchmark_args *args)
+{
+	assert(bench != nullptr);
+	assert(args != nullptr);
+	assert(args->opts != nullptr);
+
+	enum file_type type = util_file_get_type(args->fname);
+	if (type == OTHER_ERROR) {
+		fprintf(stderr, "could not check type of file %s\n",
+			args->fname);
+		return -1;
+	}
+
+	auto *ob = (struct obj_bench *)malloc(sizeof(struct obj_bench));
+	if (ob == nullptr) {
+		perror("malloc");
+		return -1;
+	}
+	pmembench_set_priv(bench, ob);
+
+	ob->pa = (struct prog_args *)args->opts;
+	ob->fname = args->fname;
+	size_t psize;
+
+	if (ob->pa->redo_entries > MAX_REDO_ENTRIES) {
+		fprintf(stderr, "at most %zu redo log entries fit in a lane\n",
+			MAX_REDO_ENTRIES);
+		goto err;
+	}
+
+	if (ob->pa->partial > 100) {
+		fprintf(stderr, "invalid percentage of partial redo logs\n");
+		goto err;
+	}
+
+	ob->root_size = ob->pa->redo_entries * sizeof(uint64_t);
+	if (ob->root_size < ob->pa->undo_size)
+		ob->root_size = ob->pa->undo_size;
+	if (ob->root_size < sizeof(uint64_t))
+		ob->root_size = sizeof(uint64_t);
+
+	if (args->is_poolset || type == TYPE_DEVDAX) {
+		psize = 0;
+	} else {
+		/* the undo logs are extended with memory from the heap */
+		psize = PMEMOBJ_MIN_POOL + 2 * ob->root_size +
+			(size_t)ob->pa->lanes * 2 * ob->pa->undo_size;
+	}
+
+	if (open_set_threads(ob) != 0)
+		goto err;
+
+	/* create pmemobj pool */
+	ob->pop = pmemobj_create(args->fname, LAYOUT_NAME, psize, args->fmode);
+	if (ob->pop == nullptr) {
+		fprintf(stderr, "%s\n", pmemobj_errormsg());
+		goto err_threads;
+	}
+
+	if (ob->pa->lanes > ob->pop->nlanes) {
+		fprintf(stderr, "the pool has only %" PRIu64 " lanes\n",
+			ob->pop->nlanes);
+		goto err_close;
+	}
+
+	if (open_root(ob) != 0)
+		goto err_close;
+
+	return 0;
+
+err_close:
+	pmemobj_close(ob->pop);
+err_threads:
+	open_restore_threads(ob);
+err:
+	free(ob);
+	return -1;
+}
+
+/*
+ * open_exit -- benchmark clean up
+ */
+static int
+open_exit(struct benchmark *bench, struct benchmark_args *args)
+{
+	auto *ob = (struct obj_bench *)pmembench_get_priv(bench);
+
+	pmemobj_close(ob->pop);
+	open_restore_threads(ob);
+	free(ob);
+
+	return 0;
+}
+
+/*
+ * open_op -- closes the pool with undo and redo logs left in its lanes and
+ * opens it again, which recovers them
+ */
+static int
+open_op(struct benchmark *bench, struct operation_info *info)
+{
+	auto *ob = (struct obj_bench *)pmembench_get_priv(bench);
+
+	/* extending the undo logs uses the redo logs of the lanes */
+	if (ob->pa->undo_size != 0 && open_dirty_undo(ob) != 0)
+		return -1;
+	if (ob->pa->redo_entries != 0)
+		open_dirty_redo(ob);
+	pmemobj_close(ob->pop);
+
+	ob->pop = pmemobj_open(ob->fname, LAYOUT_NAME);
+	if (ob->pop == nullptr) {
+		fprintf(stderr, "%s\n", pmemobj_errormsg());
+		return -1;
+	}
+
+	uint64_t redo_ns, heap_boot_ns, undo_ns;
+	if (pmemobj_ctl_get(ob->pop, "stats.recovery.redo_ns", &redo_ns) ||
+	    pmemobj_ctl_get(ob->pop, "stats.recovery.heap_boot_ns",
+			    &heap_boot_ns) ||
+	    pmemobj_ctl_get(ob->pop, "stats.recovery.undo_ns", &undo_ns)) {
+		fprintf(stderr, "%s\n", pmemobj_errormsg());
+		return -1;
+	}
+	open_phases.redo_ns += redo_ns;
+	open_phases.heap_boot_ns += heap_boot_ns;
+	open_phases.undo_ns += undo_ns;
+	open_phases.nopens++;
+
+	return open_root(ob);
+}
+
+/*
+ * open_print_extra_headers -- print the headers of the recovery phases
+ */
+static void
+open_print_extra_headers()
+{
+	printf(";redo-avg[nsec];heap-boot-avg[nsec];undo-avg[nsec]");
+}
+
+/*
+ * open_print_extra_values -- print the average time of each recovery phase
+ */
+static void
+open_print_extra_values(struct benchmark *bench, struct benchmark_args *args,
+			struct total_results *res)
+{
+	uint64_t n = open_phases.nopens ? open_phases.nopens : 1;
+
+	printf(";%" PRIu64 ";%" PRIu64 ";%" PRIu64, open_phases.redo_ns / n,
+	       open_phases.heap_boot_ns / n, open_phases.undo_ns / n);
+
+	memset(&open_phases, 0, sizeof(open_phases));
+}
+
+static struct benchmark_clo open_clo[5];
+static struct benchmark_info open_info;
+
+CONSTRUCTOR(obj_open_constructor)
+void
+obj_open_constructor(void)
+{
+	open_clo[0].opt_short = 'l';
+	open_clo[0].opt_long = "lanes";
+	open_clo[0].descr = "Number of lanes with a redo log to recover";
+	open_clo[0].type = CLO_TYPE_UINT;
+	open_clo[0].off = clo_field_offset(struct prog_args, lanes);
+	open_clo[0].def = "0";
+	open_clo[0].type_uint.size = clo_field_size(struct prog_args, lanes);
+	open_clo[0].type_uint.base = CLO_INT_BASE_DEC;
+	open_clo[0].type_uint.min = 0;
+	open_clo[0].type_uint.max = UINT_MAX;
+
+	open_clo[1].opt_short = 'r';
+	open_clo[1].opt_long = "recovery-threads";
+	open_clo[1].descr = "Number of threads recovering the redo logs, "
+			    "0 for the default";
+	open_clo[1].type = CLO_TYPE_UINT;
+	open_clo[1].off = clo_field_offset(struct prog_args, recovery_threads);
+	open_clo[1].def = "0";
+	open_clo[1].type_uint.size =
+		clo_field_size(struct prog_args, recovery_threads);
+	open_clo[1].type_uint.base = CLO_INT_BASE_DEC;
+	open_clo[1].type_uint.min = 0;
+	open_clo[1].type_uint.max = UINT_MAX;
+
+	open_clo[2].opt_short = 'e';
+	open_clo[2].opt_long = "redo-entries";
+	open_clo[2].descr = "Number of entries in each of the redo logs";
+	open_clo[2].type = CLO_TYPE_UINT;
+	open_clo[2].off = clo_field_offset(struct prog_args, redo_entries);
+	open_clo[2].def = "1";
+	open_clo[2].type_uint.size =
+		clo_field_size(struct prog_args, redo_entries);
+	open_clo[2].type_uint.base = CLO_INT_BASE_DEC;
+	open_clo[2].type_uint.min = 0;
+	open_clo[2].type_uint.max = MAX_REDO_ENTRIES;
+
+	open_clo[3].opt_short = 'p';
+	open_clo[3].opt_long = "partial";
+	open_clo[3].descr = "Percentage of the redo logs left incomplete";
+	open_clo[3].type = CLO_TYPE_UINT;
+	open_clo[3].off = clo_field_offset(struct prog_args, partial);
+	open_clo[3].def = "0";
+	open_clo[3].type_uint.size = clo_field_size(struct prog_args, partial);
+	open_clo[3].type_uint.base = CLO_INT_BASE_DEC;
+	open_clo[3].type_uint.min = 0;
+	open_clo[3].type_uint.max = 100;
+
+	open_clo[4].opt_short = 'u';
+	open_clo[4].opt_long = "undo-size";
+	open_clo[4].descr = "Size of the undo log in each of the lanes";
+	open_clo[4].type = CLO_TYPE_UINT;
+	open_clo[4].off = clo_field_offset(struct prog_args, undo_size);
+	open_clo[4].def = "0";
+	open_clo[4].type_uint.size = clo_field_size(struct prog_args, undo_size);
+	open_clo[4].type_uint.base = CLO_INT_BASE_DEC;
+	open_clo[4].type_uint.min = 0;
+	open_clo[4].type_uint.max = ~0;
+
+	open_info.name = "obj_open";
+	open_info.brief = "Benchmark for pmemobj_open() with lanes "
+			  "to recover";
+	open_info.init = open_init;
+	open_info.exit = open_exit;
+	open_info.multithread = false;
+	open_info.multiops = true;
+	open_info.operation = open_op;
+	open_info.print_extra_headers = open_print_extra_headers;
+	open_info.print_extra_values = open_print_extra_values;
+	open_info.measure_time = true;
+	open_info.clos = open_clo;
+	open_info.nclos = ARRAY_SIZE(open_clo);
+	open_info.opts_size = sizeof(struct prog_args);
+	open_info.rm_file = true;
+	open_info.allow_poolset = true;
+	REGISTER_BENCHMARK(open_info);
+}
@@ -71,6 +71,7 @@ struct prog_args {
 	size_t minsize;       /* minimum size for random allocation size */
 	bool use_random_size; /* if set, use random size allocations */
 	unsigned seed;	/* PRNG seed */
+	unsigned thread_cache; /* blocks per class in the thread caches */
 };
 
 POBJ_LAYOUT_BEGIN(pmalloc_layout);
@@ -178,6 +179,16 @@ obj_init(struct benchmark *bench, struct benchmark_args *args)
 		goto free_ob;
 	}
 
+	{
+		long long thread_cache = ob->pa->thread_cache;
+		if (pmemobj_ctl_set(ob->pop, "heap.thread.cache_size",
+				    &thread_cache) != 0) {
+			fprintf(stderr, "heap.thread.cache_size: %s\n",
+				pmemobj_errormsg());
+			goto free_pop;
+		}
+	}
+
 	ob->root = POBJ_ROOT(ob->pop, struct my_root);
 	if (TOID_IS_NULL(ob->root)) {
 		fprintf(stderr, "POBJ_ROOT: %s\n", pmemobj_errormsg());
@@ -431,7 +442,7 @@ pfree_op(struct benchmark *bench, struct operation_info *info)
 }
 
 /* command line options definition */
-static struct benchmark_clo pmalloc_clo[3];
+static struct benchmark_clo pmalloc_clo[4];
 /*
  * Stores information about pmalloc benchmark.
  */
@@ -481,6 +492,19 @@ obj_pmalloc_constructor(void)
 	pmalloc_clo[2].type_uint.min = 1;
 	pmalloc_clo[2].type_uint.max = UINT_MAX;
 
+	pmalloc_clo[3].opt_short = 0;
+	pmalloc_clo[3].opt_long = "thread-cache";
+	pmalloc_clo[3].descr = "Number of blocks cached per allocation "
+			       "class by each thread, 0 disables the cache";
+	pmalloc_clo[3].off = clo_field_offset(struct prog_args, thread_cache);
+	pmalloc_clo[3].def = "32";
+	pmalloc_clo[3].type = CLO_TYPE_UINT;
+	pmalloc_clo[3].type_uint.size =
+		clo_field_size(struct prog_args, thread_cache);
+	pmalloc_clo[3].type_uint.base = CLO_INT_BASE_DEC;
+	pmalloc_clo[3].type_uint.min = 0;
+	pmalloc_clo[3].type_uint.max = 1024;
+
 	pmalloc_info.name = "pmalloc",
 	pmalloc_info.brief = "Benchmark for internal pmalloc() "
 			     "operation";
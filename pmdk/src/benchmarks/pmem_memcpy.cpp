@@ -111,6 +111,13 @@ struct pmem_args {
 
 	/* do not do warmup */
 	bool no_warmup;
+
+	/*
+	 * Kind of the stores used by pmem_memcpy() - "auto" lets libpmem
+	 * choose based on the movnt threshold, "temporal" and "nontemporal"
+	 * force one of them.
+	 */
+	char *copy_mode;
 };
 
 /*
@@ -164,7 +171,10 @@ struct pmem_bench {
 	 * The actual operation performed based on benchmark specific
 	 * arguments.
 	 */
-	int (*func_op)(void *dest, void *source, size_t len);
+	int (*func_op)(void *dest, void *source, size_t len, unsigned flags);
+
+	/* pmem_memcpy() flags matching the copy_mode */
+	unsigned flags;
 };
 
 /*
@@ -277,7 +287,7 @@ assign_mode_func(char *option)
  * followed by pmem_flush().
  */
 static int
-libc_memcpy(void *dest, void *source, size_t len)
+libc_memcpy(void *dest, void *source, size_t len, unsigned flags)
 {
 	memcpy(dest, source, len);
 
@@ -291,7 +301,7 @@ libc_memcpy(void *dest, void *source, size_t len)
  * followed by pmem_persist().
  */
 static int
-libc_memcpy_persist(void *dest, void *source, size_t len)
+libc_memcpy_persist(void *dest, void *source, size_t len, unsigned flags)
 {
 	memcpy(dest, source, len);
 
@@ -301,24 +311,25 @@ libc_memcpy_persist(void *dest, void *source, size_t len)
 }
 
 /*
- * lipmem_memcpy_nodrain -- copy using libpmem pmem_memcpy_no_drain()
- * function without pmem_persist().
+ * lipmem_memcpy_nodrain -- copy using libpmem pmem_memcpy() function
+ * without draining.
  */
 static int
-libpmem_memcpy_nodrain(void *dest, void *source, size_t len)
+libpmem_memcpy_nodrain(void *dest, void *source, size_t len, unsigned flags)
 {
-	pmem_memcpy_nodrain(dest, source, len);
+	pmem_memcpy(dest, source, len, flags | PMEM_F_MEM_NODRAIN);
 
 	return 0;
 }
 
 /*
- * libpmem_memcpy_persist -- copy using libpmem pmem_memcpy_persist() function.
+ * libpmem_memcpy_persist -- copy using libpmem pmem_memcpy() function
+ * followed by a drain.
  */
 static int
-libpmem_memcpy_persist(void *dest, void *source, size_t len)
+libpmem_memcpy_persist(void *dest, void *source, size_t len, unsigned flags)
 {
-	pmem_memcpy_persist(dest, source, len);
+	pmem_memcpy(dest, source, len, flags);
 
 	return 0;
 }
@@ -475,6 +486,19 @@ pmem_memcpy_init(struct benchmark *bench, struct benchmark_args *args)
 		goto err_unmap;
 	}
 
+	if (strcmp(pmb->pargs->copy_mode, "auto") == 0) {
+		pmb->flags = 0;
+	} else if (strcmp(pmb->pargs->copy_mode, "temporal") == 0) {
+		pmb->flags = PMEM_F_MEM_TEMPORAL;
+	} else if (strcmp(pmb->pargs->copy_mode, "nontemporal") == 0) {
+		pmb->flags = PMEM_F_MEM_NONTEMPORAL;
+	} else {
+		fprintf(stderr, "wrong copy-mode parameter -- '%s'",
+			pmb->pargs->copy_mode);
+		ret = -1;
+		goto err_unmap;
+	}
+
 	if (pmb->pargs->memcpy) {
 		pmb->func_op =
 			pmb->pargs->persist ? libc_memcpy_persist : libc_memcpy;
@@ -523,7 +547,7 @@ pmem_memcpy_operation(struct benchmark *bench, struct operation_info *info)
 		pmb->pargs->dest_off;
 	size_t len = pmb->pargs->chunk_size;
 
-	pmb->func_op(dest, source, len);
+	pmb->func_op(dest, source, len, pmb->flags);
 	return 0;
 }
 
@@ -542,7 +566,7 @@ pmem_memcpy_exit(struct benchmark *bench, struct benchmark_args *args)
 }
 
 /* structure to define command line arguments */
-static struct benchmark_clo pmem_memcpy_clo[8];
+static struct benchmark_clo pmem_memcpy_clo[9];
 
 /* Stores information about benchmark. */
 static struct benchmark_info pmem_memcpy_bench;
@@ -618,6 +642,14 @@ pmem_memcpy_constructor(void)
 	pmem_memcpy_clo[7].type = CLO_TYPE_FLAG;
 	pmem_memcpy_clo[7].off = clo_field_offset(struct pmem_args, no_warmup);
 
+	pmem_memcpy_clo[8].opt_short = 0;
+	pmem_memcpy_clo[8].opt_long = "copy-mode";
+	pmem_memcpy_clo[8].descr = "Stores used by pmem_memcpy() - auto, "
+				   "temporal, nontemporal";
+	pmem_memcpy_clo[8].type = CLO_TYPE_STR;
+	pmem_memcpy_clo[8].off = clo_field_offset(struct pmem_args, copy_mode);
+	pmem_memcpy_clo[8].def = "auto";
+
 	pmem_memcpy_bench.name = "pmem_memcpy";
 	pmem_memcpy_bench.brief = "Benchmark for"
 				  "pmem_memcpy_persist() and "
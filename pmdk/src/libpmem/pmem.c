@@ -180,6 +180,9 @@
 #include "valgrind_internal.h"
 #include "os_deep.h"
 #include "os_auto_flush.h"
+#ifdef XFDETECTOR_RT
+#include "xfdetector_rt.h"
+#endif
 
 static struct pmem_funcs Funcs;
 
@@ -570,7 +573,18 @@ void *
 pmem_map_file(const char *path, size_t len, int flags,
 	mode_t mode, size_t *mapped_lenp, int *is_pmemp)
 {
+#ifdef XFDETECTOR_RT
+	size_t mapped_len;
+	if (mapped_lenp == NULL)
+		mapped_lenp = &mapped_len;
+	void *ret = pmem_map_fileU(path, len, flags, mode, mapped_lenp,
+					is_pmemp);
+	if (ret != NULL)
+		XFD_RT_CALL(xfd_rt_map, ret, *mapped_lenp);
+	return ret;
+#else
 	return pmem_map_fileU(path, len, flags, mode, mapped_lenp, is_pmemp);
+#endif
 }
 #else
 /*
@@ -603,6 +617,9 @@ pmem_unmap(void *addr, size_t len)
 	util_range_unregister(addr, len);
 #endif
 	VALGRIND_REMOVE_PMEM_MAPPING(addr, len);
+#ifdef XFDETECTOR_RT
+	XFD_RT_CALL(xfd_rt_unmap, addr, len);
+#endif
 	return util_unmap(addr, len);
 }
 
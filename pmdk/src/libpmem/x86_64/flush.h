@@ -37,6 +37,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "util.h"
+#ifdef XFDETECTOR_RT
+#include "xfdetector_rt.h"
+#endif
 
 #define FLUSH_ALIGN ((uintptr_t)64)
 
@@ -57,6 +60,38 @@
 		(*(volatile char *)(addr)));
 #endif /* _MSC_VER */
 
+/*
+ * FLUSH_LINES_UNROLLED -- flushes the cache lines covering the given range
+ *	using flush_line, 8 and then 4 lines per iteration
+ *
+ * The alignment is worked out once for the whole range, so large ranges
+ * only pay for the unrolled loop.
+ */
+#define FLUSH_LINES_UNROLLED(flush_line, addr, len) do {\
+	uintptr_t uptr = (uintptr_t)(addr) & ~(FLUSH_ALIGN - 1);\
+	uintptr_t end = ((uintptr_t)(addr) + (len) + FLUSH_ALIGN - 1) &\
+		~(FLUSH_ALIGN - 1);\
+	for (; end - uptr >= 8 * FLUSH_ALIGN; uptr += 8 * FLUSH_ALIGN) {\
+		flush_line((char *)uptr);\
+		flush_line((char *)uptr + 1 * FLUSH_ALIGN);\
+		flush_line((char *)uptr + 2 * FLUSH_ALIGN);\
+		flush_line((char *)uptr + 3 * FLUSH_ALIGN);\
+		flush_line((char *)uptr + 4 * FLUSH_ALIGN);\
+		flush_line((char *)uptr + 5 * FLUSH_ALIGN);\
+		flush_line((char *)uptr + 6 * FLUSH_ALIGN);\
+		flush_line((char *)uptr + 7 * FLUSH_ALIGN);\
+	}\
+	if (end - uptr >= 4 * FLUSH_ALIGN) {\
+		flush_line((char *)uptr);\
+		flush_line((char *)uptr + 1 * FLUSH_ALIGN);\
+		flush_line((char *)uptr + 2 * FLUSH_ALIGN);\
+		flush_line((char *)uptr + 3 * FLUSH_ALIGN);\
+		uptr += 4 * FLUSH_ALIGN;\
+	}\
+	for (; uptr < end; uptr += FLUSH_ALIGN)\
+		flush_line((char *)uptr);\
+} while (0)
+
 /*
  * flush_clflush_nolog -- flush the CPU cache, using clflush
  */
@@ -64,15 +99,11 @@
 static void
 flush_clflush_nolog(const void *addr, size_t len)
 {
-	uintptr_t uptr;
+#ifdef XFDETECTOR_RT
+	XFD_RT_CALL(xfd_rt_flush, addr, len);
+#endif
 	//fprintf(stderr, "%p: %ld\n", addr, len);
-	/*
-	 * Loop through cache-line-size (typically 64B) aligned chunks
-	 * covering the given range.
-	 */
-	for (uptr = (uintptr_t)addr & ~(FLUSH_ALIGN - 1);
-		uptr < (uintptr_t)addr + len; uptr += FLUSH_ALIGN)
-		_mm_clflush((char *)uptr);
+	FLUSH_LINES_UNROLLED(_mm_clflush, addr, len);
 }
 
 /*
@@ -82,17 +113,12 @@ flush_clflush_nolog(const void *addr, size_t len)
 static void
 flush_clflushopt_nolog(const void *addr, size_t len)
 {
-	uintptr_t uptr;
+#ifdef XFDETECTOR_RT
+	XFD_RT_CALL(xfd_rt_flush, addr, len);
+#endif
 	//fprintf(stderr, "%p: %ld\n", addr, len);
 
-	/*
-	 * Loop through cache-line-size (typically 64B) aligned chunks
-	 * covering the given range.
-	 */
-	for (uptr = (uintptr_t)addr & ~(FLUSH_ALIGN - 1);
-		uptr < (uintptr_t)addr + len; uptr += FLUSH_ALIGN) {
-		pmem_clflushopt((char *)uptr);
-	}
+	FLUSH_LINES_UNROLLED(pmem_clflushopt, addr, len);
 }
 
 /*
@@ -102,17 +128,12 @@ flush_clflushopt_nolog(const void *addr, size_t len)
 static void
 flush_clwb_nolog(const void *addr, size_t len)
 {
-	uintptr_t uptr;
+#ifdef XFDETECTOR_RT
+	XFD_RT_CALL(xfd_rt_flush, addr, len);
+#endif
 	//fprintf(stderr, "%p: %ld\n", addr, len);
 
-	/*
-	 * Loop through cache-line-size (typically 64B) aligned chunks
-	 * covering the given range.
-	 */
-	for (uptr = (uintptr_t)addr & ~(FLUSH_ALIGN - 1);
-		uptr < (uintptr_t)addr + len; uptr += FLUSH_ALIGN) {
-		pmem_clwb((char *)uptr);
-	}
+	FLUSH_LINES_UNROLLED(pmem_clwb, addr, len);
 }
 
 #endif
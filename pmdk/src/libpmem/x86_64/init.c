@@ -30,10 +30,14 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <xmmintrin.h>
 #include "libpmem.h"
 
+#include "alloc.h"
 #include "cpu.h"
 #include "flush.h"
 #include "memcpy_memset.h"
@@ -65,6 +69,9 @@ static void
 predrain_memory_barrier(void)
 {
 	LOG(15, NULL);
+#ifdef XFDETECTOR_RT
+	XFD_RT_CALL(xfd_rt_fence);
+#endif
 	_mm_sfence();	/* ensure CLWB or CLFLUSHOPT completes */
 }
 
@@ -112,6 +119,92 @@ flush_empty(const void *addr, size_t len)
 	flush_empty_nolog(addr, len);
 }
 
+/*
+ * flush_movnt_nolog -- write the cache lines covering the given range back to
+ *	memory by rewriting them with non-temporal stores
+ *
+ * For very large ranges this is cheaper than flushing each of the lines, but
+ * it's only correct if no other thread modifies the range at the same time.
+ */
+static void
+flush_movnt_nolog(const void *addr, size_t len)
+{
+#ifdef XFDETECTOR_RT
+	XFD_RT_CALL(xfd_rt_flush, addr, len);
+#endif
+	uintptr_t uptr = (uintptr_t)addr & ~(FLUSH_ALIGN - 1);
+	uintptr_t end = ((uintptr_t)addr + len + FLUSH_ALIGN - 1) &
+		~(FLUSH_ALIGN - 1);
+
+	for (; uptr < end; uptr += FLUSH_ALIGN) {
+		__m128i *line = (__m128i *)uptr;
+		__m128i xmm0 = _mm_load_si128(line + 0);
+		__m128i xmm1 = _mm_load_si128(line + 1);
+		__m128i xmm2 = _mm_load_si128(line + 2);
+		__m128i xmm3 = _mm_load_si128(line + 3);
+		_mm_stream_si128(line + 0, xmm0);
+		_mm_stream_si128(line + 1, xmm1);
+		_mm_stream_si128(line + 2, xmm2);
+		_mm_stream_si128(line + 3, xmm3);
+	}
+
+	/* the non-temporal stores are not ordered by clflush */
+	_mm_sfence();
+}
+
+
+/*
+ * Flush_movnt_threshold -- size of the range from which pmem_flush rewrites
+ * it with non-temporal stores instead of flushing it line by line, 0 means
+ * never (the default)
+ */
+static size_t Flush_movnt_threshold;
+
+/*
+ * flush_clflush_hybrid -- (internal) flush the CPU cache, using clflush or
+ *	non-temporal rewrite for large ranges
+ */
+static void
+flush_clflush_hybrid(const void *addr, size_t len)
+{
+	LOG(15, "addr %p len %zu", addr, len);
+
+	if (len >= Flush_movnt_threshold)
+		flush_movnt_nolog(addr, len);
+	else
+		flush_clflush_nolog(addr, len);
+}
+
+/*
+ * flush_clflushopt_hybrid -- (internal) flush the CPU cache, using clflushopt
+ *	or non-temporal rewrite for large ranges
+ */
+static void
+flush_clflushopt_hybrid(const void *addr, size_t len)
+{
+	LOG(15, "addr %p len %zu", addr, len);
+
+	if (len >= Flush_movnt_threshold)
+		flush_movnt_nolog(addr, len);
+	else
+		flush_clflushopt_nolog(addr, len);
+}
+
+/*
+ * flush_clwb_hybrid -- (internal) flush the CPU cache, using clwb or
+ *	non-temporal rewrite for large ranges
+ */
+static void
+flush_clwb_hybrid(const void *addr, size_t len)
+{
+	LOG(15, "addr %p len %zu", addr, len);
+
+	if (len >= Flush_movnt_threshold)
+		flush_movnt_nolog(addr, len);
+	else
+		flush_clwb_nolog(addr, len);
+}
+
 #if SSE2_AVAILABLE || AVX_AVAILABLE || AVX512F_AVAILABLE
 #define PMEM_F_MEM_MOVNT (PMEM_F_MEM_WC | PMEM_F_MEM_NONTEMPORAL)
 #define PMEM_F_MEM_MOV   (PMEM_F_MEM_WB | PMEM_F_MEM_TEMPORAL)
@@ -410,6 +503,192 @@ pmem_cpuinfo_to_funcs(struct pmem_funcs *funcs, enum memcpy_impl *impl)
 	}
 }
 
+/*
+ * The calibration copies chunks of sizes from MOVNT_CALIBRATE_MIN_SIZE to
+ * MOVNT_CALIBRATE_MAX_SIZE with both kinds of instructions into a scratch
+ * buffer larger than the CPU caches, so that the destination is cold like
+ * it usually is for pmem. The buffer is in DRAM, pmem with a different
+ * write bandwidth may favor a different threshold.
+ */
+#define MOVNT_CALIBRATE_MIN_SIZE 256
+#define MOVNT_CALIBRATE_MAX_SIZE (1 << 20) /* 1 MiB */
+#define MOVNT_CALIBRATE_SCRATCH_SIZE (64 << 20) /* 64 MiB */
+#define MOVNT_CALIBRATE_BYTES (8 << 20) /* copied per measurement */
+#define MOVNT_CALIBRATE_TRIALS 3
+
+/*
+ * movnt_calibrate_measure -- (internal) returns the time in nanoseconds it
+ *	takes to copy MOVNT_CALIBRATE_BYTES in chunks of len bytes
+ */
+static uint64_t
+movnt_calibrate_measure(struct pmem_funcs *funcs, char *scratch,
+	const char *src, size_t len, unsigned flags)
+{
+	size_t n = MOVNT_CALIBRATE_BYTES / len;
+	size_t off = 0;
+	struct timespec start, end;
+
+	os_clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < n; ++i) {
+		funcs->memmove_nodrain(scratch + off, src, len, flags);
+		funcs->predrain_fence();
+
+		off += len;
+		if (off + len > MOVNT_CALIBRATE_SCRATCH_SIZE)
+			off = 0;
+	}
+	os_clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+		(uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+}
+
+/*
+ * movnt_calibrate -- (internal) measures the smallest length from which
+ *	the non-temporal copy is faster than the temporal one
+ */
+static int
+movnt_calibrate(struct pmem_funcs *funcs, size_t *threshold)
+{
+	char *src = Malloc(MOVNT_CALIBRATE_MAX_SIZE);
+	if (src == NULL)
+		return -1;
+
+	char *scratch = Malloc(MOVNT_CALIBRATE_SCRATCH_SIZE);
+	if (scratch == NULL) {
+		Free(src);
+		return -1;
+	}
+
+	memset(src, 0xc5, MOVNT_CALIBRATE_MAX_SIZE);
+	memset(scratch, 0, MOVNT_CALIBRATE_SCRATCH_SIZE);
+
+	/* movnt is not used at all, unless it's faster for the largest size */
+	*threshold = SIZE_MAX;
+
+	for (size_t len = MOVNT_CALIBRATE_MAX_SIZE;
+			len >= MOVNT_CALIBRATE_MIN_SIZE; len /= 2) {
+		uint64_t t_mov = UINT64_MAX;
+		uint64_t t_movnt = UINT64_MAX;
+
+		for (int i = 0; i < MOVNT_CALIBRATE_TRIALS; ++i) {
+			uint64_t t = movnt_calibrate_measure(funcs, scratch,
+				src, len, PMEM_F_MEM_TEMPORAL);
+			if (t < t_mov)
+				t_mov = t;
+
+			t = movnt_calibrate_measure(funcs, scratch, src, len,
+				PMEM_F_MEM_NONTEMPORAL);
+			if (t < t_movnt)
+				t_movnt = t;
+		}
+
+		LOG(4, "len %zu mov %" PRIu64 " ns movnt %" PRIu64 " ns",
+			len, t_mov, t_movnt);
+
+		/* movnt has to be faster for all of the larger sizes */
+		if (t_movnt > t_mov)
+			break;
+
+		*threshold = len;
+	}
+
+	Free(scratch);
+	Free(src);
+
+	return 0;
+}
+
+/*
+ * movnt_calibrate_key -- (internal) describes the memcpy variant for which
+ *	the threshold is calibrated
+ */
+static int
+movnt_calibrate_key(struct pmem_funcs *funcs, enum memcpy_impl impl,
+	char *key, size_t size)
+{
+	const char *isa;
+	if (impl == MEMCPY_AVX512F)
+		isa = "avx512f";
+	else if (impl == MEMCPY_AVX)
+		isa = "avx";
+	else if (impl == MEMCPY_SSE2)
+		isa = "sse2";
+	else
+		return -1;
+
+	const char *flush;
+	if (funcs->deep_flush == flush_clwb)
+		flush = "clwb";
+	else if (funcs->deep_flush == flush_clflushopt)
+		flush = "clflushopt";
+	else
+		flush = "clflush";
+
+	int ret = snprintf(key, size, "%s_%s", isa, flush);
+	if (ret < 0 || (size_t)ret >= size)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * movnt_threshold_calibrate -- sets the movnt threshold to the one measured
+ *	on this platform
+ *
+ * If the PMEM_MOVNT_CALIBRATE_FILE is set, the threshold is read from that
+ * file instead, as long as it was calibrated for the same memcpy variant.
+ * Otherwise the file is overwritten with the new threshold.
+ */
+static void
+movnt_threshold_calibrate(struct pmem_funcs *funcs, enum memcpy_impl impl)
+{
+	char key[32];
+	if (movnt_calibrate_key(funcs, impl, key, sizeof(key)) != 0) {
+		LOG(3, "movnt not used, skipping calibration");
+		return;
+	}
+
+	char *path = os_getenv("PMEM_MOVNT_CALIBRATE_FILE");
+	if (path != NULL) {
+		FILE *f = os_fopen(path, "r");
+		if (f != NULL) {
+			char fkey[32];
+			size_t val;
+			int ret = fscanf(f, "%31s %zu", fkey, &val);
+			fclose(f);
+
+			if (ret == 2 && strcmp(fkey, key) == 0) {
+				LOG(3, "movnt threshold for %s read from %s: %zu",
+					key, path, val);
+				Movnt_threshold = val;
+				return;
+			}
+		}
+	}
+
+	size_t threshold;
+	if (movnt_calibrate(funcs, &threshold) != 0) {
+		LOG(3, "movnt calibration failed");
+		return;
+	}
+
+	LOG(3, "movnt threshold for %s calibrated to %zu", key, threshold);
+	Movnt_threshold = threshold;
+
+	if (path == NULL)
+		return;
+
+	FILE *f = os_fopen(path, "w");
+	if (f == NULL) {
+		LOG(2, "cannot write movnt threshold to %s", path);
+		return;
+	}
+
+	fprintf(f, "%s %zu\n", key, threshold);
+	fclose(f);
+}
+
 /*
  * pmem_init_funcs -- initialize architecture-specific list of pmem operations
  */
@@ -445,7 +724,11 @@ pmem_init_funcs(struct pmem_funcs *funcs)
 	 * It has no effect if movnt is not supported or disabled.
 	 */
 	ptr = os_getenv("PMEM_MOVNT_THRESHOLD");
-	if (ptr) {
+	if (ptr == NULL) {
+		char *e = os_getenv("PMEM_MOVNT_CALIBRATE");
+		if (e && strcmp(e, "1") == 0)
+			movnt_threshold_calibrate(funcs, impl);
+	} else {
 		long long val = atoll(ptr);
 
 		if (val < 0) {
@@ -493,6 +776,31 @@ pmem_init_funcs(struct pmem_funcs *funcs)
 	else if (funcs->flush != funcs->deep_flush)
 		FATAL("invalid flush function address");
 
+	/*
+	 * Rewriting large ranges with non-temporal stores is faster than
+	 * flushing them line by line, but it races with other threads
+	 * writing to the same cache lines, so it has to be asked for.
+	 */
+	ptr = os_getenv("PMEM_FLUSH_MOVNT_THRESHOLD");
+	if (ptr && funcs->flush != flush_empty) {
+		long long val = atoll(ptr);
+
+		if (val <= 0) {
+			LOG(3, "Invalid PMEM_FLUSH_MOVNT_THRESHOLD");
+		} else {
+			LOG(3, "PMEM_FLUSH_MOVNT_THRESHOLD set to %zu",
+				(size_t)val);
+			Flush_movnt_threshold = (size_t)val;
+
+			if (funcs->deep_flush == flush_clwb)
+				funcs->flush = flush_clwb_hybrid;
+			else if (funcs->deep_flush == flush_clflushopt)
+				funcs->flush = flush_clflushopt_hybrid;
+			else
+				funcs->flush = flush_clflush_hybrid;
+		}
+	}
+
 	if (impl == MEMCPY_AVX512F)
 		LOG(3, "using movnt AVX512F");
 	else if (impl == MEMCPY_AVX)
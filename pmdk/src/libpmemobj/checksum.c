@@ -0,0 +1,229 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * checksum.c -- Fletcher64 checksum of the ulog entries
+ *
+ * The checksum is the same as util_checksum, lo32 being the sum of all the
+ * 32-bit words and hi32 the sum of all the prefix sums. Over n words that
+ * continue a checksum (lo32, hi32) it is:
+ *
+ *	lo32' = lo32 + sum(w[i])
+ *	hi32' = hi32 + n * lo32 + sum((n - i) * w[i])
+ *
+ * which lets the SIMD variants sum several words at once, in any order.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "os.h"
+#include "out.h"
+#include "util.h"
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(_M_X64) ||\
+	defined(_M_AMD64)
+#define CHECKSUM_SIMD 1
+#endif
+
+static uint64_t (*Checksum_seq)(const void *addr, size_t len,
+	uint64_t csum) = util_checksum_seq;
+
+#ifdef CHECKSUM_SIMD
+
+#define EAX_IDX 0
+#define EBX_IDX 1
+#define ECX_IDX 2
+#define EDX_IDX 3
+
+#ifdef _MSC_VER
+
+#include <intrin.h>
+
+static inline void
+cpuid(unsigned func, unsigned subfunc, unsigned cpuinfo[4])
+{
+	__cpuidex((int *)cpuinfo, (int)func, (int)subfunc);
+}
+
+static inline uint64_t
+xgetbv(unsigned xcr)
+{
+	return _xgetbv(xcr);
+}
+
+#else
+
+#include <cpuid.h>
+
+static inline void
+cpuid(unsigned func, unsigned subfunc, unsigned cpuinfo[4])
+{
+	__cpuid_count(func, subfunc, cpuinfo[EAX_IDX], cpuinfo[EBX_IDX],
+		cpuinfo[ECX_IDX], cpuinfo[EDX_IDX]);
+}
+
+static inline uint64_t
+xgetbv(unsigned xcr)
+{
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(xcr));
+	return (uint64_t)edx << 32 | eax;
+}
+
+#endif
+
+#define CHECKSUM_BIT_SSE42	(1 << 20) /* cpuid(1).ecx */
+#define CHECKSUM_BIT_OSXSAVE	(1 << 27) /* cpuid(1).ecx */
+#define CHECKSUM_BIT_AVX	(1 << 28) /* cpuid(1).ecx */
+#define CHECKSUM_BIT_AVX2	(1 << 5) /* cpuid(7).ebx */
+
+/* the SSE and AVX state is enabled by the OS */
+#define XCR0_SSE_AVX	0x6
+
+/*
+ * is_cpu_sse42_present -- (internal) checks if SSE4.2 is supported
+ */
+static int
+is_cpu_sse42_present(void)
+{
+	unsigned cpuinfo[4] = { 0 };
+
+	cpuid(0x1, 0x0, cpuinfo);
+
+	return (cpuinfo[ECX_IDX] & CHECKSUM_BIT_SSE42) != 0;
+}
+
+/*
+ * is_cpu_avx2_present -- (internal) checks if AVX2 is supported and enabled
+ *	by the OS
+ */
+static int
+is_cpu_avx2_present(void)
+{
+	unsigned cpuinfo[4] = { 0 };
+
+	cpuid(0x0, 0x0, cpuinfo);
+	if (cpuinfo[EAX_IDX] < 0x7)
+		return 0;
+
+	cpuid(0x1, 0x0, cpuinfo);
+	if ((cpuinfo[ECX_IDX] & (CHECKSUM_BIT_OSXSAVE | CHECKSUM_BIT_AVX)) !=
+			(CHECKSUM_BIT_OSXSAVE | CHECKSUM_BIT_AVX))
+		return 0;
+
+	if ((xgetbv(0) & XCR0_SSE_AVX) != XCR0_SSE_AVX)
+		return 0;
+
+	cpuid(0x7, 0x0, cpuinfo);
+
+	return (cpuinfo[EBX_IDX] & CHECKSUM_BIT_AVX2) != 0;
+}
+
+#endif
+
+/*
+ * checksum_init -- selects the checksum variant supported by the CPU
+ */
+void
+checksum_init(void)
+{
+	LOG(3, NULL);
+
+#ifdef CHECKSUM_SIMD
+	char *e = os_getenv("PMEMOBJ_NO_SIMD_CHECKSUM");
+	if (e && strcmp(e, "1") == 0) {
+		LOG(3, "PMEMOBJ_NO_SIMD_CHECKSUM set");
+		return;
+	}
+
+	if (is_cpu_avx2_present()) {
+		LOG(3, "using AVX2 checksum");
+		Checksum_seq = checksum_seq_avx2;
+	} else if (is_cpu_sse42_present()) {
+		LOG(3, "using SSE4.2 checksum");
+		Checksum_seq = checksum_seq_sse42;
+	}
+#endif
+}
+
+/*
+ * checksum_seq -- continues the Fletcher64 checksum csum over the buffer,
+ *	like util_checksum_seq
+ */
+uint64_t
+checksum_seq(const void *addr, size_t len, uint64_t csum)
+{
+	if (len % 4 != 0)
+		abort();
+
+	return Checksum_seq(addr, len, csum);
+}
+
+/*
+ * checksum_compute -- computes the Fletcher64 checksum of the buffer, with
+ *	the 64-bit checksum at csump treated as zeros, like util_checksum
+ *
+ * If insert is true, the checksum is stored at csump and 1 is returned.
+ * Otherwise it returns whether the checksum matches the one at csump.
+ */
+int
+checksum_compute(void *addr, size_t len, uint64_t *csump, int insert)
+{
+	uintptr_t off = (uintptr_t)csump - (uintptr_t)addr;
+
+	/* only a checksum fully inside of the buffer can be subtracted */
+	if (len % 4 != 0 || (uintptr_t)csump < (uintptr_t)addr ||
+	    off % 4 != 0 || off + sizeof(*csump) > len)
+		return util_checksum(addr, len, csump, insert, 0);
+
+	uint64_t csum = Checksum_seq(addr, len, 0);
+	uint32_t lo32 = (uint32_t)csum;
+	uint32_t hi32 = (uint32_t)(csum >> 32);
+
+	/* take out the contribution of the two words of the checksum */
+	uint32_t n = (uint32_t)((len - off) / 4);
+	uint32_t w0 = le32toh(((uint32_t *)csump)[0]);
+	uint32_t w1 = le32toh(((uint32_t *)csump)[1]);
+	lo32 -= w0 + w1;
+	hi32 -= n * w0 + (n - 1) * w1;
+
+	csum = (uint64_t)hi32 << 32 | lo32;
+
+	if (insert) {
+		*csump = htole64(csum);
+		return 1;
+	}
+
+	return *csump == htole64(csum);
+}
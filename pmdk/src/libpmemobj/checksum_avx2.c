@@ -0,0 +1,89 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * checksum_avx2.c -- Fletcher64 checksum using AVX2
+ */
+
+#include <immintrin.h>
+
+#include "checksum.h"
+
+/*
+ * checksum_seq_avx2 -- continues the Fletcher64 checksum over the buffer,
+ *	eight words at a time
+ */
+uint64_t
+checksum_seq_avx2(const void *addr, size_t len, uint64_t csum)
+{
+	const uint32_t *p32 = addr;
+	size_t nwords = len / 4;
+	size_t nvec = nwords / 8;
+	uint32_t lo32 = (uint32_t)csum;
+	uint32_t hi32 = (uint32_t)(csum >> 32);
+
+	/* per lane sums of the words and of their prefix sums */
+	__m256i sum = _mm256_setzero_si256();
+	__m256i prefix = _mm256_setzero_si256();
+	for (size_t i = 0; i < nvec; ++i) {
+		__m256i w = _mm256_loadu_si256((const __m256i *)(p32 + i * 8));
+		sum = _mm256_add_epi32(sum, w);
+		prefix = _mm256_add_epi32(prefix, sum);
+	}
+
+	/* the word in lane j is counted j times too many in prefix */
+	__m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i excess = _mm256_mullo_epi32(sum, lanes);
+
+	uint32_t s[8], p[8], x[8];
+	_mm256_storeu_si256((__m256i *)s, sum);
+	_mm256_storeu_si256((__m256i *)p, prefix);
+	_mm256_storeu_si256((__m256i *)x, excess);
+
+	uint32_t ssum = 0, psum = 0, xsum = 0;
+	for (int j = 0; j < 8; ++j) {
+		ssum += s[j];
+		psum += p[j];
+		xsum += x[j];
+	}
+
+	uint32_t n = (uint32_t)(nvec * 8);
+	hi32 += n * lo32 + 8 * psum - xsum;
+	lo32 += ssum;
+
+	for (size_t i = nvec * 8; i < nwords; ++i) {
+		lo32 += p32[i];
+		hi32 += lo32;
+	}
+
+	return (uint64_t)hi32 << 32 | lo32;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * checksum_sse42.c -- Fletcher64 checksum using SSE4.2
+ */
+
+#include <smmintrin.h>
+
+#include "checksum.h"
+
+/*
+ * checksum_seq_sse42 -- continues the Fletcher64 checksum over the buffer,
+ *	four words at a time
+ */
+uint64_t
+checksum_seq_sse42(const void *addr, size_t len, uint64_t csum)
+{
+	const uint32_t *p32 = addr;
+	size_t nwords = len / 4;
+	size_t nvec = nwords / 4;
+	uint32_t lo32 = (uint32_t)csum;
+	uint32_t hi32 = (uint32_t)(csum >> 32);
+
+	/* per lane sums of the words and of their prefix sums */
+	__m128i sum = _mm_setzero_si128();
+	__m128i prefix = _mm_setzero_si128();
+	for (size_t i = 0; i < nvec; ++i) {
+		__m128i w = _mm_loadu_si128((const __m128i *)(p32 + i * 4));
+		sum = _mm_add_epi32(sum, w);
+		prefix = _mm_add_epi32(prefix, sum);
+	}
+
+	/* the word in lane j is counted j times too many in prefix */
+	__m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+	__m128i excess = _mm_mullo_epi32(sum, lanes);
+
+	uint32_t s[4], p[4], x[4];
+	_mm_storeu_si128((__m128i *)s, sum);
+	_mm_storeu_si128((__m128i *)p, prefix);
+	_mm_storeu_si128((__m128i *)x, excess);
+
+	uint32_t n = (uint32_t)(nvec * 4);
+	hi32 += n * lo32 + 4 * (p[0] + p[1] + p[2] + p[3]) -
+		(x[0] + x[1] + x[2] + x[3]);
+	lo32 += s[0] + s[1] + s[2] + s[3];
+
+	for (size_t i = nvec * 4; i < nwords; ++i) {
+		lo32 += p32[i];
+		hi32 += lo32;
+	}
+
+	return (uint64_t)hi32 << 32 | lo32;
+}
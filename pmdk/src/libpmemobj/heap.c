@@ -61,6 +61,9 @@
 #define HEAP_DEFAULT_GROW_SIZE (1 << 27) /* 128 megabytes */
 #define MAX_DEFAULT_ARENAS (1 << 10) /* 1024 arenas */
 
+/* allocations a thread makes from a class before the class gets a magazine */
+#define HEAP_THREAD_CACHE_HOT_ALLOCS 64
+
 /*
  * Arenas store the collection of buckets for allocation classes.
  * Each thread is assigned an arena on its first allocator operation
@@ -98,6 +101,64 @@ struct heap_rt {
 
 	unsigned nzones;
 	unsigned zones_exhausted;
+
+	/* faults in the zones ahead of heap_populate_bucket, if started */
+	struct zone_prefetch *zone_prefetch;
+
+	/* stores a pointer to the thread cache of the current thread */
+	os_tls_key_t thread_cache;
+
+	/* all the thread caches, freed when the heap is cleaned up */
+	VEC(, struct heap_thread_cache *) thread_caches;
+	os_mutex_t thread_caches_lock;
+};
+
+/*
+ * A block reserved from a bucket but not yet handed out to a reservation.
+ * It counts as a reservation of its run, so the run cannot be recycled while
+ * the block is cached.
+ */
+struct heap_cached_block {
+	struct memory_block m;
+	int *resvp;
+};
+
+/*
+ * Magazine of the blocks of one allocation class, refilled in batches from
+ * a single bucket once all of its blocks are handed out.
+ */
+struct heap_magazine {
+	struct bucket *b; /* the bucket from which the cached blocks come */
+	unsigned capacity;
+	unsigned first; /* the next block to hand out */
+	unsigned last;
+	struct heap_cached_block blocks[];
+};
+
+/*
+ * Per-thread cache of the reserved blocks of the allocation classes most
+ * used by the thread, so that most of the small allocations don't take the
+ * bucket lock. The lock is only contended when another thread flushes the
+ * cache because the heap ran out of memory.
+ */
+struct heap_thread_cache {
+	struct palloc_heap *heap;
+	os_mutex_t lock;
+	unsigned nallocs[MAX_ALLOCATION_CLASSES];
+	struct heap_magazine *magazines[MAX_ALLOCATION_CLASSES];
+};
+
+/*
+ * The zones are walked by a background thread once the first one is
+ * materialized, so that the chunk and run headers are already mapped in
+ * when the next ones are needed.
+ */
+struct zone_prefetch {
+	struct palloc_heap *heap;
+	unsigned nzones; /* the number of zones when the thread was started */
+	size_t heap_size;
+	int stop;
+	os_thread_t thread;
 };
 
 /*
@@ -310,6 +371,299 @@ out:
 	return b;
 }
 
+/*
+ * heap_magazine_new -- (internal) creates an empty magazine
+ */
+static struct heap_magazine *
+heap_magazine_new(unsigned capacity)
+{
+	struct heap_magazine *mag = Malloc(sizeof(*mag) +
+		sizeof(struct heap_cached_block) * capacity);
+	if (mag == NULL)
+		return NULL;
+
+	mag->b = NULL;
+	mag->capacity = capacity;
+	mag->first = 0;
+	mag->last = 0;
+
+	return mag;
+}
+
+/*
+ * heap_magazine_refill -- (internal) reserves a batch of blocks from the
+ *	bucket, which has to be locked
+ */
+static void
+heap_magazine_refill(struct palloc_heap *heap, struct heap_magazine *mag,
+	struct bucket *b)
+{
+	ASSERTeq(mag->first, mag->last);
+
+	mag->b = b;
+	mag->first = 0;
+	mag->last = 0;
+
+	unsigned nblocks = MIN(mag->capacity, heap->thread_cache_size);
+	while (mag->last < nblocks) {
+		struct heap_cached_block *cb = &mag->blocks[mag->last];
+		cb->m = MEMORY_BLOCK_NONE;
+		cb->m.size_idx = 1;
+
+		if (heap_get_bestfit_block(heap, b, &cb->m) != 0)
+			break;
+
+		/* same as a reservation made by palloc_reservation_create */
+		if ((cb->resvp = bucket_current_resvp(b)) != NULL)
+			util_fetch_and_add64(cb->resvp, 1);
+
+		mag->last++;
+	}
+}
+
+/*
+ * heap_cached_block_release -- (internal) gives a cached block back to the
+ *	bucket it came from, which has to be locked
+ *
+ * Blocks of the run still active in the bucket are put back into it, the
+ * others become available again once their run is recycled.
+ */
+static void
+heap_cached_block_release(struct bucket *b, struct heap_cached_block *cb)
+{
+	if (cb->resvp == NULL)
+		return;
+
+	if (cb->resvp == bucket_current_resvp(b) &&
+	    bucket_insert_block(b, &cb->m) != 0)
+		LOG(2, "unable to track runtime block state");
+
+	util_fetch_and_sub64(cb->resvp, 1);
+}
+
+/*
+ * heap_magazine_flush -- (internal) gives the cached blocks back to the bucket
+ *	they came from
+ */
+static void
+heap_magazine_flush(struct heap_magazine *mag)
+{
+	if (mag->first == mag->last)
+		return;
+
+	util_mutex_lock(&mag->b->lock);
+
+	for (unsigned i = mag->first; i < mag->last; ++i)
+		heap_cached_block_release(mag->b, &mag->blocks[i]);
+
+	util_mutex_unlock(&mag->b->lock);
+
+	mag->first = 0;
+	mag->last = 0;
+}
+
+/*
+ * heap_thread_cache_delete -- (internal) frees the thread cache
+ */
+static void
+heap_thread_cache_delete(struct heap_thread_cache *tc)
+{
+	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
+		Free(tc->magazines[i]);
+	util_mutex_destroy(&tc->lock);
+	Free(tc);
+}
+
+/*
+ * heap_thread_cache_flush_magazines -- (internal) gives all the blocks cached
+ *	by the thread back to the buckets
+ */
+static void
+heap_thread_cache_flush_magazines(struct heap_thread_cache *tc)
+{
+	util_mutex_lock(&tc->lock);
+	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
+		if (tc->magazines[i] != NULL)
+			heap_magazine_flush(tc->magazines[i]);
+	}
+	util_mutex_unlock(&tc->lock);
+}
+
+/*
+ * heap_thread_cache_destructor -- (internal) flushes and frees the thread
+ *	cache on thread exit
+ */
+static void
+heap_thread_cache_destructor(void *arg)
+{
+	struct heap_thread_cache *tc = arg;
+	struct heap_rt *rt = tc->heap->rt;
+
+	heap_thread_cache_flush_magazines(tc);
+
+	util_mutex_lock(&rt->thread_caches_lock);
+	size_t pos;
+	VEC_FOREACH_BY_POS(pos, &rt->thread_caches) {
+		if (VEC_ARR(&rt->thread_caches)[pos] == tc) {
+			VEC_ERASE_BY_POS(&rt->thread_caches, pos);
+			break;
+		}
+	}
+	util_mutex_unlock(&rt->thread_caches_lock);
+
+	heap_thread_cache_delete(tc);
+}
+
+/*
+ * heap_thread_cache -- (internal) returns the cache of the current thread,
+ *	creates it if needed
+ */
+static struct heap_thread_cache *
+heap_thread_cache(struct palloc_heap *heap)
+{
+	struct heap_rt *rt = heap->rt;
+
+	struct heap_thread_cache *tc = os_tls_get(rt->thread_cache);
+	if (tc != NULL)
+		return tc;
+
+	tc = Zalloc(sizeof(*tc));
+	if (tc == NULL)
+		return NULL;
+	tc->heap = heap;
+	util_mutex_init(&tc->lock);
+
+	util_mutex_lock(&rt->thread_caches_lock);
+	int ret = VEC_PUSH_BACK(&rt->thread_caches, tc);
+	util_mutex_unlock(&rt->thread_caches_lock);
+
+	if (ret != 0) {
+		util_mutex_destroy(&tc->lock);
+		Free(tc);
+		return NULL;
+	}
+
+	os_tls_set(rt->thread_cache, tc);
+
+	return tc;
+}
+
+/*
+ * heap_thread_cache_get -- takes a block of the size index of m from the
+ *	magazine of the current thread
+ *
+ * The returned block is reserved, the reservation counter is returned through
+ * resvp. Returns -1 if the block has to be taken from the bucket instead.
+ */
+int
+heap_thread_cache_get(struct palloc_heap *heap, struct alloc_class *c,
+	struct memory_block *m, int **resvp)
+{
+	/* only single-unit blocks of the runs are cached */
+	if (heap->thread_cache_size == 0 || c->type != CLASS_RUN ||
+	    m->size_idx != 1)
+		return -1;
+
+	struct heap_thread_cache *tc = heap_thread_cache(heap);
+	if (tc == NULL)
+		return -1;
+
+	int ret = -1;
+	util_mutex_lock(&tc->lock);
+
+	struct heap_magazine *mag = tc->magazines[c->id];
+	if (mag == NULL) {
+		if (++tc->nallocs[c->id] < HEAP_THREAD_CACHE_HOT_ALLOCS)
+			goto out;
+
+		mag = heap_magazine_new(heap->thread_cache_size);
+		if (mag == NULL)
+			goto out;
+		tc->magazines[c->id] = mag;
+	}
+
+	if (mag->first == mag->last) {
+		struct bucket *b = heap_bucket_acquire(heap, c->id,
+			HEAP_ARENA_PER_THREAD);
+		heap_magazine_refill(heap, mag, b);
+		heap_bucket_release(heap, b);
+
+		if (mag->first == mag->last)
+			goto out;
+	}
+
+	struct heap_cached_block *cb = &mag->blocks[mag->first++];
+	*m = cb->m;
+	*resvp = cb->resvp;
+	ret = 0;
+
+out:
+	util_mutex_unlock(&tc->lock);
+
+	return ret;
+}
+
+/*
+ * heap_thread_cache_put -- puts back the last block taken from the magazine
+ *	of the current thread, together with its reservation
+ */
+void
+heap_thread_cache_put(struct palloc_heap *heap, struct alloc_class *c,
+	const struct memory_block *m, int *resvp)
+{
+	struct heap_thread_cache *tc = os_tls_get(heap->rt->thread_cache);
+	ASSERTne(tc, NULL);
+
+	util_mutex_lock(&tc->lock);
+
+	struct heap_magazine *mag = tc->magazines[c->id];
+	ASSERTne(mag, NULL);
+
+	if (mag->first != 0) {
+		struct heap_cached_block *cb = &mag->blocks[--mag->first];
+		cb->m = *m;
+		cb->resvp = resvp;
+	} else {
+		/* the magazine was flushed since the block was taken */
+		struct heap_cached_block cb = { *m, resvp };
+		util_mutex_lock(&mag->b->lock);
+		heap_cached_block_release(mag->b, &cb);
+		util_mutex_unlock(&mag->b->lock);
+	}
+
+	util_mutex_unlock(&tc->lock);
+}
+
+/*
+ * heap_thread_cache_flush -- gives the blocks cached by the current thread
+ *	back to the buckets
+ */
+void
+heap_thread_cache_flush(struct palloc_heap *heap)
+{
+	struct heap_thread_cache *tc = os_tls_get(heap->rt->thread_cache);
+	if (tc != NULL)
+		heap_thread_cache_flush_magazines(tc);
+}
+
+/*
+ * heap_thread_caches_flush -- gives the blocks cached by all the threads
+ *	back to the buckets
+ *
+ * No bucket can be held by the caller.
+ */
+void
+heap_thread_caches_flush(struct palloc_heap *heap)
+{
+	struct heap_rt *rt = heap->rt;
+
+	util_mutex_lock(&rt->thread_caches_lock);
+	struct heap_thread_cache *tc;
+	VEC_FOREACH(tc, &rt->thread_caches)
+		heap_thread_cache_flush_magazines(tc);
+	util_mutex_unlock(&rt->thread_caches_lock);
+}
+
 /*
  * heap_bucket_release -- puts the bucket back into the heap
  */
@@ -393,6 +747,129 @@ heap_zone_init(struct palloc_heap *heap, uint32_t zone_id,
 	pmemops_persist(&heap->p_ops, &z->header, sizeof(z->header));
 }
 
+/*
+ * heap_zone_update_if_needed -- (internal) updates the zone metadata if
+ *	the pool has been extended
+ */
+static void
+heap_zone_update_if_needed(struct palloc_heap *heap, uint32_t zone_id)
+{
+	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+
+	size_t size_idx = zone_calc_size_idx(zone_id, heap->rt->nzones,
+		*heap->sizep);
+	if (size_idx == z->header.size_idx)
+		return;
+
+	heap_zone_init(heap, zone_id, z->header.size_idx);
+}
+
+/*
+ * heap_zone_prefetch_zone -- (internal) faults in the chunk headers and run
+ *	headers of a zone
+ */
+static void
+heap_zone_prefetch_zone(struct zone_prefetch *zp, uint32_t zone_id)
+{
+	struct zone *z = ZID_TO_ZONE(zp->heap->layout, zone_id);
+
+	/* the headers of a zone are only written when it is materialized */
+	if (z->header.magic != ZONE_HEADER_MAGIC)
+		return;
+
+	uint32_t size_idx = zone_calc_size_idx(zone_id, zp->nzones,
+		zp->heap_size);
+
+	for (uint32_t i = 0; i < size_idx; ) {
+		int stop;
+		util_atomic_load_explicit32(&zp->stop, &stop,
+			memory_order_relaxed);
+		if (stop)
+			return;
+
+		/* the header might be changed by a concurrent materialization */
+		struct chunk_header hdr = z->chunk_headers[i];
+		if (hdr.type == CHUNK_TYPE_RUN) {
+			struct chunk_run *run = (struct chunk_run *)&z->chunks[i];
+			(void) *(volatile uint64_t *)&run->hdr;
+		}
+
+		i += hdr.size_idx == 0 ? 1 : hdr.size_idx;
+	}
+}
+
+/*
+ * heap_zone_prefetch_worker -- (internal) walks the zones that are not yet
+ *	materialized
+ */
+static void *
+heap_zone_prefetch_worker(void *arg)
+{
+	struct zone_prefetch *zp = arg;
+	struct heap_rt *h = zp->heap->rt;
+
+	for (uint32_t zone_id = 1; zone_id < zp->nzones; ++zone_id) {
+		unsigned zones_exhausted;
+		util_atomic_load_explicit32(&h->zones_exhausted,
+			&zones_exhausted, memory_order_relaxed);
+		if (zone_id < zones_exhausted)
+			continue;
+
+		heap_zone_prefetch_zone(zp, zone_id);
+	}
+
+	return NULL;
+}
+
+/*
+ * heap_zone_prefetch_start -- (internal) starts faulting in the zones after
+ *	the first one in the background
+ */
+static void
+heap_zone_prefetch_start(struct palloc_heap *heap)
+{
+	struct heap_rt *h = heap->rt;
+
+	if (h->nzones < 2 || On_valgrind)
+		return;
+
+	struct zone_prefetch *zp = Malloc(sizeof(*zp));
+	if (zp == NULL) {
+		LOG(2, "cannot allocate zone prefetch");
+		return;
+	}
+
+	zp->heap = heap;
+	zp->nzones = h->nzones;
+	zp->heap_size = *heap->sizep;
+	zp->stop = 0;
+
+	if (os_thread_create(&zp->thread, NULL,
+			heap_zone_prefetch_worker, zp) != 0) {
+		LOG(2, "cannot start zone prefetch");
+		Free(zp);
+		return;
+	}
+
+	h->zone_prefetch = zp;
+}
+
+/*
+ * heap_zone_prefetch_stop -- (internal) stops faulting in the zones
+ */
+static void
+heap_zone_prefetch_stop(struct heap_rt *h)
+{
+	struct zone_prefetch *zp = h->zone_prefetch;
+	if (zp == NULL)
+		return;
+
+	util_atomic_store_explicit32(&zp->stop, 1, memory_order_relaxed);
+	os_thread_join(&zp->thread, NULL);
+	Free(zp);
+	h->zone_prefetch = NULL;
+}
+
 /*
  * heap_memblock_insert_block -- (internal) bucket insert wrapper for callbacks
  */
@@ -592,18 +1069,30 @@ heap_populate_bucket(struct palloc_heap *heap, struct bucket *bucket)
 	if (h->zones_exhausted == h->nzones)
 		return ENOMEM;
 
-	uint32_t zone_id = h->zones_exhausted++;
+	uint32_t zone_id = h->zones_exhausted;
+	util_atomic_store_explicit32(&h->zones_exhausted, zone_id + 1,
+		memory_order_relaxed);
 	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
 
 	/* ignore zone and chunk headers */
 	VALGRIND_ADD_TO_GLOBAL_TX_IGNORE(z, sizeof(z->header) +
 		sizeof(z->chunk_headers));
 
+	/*
+	 * The zones are only initialized, or updated after the pool was
+	 * extended, when they are first needed, so that opening the pool does
+	 * not depend on its size.
+	 */
 	if (z->header.magic != ZONE_HEADER_MAGIC)
 		heap_zone_init(heap, zone_id, 0);
+	else
+		heap_zone_update_if_needed(heap, zone_id);
 
 	heap_reclaim_zone_garbage(heap, bucket, zone_id);
 
+	if (zone_id == 0)
+		heap_zone_prefetch_start(heap);
+
 	/*
 	 * It doesn't matter that this function might not have found any
 	 * free blocks because there is still potential that subsequent calls
@@ -1280,8 +1769,9 @@ heap_extend(struct palloc_heap *heap, struct bucket *b, size_t size)
 	pmemops_persist(&heap->p_ops, heap->sizep, sizeof(*heap->sizep));
 
 	/*
-	 * If interrupted after changing the size, the heap will just grow
-	 * automatically on the next heap_boot.
+	 * If interrupted after changing the size, the new chunks are added
+	 * to the last zone, or the new zone is initialized, when
+	 * heap_populate_bucket first reaches it after the next heap_boot.
 	 */
 
 	uint32_t nzones = heap_max_zone(*heap->sizep);
@@ -1309,29 +1799,6 @@ heap_extend(struct palloc_heap *heap, struct bucket *b, size_t size)
 	return 1;
 }
 
-/*
- * heap_zone_update_if_needed -- updates the zone metadata if the pool has been
- *	extended.
- */
-static void
-heap_zone_update_if_needed(struct palloc_heap *heap)
-{
-	struct zone *z;
-
-	for (uint32_t i = 0; i < heap->rt->nzones; ++i) {
-		z = ZID_TO_ZONE(heap->layout, i);
-		if (z->header.magic != ZONE_HEADER_MAGIC)
-			continue;
-
-		size_t size_idx = zone_calc_size_idx(i, heap->rt->nzones,
-			*heap->sizep);
-		if (size_idx == z->header.size_idx)
-			continue;
-
-		heap_zone_init(heap, i, z->header.size_idx);
-	}
-}
-
 /*
  * heap_boot -- opens the heap region of the pmemobj pool
  *
@@ -1388,6 +1855,10 @@ heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 
 	os_tls_key_create(&h->thread_arena, heap_thread_arena_destructor);
 
+	os_tls_key_create(&h->thread_cache, heap_thread_cache_destructor);
+	VEC_INIT(&h->thread_caches);
+	util_mutex_init(&h->thread_caches_lock);
+
 	heap->p_ops = *p_ops;
 	heap->layout = heap_start;
 	heap->rt = h;
@@ -1397,6 +1868,7 @@ heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 	heap->set = set;
 	heap->growsize = HEAP_DEFAULT_GROW_SIZE;
 	heap->alloc_pattern = PALLOC_CTL_DEBUG_NO_PATTERN;
+	heap->thread_cache_size = HEAP_THREAD_CACHE_DEFAULT_SIZE;
 	VALGRIND_DO_CREATE_MEMPOOL(heap->layout, 0, 0);
 
 	for (unsigned i = 0; i < narenas_default; ++i) {
@@ -1409,7 +1881,7 @@ heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 	for (unsigned i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
 		h->recyclers[i] = NULL;
 
-	heap_zone_update_if_needed(heap);
+	h->zone_prefetch = NULL;
 
 	return 0;
 
@@ -1490,9 +1962,23 @@ heap_cleanup(struct palloc_heap *heap)
 {
 	struct heap_rt *rt = heap->rt;
 
+	heap_zone_prefetch_stop(rt);
+
 	alloc_class_collection_delete(rt->alloc_classes);
 
 	os_tls_key_delete(rt->thread_arena);
+
+	/*
+	 * The cached blocks are only reserved in the transient state, which
+	 * is going away with the buckets.
+	 */
+	os_tls_key_delete(rt->thread_cache);
+	struct heap_thread_cache *tc;
+	VEC_FOREACH(tc, &rt->thread_caches)
+		heap_thread_cache_delete(tc);
+	VEC_DELETE(&rt->thread_caches);
+	util_mutex_destroy(&rt->thread_caches_lock);
+
 	bucket_delete(rt->default_bucket);
 
 	struct arena *arena;
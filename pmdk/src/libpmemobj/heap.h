@@ -57,6 +57,10 @@ extern "C" {
 #define BIT_IS_CLR(a, i)	(!((a) & (1ULL << (i))))
 #define HEAP_ARENA_PER_THREAD (0)
 
+/* blocks cached per allocation class in the thread caches */
+#define HEAP_THREAD_CACHE_DEFAULT_SIZE (32)
+#define HEAP_THREAD_CACHE_MAX_SIZE (1024)
+
 int heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 		uint64_t *sizep,
 		void *base, struct pmem_ops *p_ops,
@@ -83,6 +87,13 @@ heap_bucket_acquire(struct palloc_heap *heap, uint8_t class_id,
 void
 heap_bucket_release(struct palloc_heap *heap, struct bucket *b);
 
+int heap_thread_cache_get(struct palloc_heap *heap, struct alloc_class *c,
+	struct memory_block *m, int **resvp);
+void heap_thread_cache_put(struct palloc_heap *heap, struct alloc_class *c,
+	const struct memory_block *m, int *resvp);
+void heap_thread_cache_flush(struct palloc_heap *heap);
+void heap_thread_caches_flush(struct palloc_heap *heap);
+
 int heap_get_bestfit_block(struct palloc_heap *heap, struct bucket *b,
 	struct memory_block *m);
 struct memory_block
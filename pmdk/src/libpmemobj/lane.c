@@ -49,12 +49,37 @@
 #include "out.h"
 #include "util.h"
 #include "obj.h"
+#include "os.h"
 #include "os_thread.h"
 #include "valgrind_internal.h"
 #include "memops.h"
 #include "palloc.h"
 #include "tx.h"
 
+#define LANE_RECOVERY_THREADS_ENV_VARIABLE "PMEMOBJ_RECOVERY_THREADS"
+
+/* the default and maximum number of threads recovering the redo logs */
+#define LANE_RECOVERY_THREADS 4
+#define LANE_RECOVERY_THREADS_MAX 64
+
+/* the least number of lanes to recover worth starting another thread for */
+#define LANE_RECOVERY_MIN_PER_THREAD 16
+
+/* lane_redo_recovery.applied flags */
+#define LANE_REDO_INTERNAL_APPLIED (1 << 0)
+#define LANE_REDO_EXTERNAL_APPLIED (1 << 1)
+
+/*
+ * lane_redo_recovery -- a range of lanes whose redo logs are recovered by
+ *	a single thread
+ */
+struct lane_redo_recovery {
+	PMEMobjpool *pop;
+	uint64_t *lanes; /* indexes of the lanes with non-empty redo logs */
+	uint8_t *applied; /* which of the redo logs of each lane were applied */
+	size_t nlanes;
+};
+
 static os_tls_key_t Lane_info_key;
 
 static __thread struct critnib *Lane_info_ht;
@@ -366,6 +391,151 @@ lane_cleanup(PMEMobjpool *pop)
 	lane_info_cleanup(pop);
 }
 
+/*
+ * lane_recovery_threads -- (internal) returns the number of threads recovering
+ *	the redo logs, PMEMOBJ_RECOVERY_THREADS if it is a valid positive integer
+ */
+static unsigned
+lane_recovery_threads(void)
+{
+	char *env_threads = os_getenv(LANE_RECOVERY_THREADS_ENV_VARIABLE);
+	if (env_threads) {
+		int nthreads = atoi(env_threads);
+		if (nthreads <= 0) {
+			ERR("%s variable must be a positive integer",
+					LANE_RECOVERY_THREADS_ENV_VARIABLE);
+			return LANE_RECOVERY_THREADS;
+		}
+
+		return (unsigned)(LANE_RECOVERY_THREADS_MAX < nthreads ?
+			LANE_RECOVERY_THREADS_MAX : nthreads);
+	}
+
+	return LANE_RECOVERY_THREADS;
+}
+
+/*
+ * lane_redo_apply -- (internal) applies the redo logs of a range of lanes,
+ *	without draining them
+ */
+static void *
+lane_redo_apply(void *arg)
+{
+	struct lane_redo_recovery *r = arg;
+	PMEMobjpool *pop = r->pop;
+
+	for (size_t i = 0; i < r->nlanes; ++i) {
+		struct lane_layout *layout = lane_get_layout(pop, r->lanes[i]);
+
+		if (ulog_recover_apply((struct ulog *)&layout->internal,
+				OBJ_OFF_IS_VALID_FROM_CTX, &pop->p_ops))
+			r->applied[i] |= LANE_REDO_INTERNAL_APPLIED;
+		if (ulog_recover_apply((struct ulog *)&layout->external,
+				OBJ_OFF_IS_VALID_FROM_CTX, &pop->p_ops))
+			r->applied[i] |= LANE_REDO_EXTERNAL_APPLIED;
+	}
+
+	return NULL;
+}
+
+/*
+ * lane_redo_recover -- (internal) recovers the internal/external redo logs of
+ *	all lanes
+ *
+ * The lanes with non-empty redo logs are split between up to
+ * PMEMOBJ_RECOVERY_THREADS threads. Only the flushes are issued while the
+ * logs are applied, the logs are clobbered after a single drain, and
+ * the clobbering is drained once for all of them.
+ */
+static int
+lane_redo_recover(PMEMobjpool *pop)
+{
+	uint64_t *lanes = Malloc(sizeof(*lanes) * pop->nlanes);
+	if (lanes == NULL) {
+		ERR("!Malloc of recovered lanes");
+		return ENOMEM;
+	}
+
+	size_t nlanes = 0;
+	for (uint64_t i = 0; i < pop->nlanes; ++i) {
+		struct lane_layout *layout = lane_get_layout(pop, i);
+
+		if (ulog_base_nbytes((struct ulog *)&layout->internal) != 0 ||
+		    ulog_base_nbytes((struct ulog *)&layout->external) != 0)
+			lanes[nlanes++] = i;
+	}
+
+	if (nlanes == 0) {
+		Free(lanes);
+		return 0;
+	}
+
+	uint8_t *applied = Zalloc(sizeof(*applied) * nlanes);
+	if (applied == NULL) {
+		ERR("!Malloc of recovered lanes");
+		Free(lanes);
+		return ENOMEM;
+	}
+
+	size_t nthreads = lane_recovery_threads();
+	if (nthreads > nlanes / LANE_RECOVERY_MIN_PER_THREAD)
+		nthreads = nlanes / LANE_RECOVERY_MIN_PER_THREAD;
+	if (nthreads == 0)
+		nthreads = 1;
+
+	LOG(4, "recovering %zu lanes on %zu threads", nlanes, nthreads);
+
+	struct lane_redo_recovery ranges[LANE_RECOVERY_THREADS_MAX];
+	for (size_t t = 0; t < nthreads; ++t) {
+		size_t start = nlanes * t / nthreads;
+		size_t end = nlanes * (t + 1) / nthreads;
+
+		ranges[t].pop = pop;
+		ranges[t].lanes = lanes + start;
+		ranges[t].applied = applied + start;
+		ranges[t].nlanes = end - start;
+	}
+
+	/* the calling thread recovers the first range itself */
+	os_thread_t threads[LANE_RECOVERY_THREADS_MAX];
+	int started[LANE_RECOVERY_THREADS_MAX];
+	for (size_t t = 1; t < nthreads; ++t) {
+		started[t] = os_thread_create(&threads[t], NULL,
+			lane_redo_apply, &ranges[t]) == 0;
+		if (!started[t]) {
+			LOG(2, "cannot start a recovery thread, errno %d",
+				errno);
+			lane_redo_apply(&ranges[t]);
+		}
+	}
+	lane_redo_apply(&ranges[0]);
+	for (size_t t = 1; t < nthreads; ++t) {
+		if (started[t])
+			os_thread_join(&threads[t], NULL);
+	}
+
+	/* the logs can be discarded only once all of their entries are durable */
+	pmemops_drain(&pop->p_ops);
+
+	for (size_t i = 0; i < nlanes; ++i) {
+		struct lane_layout *layout = lane_get_layout(pop, lanes[i]);
+
+		if (applied[i] & LANE_REDO_INTERNAL_APPLIED)
+			ulog_recover_clobber((struct ulog *)&layout->internal,
+				&pop->p_ops);
+		if (applied[i] & LANE_REDO_EXTERNAL_APPLIED)
+			ulog_recover_clobber((struct ulog *)&layout->external,
+				&pop->p_ops);
+	}
+
+	pmemops_drain(&pop->p_ops);
+
+	Free(applied);
+	Free(lanes);
+
+	return 0;
+}
+
 /*
  * lane_recover_and_section_boot -- performs initialization and recovery of all
  * lanes
@@ -379,35 +549,49 @@ lane_recover_and_section_boot(PMEMobjpool *pop)
 
 	int err = 0;
 	uint64_t i; /* lane index */
-	struct lane_layout *layout;
+
+	/*
+	 * The duration of each phase is recorded regardless of whether
+	 * statistics are enabled, they can't be enabled before the open.
+	 */
+	struct stats_transient *st = pop->stats->transient;
+	uint64_t start = stats_clock_ns();
 
 	/*
 	 * First we need to recover the internal/external redo logs so that the
 	 * allocator state is consistent before we boot it.
 	 */
-	for (i = 0; i < pop->nlanes; ++i) {
-		layout = lane_get_layout(pop, i);
+	if ((err = lane_redo_recover(pop)) != 0)
+		return err;
 
-		ulog_recover((struct ulog *)&layout->internal,
-			OBJ_OFF_IS_VALID_FROM_CTX, &pop->p_ops);
-		ulog_recover((struct ulog *)&layout->external,
-			OBJ_OFF_IS_VALID_FROM_CTX, &pop->p_ops);
-	}
+	uint64_t redo_end = stats_clock_ns();
+	st->recovery_redo_ns = redo_end - start;
 
 	if ((err = pmalloc_boot(pop)) != 0)
 		return err;
 
+	uint64_t boot_end = stats_clock_ns();
+	st->recovery_heap_boot_ns = boot_end - redo_end;
+
 	/*
 	 * Undo logs must be processed after the heap is initialized since
 	 * a undo recovery might require deallocation of the next ulogs.
+	 * The entries of all undo logs are applied before a single drain,
+	 * and only then the logs are clobbered.
 	 */
 	for (i = 0; i < pop->nlanes; ++i) {
 		struct operation_context *ctx = pop->lanes_desc.lane[i].undo;
 		operation_resume(ctx);
 		operation_process(ctx);
-		operation_finish(ctx);
 	}
 
+	pmemops_drain(&pop->p_ops);
+
+	for (i = 0; i < pop->nlanes; ++i)
+		operation_finish(pop->lanes_desc.lane[i].undo);
+
+	st->recovery_undo_ns = stats_clock_ns() - boot_end;
+
 	return 0;
 }
 
@@ -155,6 +155,14 @@ operation_transient_clean(void *base, const void *addr, size_t len,
 	return 0;
 }
 
+/*
+ * operation_transient_drain -- transient drain wrapper
+ */
+static void
+operation_transient_drain(void *base)
+{
+}
+
 /*
  * operation_transient_memcpy -- transient memcpy wrapper
  */
@@ -197,6 +205,7 @@ operation_new(struct ulog *ulog, size_t ulog_base_nbytes,
 
 	ctx->t_ops.base = NULL;
 	ctx->t_ops.flush = operation_transient_clean;
+	ctx->t_ops.drain = operation_transient_drain;
 	ctx->t_ops.memcpy = operation_transient_memcpy;
 
 	ctx->s_ops.base = p_ops->base;
@@ -439,13 +448,16 @@ operation_process_persistent_redo(struct operation_context *ctx)
 
 /*
  * operation_process_persistent_undo -- (internal) process using ulog
+ *
+ * The undo log is only processed during recovery, which drains once for
+ * all lanes before any of the logs is clobbered.
  */
 static void
 operation_process_persistent_undo(struct operation_context *ctx)
 {
 	ASSERTeq(ctx->pshadow_ops.capacity % CACHELINE_SIZE, 0);
 
-	ulog_process(ctx->ulog, OBJ_OFF_IS_VALID_FROM_CTX, ctx->p_ops);
+	ulog_process_nodrain(ctx->ulog, OBJ_OFF_IS_VALID_FROM_CTX, ctx->p_ops);
 }
 
 /*
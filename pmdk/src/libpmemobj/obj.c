@@ -41,6 +41,7 @@
 #include "valgrind_internal.h"
 #include "libpmem.h"
 #include "memblock.h"
+#include "checksum.h"
 #include "critnib.h"
 #include "list.h"
 #include "mmap.h"
@@ -310,6 +311,7 @@ obj_init(void)
 	if (obj_ctl_init_and_load(NULL))
 		FATAL("error: %s", pmemobj_errormsg());
 
+	checksum_init();
 	lane_info_boot();
 
 	util_remote_init();
@@ -233,9 +233,41 @@ palloc_reservation_create(struct palloc_heap *heap, size_t size,
 	*new_block = MEMORY_BLOCK_NONE;
 	new_block->size_idx = (uint32_t)size_idx;
 
+	/*
+	 * Small blocks of the classes frequently used by the thread are
+	 * already reserved in its cache, which avoids the bucket lock.
+	 */
+	int *resvp;
+	if (arena_id == HEAP_ARENA_PER_THREAD &&
+	    heap_thread_cache_get(heap, c, new_block, &resvp) == 0) {
+		if (alloc_prep_block(heap, new_block, constructor, arg,
+			extra_field, object_flags, &out->offset) != 0) {
+			heap_thread_cache_put(heap, c, new_block, resvp);
+			errno = ECANCELED;
+			return -1;
+		}
+
+		out->resvp = resvp;
+		out->lock = new_block->m_ops->get_lock(new_block);
+		out->new_state = MEMBLOCK_ALLOCATED;
+
+		return 0;
+	}
+
 	struct bucket *b = heap_bucket_acquire(heap, c->id, arena_id);
 
 	err = heap_get_bestfit_block(heap, b, new_block);
+	if (err == ENOMEM) {
+		/*
+		 * The blocks still cached by the threads might be the only
+		 * free ones left, give them back to the buckets and retry.
+		 */
+		heap_bucket_release(heap, b);
+		heap_thread_caches_flush(heap);
+		b = heap_bucket_acquire(heap, c->id, arena_id);
+
+		err = heap_get_bestfit_block(heap, b, new_block);
+	}
 	if (err != 0)
 		goto out;
 
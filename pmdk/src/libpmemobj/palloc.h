@@ -65,6 +65,9 @@ struct palloc_heap {
 	void *base;
 
 	int alloc_pattern;
+
+	/* the number of blocks per magazine of the thread caches */
+	unsigned thread_cache_size;
 };
 
 struct memory_block;
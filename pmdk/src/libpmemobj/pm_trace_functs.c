@@ -1,28 +1,46 @@
 #include "pm_trace_functs.h"
+#ifdef XFDETECTOR_RT
+#include "xfdetector_rt.h"
+#endif
 
 // PM Address range manipulation
 void __attribute__ ((noinline))
 pm_trace_pm_addr_add(uint64_t addr, uint64_t size){
+#ifdef XFDETECTOR_RT
+    XFD_RT_CALL(xfd_rt_pm_addr_add, addr, size);
+#endif
     return;
 }
 
 void pm_trace_pm_addr_remove(uint64_t addr, uint64_t size){
+#ifdef XFDETECTOR_RT
+    XFD_RT_CALL(xfd_rt_pm_addr_remove, addr, size);
+#endif
     return;
 }
 
 // Transaction annotation
 void __attribute__ ((noinline))
 pm_trace_tx_begin(void){
+#ifdef XFDETECTOR_RT
+    XFD_RT_CALL(xfd_rt_tx_begin);
+#endif
     return;
 }
 
 void __attribute__ ((noinline))
 pm_trace_tx_end(void){
+#ifdef XFDETECTOR_RT
+    XFD_RT_CALL(xfd_rt_tx_end);
+#endif
     return;
 }
 
 void __attribute__ ((noinline))
 pm_trace_tx_addr_add(uint64_t addr, uint64_t size){
+#ifdef XFDETECTOR_RT
+    XFD_RT_CALL(xfd_rt_tx_addr_add, addr, size);
+#endif
     return;
 }
 
@@ -633,6 +633,53 @@ CTL_WRITE_HANDLER(arena_id)(void *ctx,
 
 static const struct ctl_argument CTL_ARG(arena_id) = CTL_ARG_LONG_LONG;
 
+/*
+ * CTL_READ_HANDLER(cache_size) -- reads the number of blocks cached per
+ *	allocation class by each thread
+ */
+static int
+CTL_READ_HANDLER(cache_size)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t *arg_out = arg;
+
+	*arg_out = (ssize_t)pop->heap.thread_cache_size;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(cache_size) -- changes the number of blocks cached per
+ *	allocation class by each thread
+ */
+static int
+CTL_WRITE_HANDLER(cache_size)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t arg_in = *(int *)arg;
+	if (arg_in < 0 || arg_in > HEAP_THREAD_CACHE_MAX_SIZE) {
+		ERR("invalid thread cache size, must be between 0 and %d",
+			HEAP_THREAD_CACHE_MAX_SIZE);
+		errno = EINVAL;
+		return -1;
+	}
+
+	unsigned old_size = pop->heap.thread_cache_size;
+	pop->heap.thread_cache_size = (unsigned)arg_in;
+
+	/* the blocks over the new size are not kept by the calling thread */
+	if ((unsigned)arg_in < old_size)
+		heap_thread_cache_flush(&pop->heap);
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(cache_size) = CTL_ARG_LONG_LONG;
+
 /*
  * CTL_WRITE_HANDLER(automatic) -- updates automatic status of the arena
  */
@@ -803,6 +850,7 @@ static const struct ctl_node CTL_NODE(narenas)[] = {
 
 static const struct ctl_node CTL_NODE(thread)[] = {
 	CTL_LEAF_RW(arena_id),
+	CTL_LEAF_RW(cache_size),
 
 	CTL_NODE_END
 };
@@ -35,6 +35,7 @@
  */
 
 #include "obj.h"
+#include "os.h"
 #include "stats.h"
 
 STATS_CTL_HANDLER(persistent, curr_allocated, heap_curr_allocated);
@@ -45,6 +46,18 @@ static const struct ctl_node CTL_NODE(heap)[] = {
 	CTL_NODE_END
 };
 
+STATS_CTL_HANDLER(transient, redo_ns, recovery_redo_ns);
+STATS_CTL_HANDLER(transient, heap_boot_ns, recovery_heap_boot_ns);
+STATS_CTL_HANDLER(transient, undo_ns, recovery_undo_ns);
+
+static const struct ctl_node CTL_NODE(recovery)[] = {
+	STATS_CTL_LEAF(transient, redo_ns),
+	STATS_CTL_LEAF(transient, heap_boot_ns),
+	STATS_CTL_LEAF(transient, undo_ns),
+
+	CTL_NODE_END
+};
+
 /*
  * CTL_READ_HANDLER(enabled) -- returns whether or not statistics are enabled
  */
@@ -83,6 +96,7 @@ static const struct ctl_argument CTL_ARG(enabled) = CTL_ARG_BOOLEAN;
 
 static const struct ctl_node CTL_NODE(stats)[] = {
 	CTL_CHILD(heap),
+	CTL_CHILD(recovery),
 	CTL_LEAF_RW(enabled),
 
 	CTL_NODE_END
@@ -126,6 +140,18 @@ stats_delete(PMEMobjpool *pop, struct stats *s)
 	Free(s);
 }
 
+/*
+ * stats_clock_ns -- returns the monotonic time in nanoseconds
+ */
+uint64_t
+stats_clock_ns(void)
+{
+	struct timespec ts;
+	os_clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
 /*
  * stats_ctl_register -- registers ctl nodes for statistics
  */
@@ -44,7 +44,10 @@ extern "C" {
 #endif
 
 struct stats_transient {
-	int unused;
+	/* duration of the recovery phases of the last open, in nanoseconds */
+	uint64_t recovery_redo_ns;
+	uint64_t recovery_heap_boot_ns;
+	uint64_t recovery_undo_ns;
 };
 
 struct stats_persistent {
@@ -91,6 +94,8 @@ static int CTL_READ_HANDLER(type##_##name)(void *ctx,\
 
 void stats_ctl_register(PMEMobjpool *pop);
 
+uint64_t stats_clock_ns(void);
+
 struct stats *stats_new(PMEMobjpool *pop);
 void stats_delete(PMEMobjpool *pop, struct stats *stats);
 
@@ -128,6 +128,21 @@ tx_range_def_cmp(const void *lhs, const void *rhs)
 	return 0;
 }
 
+/*
+ * tx_range_def_merge_flags -- (internal) updates the flags of a range that
+ *	was merged with another one
+ *
+ * A merged range is flushed on commit unless none of its parts asked to skip
+ * the flush.
+ */
+static void
+tx_range_def_merge_flags(struct tx_range_def *dst,
+	const struct tx_range_def *src)
+{
+	if (!(src->flags & POBJ_FLAG_NO_FLUSH))
+		dst->flags &= ~POBJ_FLAG_NO_FLUSH;
+}
+
 /*
  * tx_params_new -- creates a new transactional parameters instance and fills it
  *	with default values.
@@ -140,6 +155,7 @@ tx_params_new(void)
 		return NULL;
 
 	tx_params->cache_size = TX_DEFAULT_RANGE_CACHE_SIZE;
+	tx_params->snapshot_cacheline = 0;
 
 	return tx_params;
 }
@@ -1184,6 +1200,7 @@ pmemobj_tx_add_common(struct tx *tx, struct tx_range_def *args)
 				ASSERTeq(rend, fprev->offset);
 				fprev->offset -= r.size;
 				fprev->size += r.size;
+				tx_range_def_merge_flags(fprev, args);
 			} else {
 				/*
 				 * If we don't have anything adjacent, create
@@ -1220,6 +1237,7 @@ pmemobj_tx_add_common(struct tx *tx, struct tx_range_def *args)
 			size_t intersection = fend - MAX(f->offset, r.offset);
 			r.size -= intersection + snapshot.size;
 			f->size += snapshot.size;
+			tx_range_def_merge_flags(f, args);
 
 			if (snapshot.size != 0) {
 				ret = pmemobj_tx_add_snapshot(tx, &snapshot);
@@ -1235,6 +1253,7 @@ pmemobj_tx_add_common(struct tx *tx, struct tx_range_def *args)
 				struct tx_range_def *fprev = ravl_data(nprev);
 				ASSERTeq(rend, fprev->offset);
 				f->size += fprev->size;
+				tx_range_def_merge_flags(f, fprev);
 				ravl_remove(tx->ranges, nprev);
 			}
 		} else if (fend >= r.offset) {
@@ -1258,6 +1277,7 @@ pmemobj_tx_add_common(struct tx *tx, struct tx_range_def *args)
 			 */
 			size_t overlap = rend - MAX(f->offset, r.offset);
 			r.size -= overlap;
+			tx_range_def_merge_flags(f, args);
 		} else {
 			ASSERT(0);
 		}
@@ -1350,6 +1370,39 @@ pmemobj_tx_xadd_range_direct(const void *ptr, size_t size, uint64_t flags)
 	return ret;
 }
 
+/*
+ * tx_range_def_align -- (internal) extends the range to the cache lines it
+ *	touches, without going outside of the object
+ *
+ * Fields of an object added one by one then share one snapshot per cache line
+ * instead of getting an undo log entry each. Ranges which are not flushed on
+ * commit are left as they are, the rest of their cache lines may still need a
+ * flush.
+ */
+static void
+tx_range_def_align(struct tx *tx, PMEMoid oid, struct tx_range_def *def)
+{
+	PMEMobjpool *pop = tx->pop;
+
+	/* the padding between the fields might not be initialized */
+	if (!pop->tx_params->snapshot_cacheline || On_valgrind ||
+	    def->size == 0 || (def->flags & POBJ_FLAG_NO_FLUSH))
+		return;
+
+	uint64_t obj_end = oid.off + palloc_usable_size(&pop->heap, oid.off);
+	uint64_t end = def->offset + def->size;
+
+	/* ranges outside of the object are left as they are */
+	if (def->offset < oid.off || end < def->offset || end > obj_end)
+		return;
+
+	uint64_t begin = MAX(ALIGN_DOWN(def->offset, CACHELINE_SIZE), oid.off);
+	end = MIN(ALIGN_UP(end, CACHELINE_SIZE), obj_end);
+
+	def->offset = begin;
+	def->size = end - begin;
+}
+
 /*
  * pmemobj_tx_add_range -- adds persistent memory range into the transaction
  */
@@ -1378,6 +1431,8 @@ pmemobj_tx_add_range(PMEMoid oid, uint64_t hoff, size_t size)
 		.flags = 0,
 	};
 
+	tx_range_def_align(tx, oid, &args);
+
 	int ret = pmemobj_tx_add_common(tx, &args);
 
 	PMEMOBJ_API_END();
@@ -1420,6 +1475,8 @@ pmemobj_tx_xadd_range(PMEMoid oid, uint64_t hoff, size_t size, uint64_t flags)
 		.flags = flags,
 	};
 
+	tx_range_def_align(tx, oid, &args);
+
 	ret = pmemobj_tx_add_common(tx, &args);
 	PMEMOBJ_API_END();
 	return ret;
@@ -1806,6 +1863,48 @@ static const struct ctl_node CTL_NODE(cache)[] = {
 	CTL_NODE_END
 };
 
+/*
+ * CTL_READ_HANDLER(cacheline) -- returns whether the snapshots are aligned to
+ *	cache lines
+ */
+static int
+CTL_READ_HANDLER(cacheline)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	int *arg_out = arg;
+
+	*arg_out = pop->tx_params->snapshot_cacheline;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(cacheline) -- sets whether the snapshots are aligned to
+ *	cache lines
+ */
+static int
+CTL_WRITE_HANDLER(cacheline)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	int arg_in = *(int *)arg;
+
+	pop->tx_params->snapshot_cacheline = arg_in;
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(cacheline) = CTL_ARG_BOOLEAN;
+
+static const struct ctl_node CTL_NODE(snapshot)[] = {
+	CTL_LEAF_RW(cacheline),
+
+	CTL_NODE_END
+};
+
 /*
  * CTL_READ_HANDLER(skip_expensive_checks) -- returns "skip_expensive_checks"
  * var from pool ctl
@@ -1901,6 +2000,7 @@ static const struct ctl_node CTL_NODE(post_commit)[] = {
 static const struct ctl_node CTL_NODE(tx)[] = {
 	CTL_CHILD(debug),
 	CTL_CHILD(cache),
+	CTL_CHILD(snapshot),
 	CTL_CHILD(post_commit),
 
 	CTL_NODE_END
@@ -55,6 +55,7 @@ extern "C" {
 
 struct tx_parameters {
 	size_t cache_size;
+	int snapshot_cacheline;
 };
 
 /*
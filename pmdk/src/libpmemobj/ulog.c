@@ -35,10 +35,12 @@
  */
 
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "libpmemobj.h"
 #include "ulog.h"
+#include "checksum.h"
 #include "out.h"
 #include "util.h"
 #include "valgrind_internal.h"
@@ -56,6 +58,26 @@
 #define IS_CACHELINE_ALIGNED(ptr)\
 	(((uintptr_t)(ptr) & (CACHELINE_SIZE - 1)) == 0)
 
+/* the number of modified ranges collected before they are flushed */
+#define ULOG_FLUSH_BATCH 64
+
+/*
+ * ulog_flush_range -- cacheline aligned range modified by ulog entries
+ */
+struct ulog_flush_range {
+	uintptr_t begin;
+	uintptr_t end;
+};
+
+/*
+ * ulog_flush_batch -- ranges modified by the processed entries, flushed
+ *	only once all of them are written
+ */
+struct ulog_flush_batch {
+	struct ulog_flush_range ranges[ULOG_FLUSH_BATCH];
+	size_t nranges;
+};
+
 /*
  * ulog_by_offset -- (internal) calculates the ulog pointer
  */
@@ -140,7 +162,7 @@ ulog_entry_valid(const struct ulog_entry_base *entry)
 		case ULOG_OPERATION_BUF_SET:
 			size = ulog_entry_size(entry);
 			b = (struct ulog_entry_buf *)entry;
-			if (!util_checksum(b, size, &b->checksum, 0, 0))
+			if (!checksum_compute(b, size, &b->checksum, 0))
 				return 0;
 			break;
 		default:
@@ -280,8 +302,8 @@ ulog_reserve(struct ulog *ulog,
 static int
 ulog_checksum(struct ulog *ulog, size_t ulog_base_bytes, int insert)
 {
-	return util_checksum(ulog, SIZEOF_ULOG(ulog_base_bytes),
-		&ulog->checksum, insert, 0);
+	return checksum_compute(ulog, SIZEOF_ULOG(ulog_base_bytes),
+		&ulog->checksum, insert);
 }
 
 /*
@@ -462,11 +484,11 @@ ulog_entry_buf_create(struct ulog *ulog, size_t offset, uint64_t *dest,
 		VALGRIND_REMOVE_FROM_TX(dest, CACHELINE_SIZE);
 	}
 
-	b->checksum = util_checksum_seq(b, CACHELINE_SIZE, 0);
+	b->checksum = checksum_seq(b, CACHELINE_SIZE, 0);
 	if (rcopy != 0)
-		b->checksum = util_checksum_seq(srcof, rcopy, b->checksum);
+		b->checksum = checksum_seq(srcof, rcopy, b->checksum);
 	if (lcopy != 0)
-		b->checksum = util_checksum_seq(last_cacheline,
+		b->checksum = checksum_seq(last_cacheline,
 			CACHELINE_SIZE, b->checksum);
 
 	ASSERT(IS_CACHELINE_ALIGNED(e));
@@ -484,11 +506,13 @@ ulog_entry_buf_create(struct ulog *ulog, size_t offset, uint64_t *dest,
 }
 
 /*
- * ulog_entry_apply -- applies modifications of a single ulog entry
+ * ulog_entry_write -- (internal) applies modifications of a single ulog entry,
+ *	flushes them with 'f' unless it is NULL and returns the number of
+ *	modified bytes at *dstp
  */
-void
-ulog_entry_apply(const struct ulog_entry_base *e, int persist,
-	const struct pmem_ops *p_ops)
+static size_t
+ulog_entry_write(const struct ulog_entry_base *e, flush_fn f,
+	unsigned mem_flags, const struct pmem_ops *p_ops, uint64_t **dstp)
 {
 	ulog_operation_type t = ulog_entry_type(e);
 	uint64_t offset = ulog_entry_offset(e);
@@ -499,32 +523,33 @@ ulog_entry_apply(const struct ulog_entry_base *e, int persist,
 	struct ulog_entry_val *ev;
 	struct ulog_entry_buf *eb;
 
-	flush_fn f = persist ? p_ops->persist : p_ops->flush;
-
 	switch (t) {
 		case ULOG_OPERATION_AND:
 			ev = (struct ulog_entry_val *)e;
 
 			VALGRIND_ADD_TO_TX(dst, dst_size);
 			*dst &= ev->value;
-			f(p_ops->base, dst, sizeof(uint64_t),
-				PMEMOBJ_F_RELAXED);
+			if (f != NULL)
+				f(p_ops->base, dst, sizeof(uint64_t),
+					PMEMOBJ_F_RELAXED);
 		break;
 		case ULOG_OPERATION_OR:
 			ev = (struct ulog_entry_val *)e;
 
 			VALGRIND_ADD_TO_TX(dst, dst_size);
 			*dst |= ev->value;
-			f(p_ops->base, dst, sizeof(uint64_t),
-				PMEMOBJ_F_RELAXED);
+			if (f != NULL)
+				f(p_ops->base, dst, sizeof(uint64_t),
+					PMEMOBJ_F_RELAXED);
 		break;
 		case ULOG_OPERATION_SET:
 			ev = (struct ulog_entry_val *)e;
 
 			VALGRIND_ADD_TO_TX(dst, dst_size);
 			*dst = ev->value;
-			f(p_ops->base, dst, sizeof(uint64_t),
-				PMEMOBJ_F_RELAXED);
+			if (f != NULL)
+				f(p_ops->base, dst, sizeof(uint64_t),
+					PMEMOBJ_F_RELAXED);
 		break;
 		case ULOG_OPERATION_BUF_SET:
 			eb = (struct ulog_entry_buf *)e;
@@ -532,7 +557,7 @@ ulog_entry_apply(const struct ulog_entry_base *e, int persist,
 			dst_size = eb->size;
 			VALGRIND_ADD_TO_TX(dst, dst_size);
 			pmemops_memset(p_ops, dst, *eb->data, eb->size,
-				PMEMOBJ_F_RELAXED | PMEMOBJ_F_MEM_NODRAIN);
+				mem_flags);
 		break;
 		case ULOG_OPERATION_BUF_CPY:
 			eb = (struct ulog_entry_buf *)e;
@@ -540,12 +565,103 @@ ulog_entry_apply(const struct ulog_entry_base *e, int persist,
 			dst_size = eb->size;
 			VALGRIND_ADD_TO_TX(dst, dst_size);
 			pmemops_memcpy(p_ops, dst, eb->data, eb->size,
-				PMEMOBJ_F_RELAXED | PMEMOBJ_F_MEM_NODRAIN);
+				mem_flags);
 		break;
 		default:
 			ASSERT(0);
 	}
 	VALGRIND_REMOVE_FROM_TX(dst, dst_size);
+
+	*dstp = dst;
+	return dst_size;
+}
+
+/*
+ * ulog_entry_apply -- applies modifications of a single ulog entry
+ */
+void
+ulog_entry_apply(const struct ulog_entry_base *e, int persist,
+	const struct pmem_ops *p_ops)
+{
+	uint64_t *dst;
+	(void) ulog_entry_write(e, persist ? p_ops->persist : p_ops->flush,
+		PMEMOBJ_F_RELAXED | PMEMOBJ_F_MEM_NODRAIN, p_ops, &dst);
+}
+
+/*
+ * ulog_flush_range_cmp -- (internal) orders ranges by their beginning
+ */
+static int
+ulog_flush_range_cmp(const void *lhs, const void *rhs)
+{
+	const struct ulog_flush_range *l = lhs;
+	const struct ulog_flush_range *r = rhs;
+
+	if (l->begin < r->begin)
+		return -1;
+	return l->begin > r->begin;
+}
+
+/*
+ * ulog_flush_batch_flush -- (internal) flushes every cacheline of the
+ *	collected ranges once
+ */
+static void
+ulog_flush_batch_flush(struct ulog_flush_batch *b,
+	const struct pmem_ops *p_ops)
+{
+	if (b->nranges == 0)
+		return;
+
+	qsort(b->ranges, b->nranges, sizeof(b->ranges[0]),
+		ulog_flush_range_cmp);
+
+	struct ulog_flush_range r = b->ranges[0];
+	for (size_t i = 1; i < b->nranges; ++i) {
+		if (b->ranges[i].begin <= r.end) {
+			if (b->ranges[i].end > r.end)
+				r.end = b->ranges[i].end;
+			continue;
+		}
+
+		pmemops_xflush(p_ops, (void *)r.begin, r.end - r.begin,
+			PMEMOBJ_F_RELAXED);
+		r = b->ranges[i];
+	}
+	pmemops_xflush(p_ops, (void *)r.begin, r.end - r.begin,
+		PMEMOBJ_F_RELAXED);
+
+	b->nranges = 0;
+}
+
+/*
+ * ulog_flush_batch_add -- (internal) adds a modified range to the batch
+ */
+static void
+ulog_flush_batch_add(struct ulog_flush_batch *b, const void *addr,
+	size_t size, const struct pmem_ops *p_ops)
+{
+	if (size == 0)
+		return;
+
+	struct ulog_flush_range r;
+	r.begin = ALIGN_DOWN((uintptr_t)addr, CACHELINE_SIZE);
+	r.end = ALIGN_UP((uintptr_t)addr + size, CACHELINE_SIZE);
+
+	/* consecutive entries often modify the same cacheline */
+	if (b->nranges != 0) {
+		struct ulog_flush_range *last = &b->ranges[b->nranges - 1];
+		if (r.begin <= last->end && last->begin <= r.end) {
+			last->begin = MIN(last->begin, r.begin);
+			last->end = MAX(last->end, r.end);
+			return;
+		}
+	}
+
+	if (b->nranges == ULOG_FLUSH_BATCH)
+		ulog_flush_batch_flush(b, p_ops);
+
+	b->ranges[b->nranges++] = r;
 }
 
 /*
@@ -555,17 +671,22 @@ static int
 ulog_process_entry(struct ulog_entry_base *e, void *arg,
 	const struct pmem_ops *p_ops)
 {
-	ulog_entry_apply(e, 0, p_ops);
+	struct ulog_flush_batch *b = arg;
+
+	uint64_t *dst;
+	size_t size = ulog_entry_write(e, NULL,
+		PMEMOBJ_F_RELAXED | PMEMOBJ_F_MEM_NOFLUSH, p_ops, &dst);
+	ulog_flush_batch_add(b, dst, size, p_ops);
 
 	return 0;
 }
 
 /*
- * ulog_clobber -- zeroes the metadata of the ulog
+ * ulog_clobber_flags -- (internal) zeroes the metadata of the ulog
  */
-void
-ulog_clobber(struct ulog *dest, struct ulog_next *next,
-	const struct pmem_ops *p_ops)
+static void
+ulog_clobber_flags(struct ulog *dest, struct ulog_next *next,
+	const struct pmem_ops *p_ops, unsigned flags)
 {
 	struct ulog empty;
 	memset(&empty, 0, sizeof(empty));
@@ -575,8 +696,17 @@ ulog_clobber(struct ulog *dest, struct ulog_next *next,
 	else
 		empty.next = dest->next;
 
-	pmemops_memcpy(p_ops, dest, &empty, sizeof(empty),
-		PMEMOBJ_F_MEM_WC);
+	pmemops_memcpy(p_ops, dest, &empty, sizeof(empty), flags);
+}
+
+/*
+ * ulog_clobber -- zeroes the metadata of the ulog
+ */
+void
+ulog_clobber(struct ulog *dest, struct ulog_next *next,
+	const struct pmem_ops *p_ops)
+{
+	ulog_clobber_flags(dest, next, p_ops, PMEMOBJ_F_MEM_WC);
 }
 
 /*
@@ -646,10 +776,13 @@ out:
 }
 
 /*
- * ulog_process -- process ulog entries
+ * ulog_process_nodrain -- applies the ulog entries, in order, and flushes
+ *	every modified cacheline once
+ *
+ * The caller has to drain before the ulog is clobbered.
  */
 void
-ulog_process(struct ulog *ulog, ulog_check_offset_fn check,
+ulog_process_nodrain(struct ulog *ulog, ulog_check_offset_fn check,
 	const struct pmem_ops *p_ops)
 {
 	LOG(15, "ulog %p", ulog);
@@ -659,7 +792,25 @@ ulog_process(struct ulog *ulog, ulog_check_offset_fn check,
 		ulog_check(ulog, check, p_ops);
 #endif
 
-	ulog_foreach_entry(ulog, ulog_process_entry, NULL, p_ops);
+	struct ulog_flush_batch b;
+	b.nranges = 0;
+
+	ulog_foreach_entry(ulog, ulog_process_entry, &b, p_ops);
+	ulog_flush_batch_flush(&b, p_ops);
+}
+
+/*
+ * ulog_process -- process ulog entries
+ *
+ * The modifications are durable when it returns, so that the ulog can be
+ * clobbered.
+ */
+void
+ulog_process(struct ulog *ulog, ulog_check_offset_fn check,
+	const struct pmem_ops *p_ops)
+{
+	ulog_process_nodrain(ulog, check, p_ops);
+	pmemops_drain(p_ops);
 }
 
 /*
@@ -716,6 +867,38 @@ ulog_recover(struct ulog *ulog, ulog_check_offset_fn check,
 	}
 }
 
+/*
+ * ulog_recover_apply -- applies the entries of the ulog if it needs recovery,
+ *	returns 1 if it did
+ *
+ * The modifications are only flushed, the caller has to drain them before
+ * the ulog is clobbered with ulog_recover_clobber.
+ */
+int
+ulog_recover_apply(struct ulog *ulog, ulog_check_offset_fn check,
+	const struct pmem_ops *p_ops)
+{
+	LOG(15, "ulog %p", ulog);
+
+	if (!ulog_recovery_needed(ulog, 1))
+		return 0;
+
+	ulog_process_nodrain(ulog, check, p_ops);
+
+	return 1;
+}
+
+/*
+ * ulog_recover_clobber -- zeroes the metadata of a ulog applied with
+ *	ulog_recover_apply, without draining it
+ */
+void
+ulog_recover_clobber(struct ulog *ulog, const struct pmem_ops *p_ops)
+{
+	ulog_clobber_flags(ulog, NULL, p_ops,
+		PMEMOBJ_F_MEM_WC | PMEMOBJ_F_MEM_NODRAIN);
+}
+
 /*
  * ulog_check_entry --
  *	(internal) checks consistency of a single ulog entry
@@ -43,6 +43,10 @@
 #include "vec.h"
 #include "pmemops.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct ulog_entry_base {
 	uint64_t offset; /* offset with operation type flag */
 };
@@ -137,6 +141,8 @@ void ulog_clobber_data(struct ulog *dest,
 
 void ulog_process(struct ulog *ulog, ulog_check_offset_fn check,
 	const struct pmem_ops *p_ops);
+void ulog_process_nodrain(struct ulog *ulog, ulog_check_offset_fn check,
+	const struct pmem_ops *p_ops);
 
 size_t ulog_base_nbytes(struct ulog *ulog);
 int ulog_recovery_needed(struct ulog *ulog, int verify_checksum);
@@ -162,7 +168,14 @@ size_t ulog_entry_size(const struct ulog_entry_base *entry);
 
 void ulog_recover(struct ulog *ulog, ulog_check_offset_fn check,
 	const struct pmem_ops *p_ops);
+int ulog_recover_apply(struct ulog *ulog, ulog_check_offset_fn check,
+	const struct pmem_ops *p_ops);
+void ulog_recover_clobber(struct ulog *ulog, const struct pmem_ops *p_ops);
 int ulog_check(struct ulog *ulog, ulog_check_offset_fn check,
 	const struct pmem_ops *p_ops);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
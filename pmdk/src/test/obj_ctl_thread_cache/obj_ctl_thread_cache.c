@@ -0,0 +1,319 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_ctl_thread_cache.c -- tests for the per-thread caches of reserved blocks
+ *
+ * usage: obj_ctl_thread_cache file c|m|e
+ *
+ * obj_ctl_thread_cache <file> c - test for heap.thread.cache_size (RW)
+ *
+ * obj_ctl_thread_cache <file> m - allocations served from the magazines
+ * use the same blocks as without the cache, and the cached blocks are free
+ * again after the pool is reopened
+ *
+ * obj_ctl_thread_cache <file> e - the blocks cached by an idle thread are
+ * given back to the heap before an allocation of another thread fails
+ */
+
+#include "sys_util.h"
+#include "unittest.h"
+#include "util.h"
+
+#define LAYOUT "obj_ctl_thread_cache"
+#define ALLOC_SIZE 64
+/* more than needed for the allocations of a class to be cached */
+#define NOBJECT_THREAD 1000
+#define DEFAULT_CACHE_SIZE 32
+#define MAX_CACHE_SIZE 1024
+
+static PMEMobjpool *pop;
+
+static os_mutex_t lock;
+static os_cond_t cond;
+static int filled;
+static int done;
+
+/*
+ * create_pool -- creates a new pool with the given thread cache size
+ */
+static void
+create_pool(const char *path, int cache_size)
+{
+	if ((pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL,
+			S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	UT_ASSERTeq(pmemobj_ctl_set(pop, "heap.thread.cache_size",
+		&cache_size), 0);
+}
+
+/*
+ * destroy_pool -- closes and removes the pool
+ */
+static void
+destroy_pool(const char *path)
+{
+	pmemobj_close(pop);
+	UNLINK(path);
+}
+
+/*
+ * alloc_all -- allocates objects until the pool is full, returns their number
+ * and stores their offsets, if offs is not NULL
+ */
+static size_t
+alloc_all(uint64_t *offs, size_t max)
+{
+	size_t n = 0;
+	PMEMoid oid;
+	while (pmemobj_alloc(pop, &oid, ALLOC_SIZE, 0, NULL, NULL) == 0) {
+		UT_ASSERT(n < max);
+		if (offs)
+			offs[n] = oid.off;
+		n++;
+	}
+	UT_ASSERTeq(errno, ENOMEM);
+
+	return n;
+}
+
+/*
+ * cmp_off -- compares two offsets
+ */
+static int
+cmp_off(const void *lhs, const void *rhs)
+{
+	uint64_t l = *(const uint64_t *)lhs;
+	uint64_t r = *(const uint64_t *)rhs;
+
+	if (l < r)
+		return -1;
+	return l > r;
+}
+
+/*
+ * test_ctl -- reads and writes heap.thread.cache_size
+ */
+static void
+test_ctl(const char *path)
+{
+	if ((pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL,
+			S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	ssize_t size;
+	UT_ASSERTeq(pmemobj_ctl_get(pop, "heap.thread.cache_size", &size), 0);
+	UT_ASSERTeq(size, DEFAULT_CACHE_SIZE);
+
+	int valid[] = { 0, 1, MAX_CACHE_SIZE, DEFAULT_CACHE_SIZE };
+	for (unsigned i = 0; i < ARRAY_SIZE(valid); ++i) {
+		UT_ASSERTeq(pmemobj_ctl_set(pop, "heap.thread.cache_size",
+			&valid[i]), 0);
+		UT_ASSERTeq(pmemobj_ctl_get(pop, "heap.thread.cache_size",
+			&size), 0);
+		UT_ASSERTeq(size, valid[i]);
+	}
+
+	int invalid[] = { -1, MAX_CACHE_SIZE + 1 };
+	for (unsigned i = 0; i < ARRAY_SIZE(invalid); ++i) {
+		errno = 0;
+		UT_ASSERTeq(pmemobj_ctl_set(pop, "heap.thread.cache_size",
+			&invalid[i]), -1);
+		UT_ASSERTeq(errno, EINVAL);
+		UT_ASSERTeq(pmemobj_ctl_get(pop, "heap.thread.cache_size",
+			&size), 0);
+		UT_ASSERTeq(size, DEFAULT_CACHE_SIZE);
+	}
+
+	/* disabling the cache in the middle of the allocations */
+	PMEMoid oid;
+	for (int i = 0; i < NOBJECT_THREAD; ++i)
+		UT_ASSERTeq(pmemobj_alloc(pop, &oid, ALLOC_SIZE, 0,
+			NULL, NULL), 0);
+
+	int zero = 0;
+	UT_ASSERTeq(pmemobj_ctl_set(pop, "heap.thread.cache_size", &zero), 0);
+
+	for (int i = 0; i < NOBJECT_THREAD; ++i)
+		UT_ASSERTeq(pmemobj_alloc(pop, &oid, ALLOC_SIZE, 0,
+			NULL, NULL), 0);
+
+	destroy_pool(path);
+}
+
+/*
+ * test_magazines -- fills the pool with and without the cache
+ */
+static void
+test_magazines(const char *path)
+{
+	create_pool(path, 0);
+	size_t nobjects = alloc_all(NULL, SIZE_MAX);
+	destroy_pool(path);
+
+	uint64_t *offs = MALLOC(sizeof(*offs) * nobjects);
+
+	/* the magazines hand out every block of the pool, each one once */
+	create_pool(path, DEFAULT_CACHE_SIZE);
+	UT_ASSERTeq(alloc_all(offs, nobjects), nobjects);
+
+	qsort(offs, nobjects, sizeof(*offs), cmp_off);
+	for (size_t i = 1; i < nobjects; ++i)
+		UT_ASSERT(offs[i] - offs[i - 1] >= ALLOC_SIZE);
+
+	/* and they are refilled with the freed blocks */
+	for (size_t i = 0; i < nobjects; ++i) {
+		PMEMoid oid = { pmemobj_oid(pop).pool_uuid_lo, offs[i] };
+		pmemobj_free(&oid);
+	}
+	UT_ASSERTeq(alloc_all(NULL, nobjects), nobjects);
+	destroy_pool(path);
+
+	/* the blocks left in the cache are not lost when the pool is closed */
+	create_pool(path, MAX_CACHE_SIZE);
+	PMEMoid oid;
+	for (int i = 0; i < NOBJECT_THREAD; ++i)
+		UT_ASSERTeq(pmemobj_alloc(pop, &oid, ALLOC_SIZE, 0,
+			NULL, NULL), 0);
+	pmemobj_close(pop);
+
+	if ((pop = pmemobj_open(path, LAYOUT)) == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+	UT_ASSERTeq(alloc_all(NULL, nobjects), nobjects - NOBJECT_THREAD);
+	destroy_pool(path);
+
+	FREE(offs);
+}
+
+/*
+ * worker_idle -- allocates from the arena of the main thread, so that its
+ * magazine is filled, and waits without allocating until the main thread
+ * fills the pool
+ */
+static void *
+worker_idle(void *arg)
+{
+	unsigned arena_id = 1;
+	UT_ASSERTeq(pmemobj_ctl_set(pop, "heap.thread.arena_id", &arena_id), 0);
+
+	PMEMoid oid;
+	for (int i = 0; i < NOBJECT_THREAD; ++i)
+		UT_ASSERTeq(pmemobj_alloc(pop, &oid, ALLOC_SIZE, 0,
+			NULL, NULL), 0);
+
+	util_mutex_lock(&lock);
+	filled = 1;
+	os_cond_broadcast(&cond);
+	while (!done)
+		os_cond_wait(&cond, &lock);
+	util_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+/*
+ * fill_with_idle_thread -- fills the pool while another thread of the same
+ * arena keeps its cache, returns the number of allocated objects
+ */
+static size_t
+fill_with_idle_thread(const char *path, int cache_size)
+{
+	create_pool(path, cache_size);
+
+	unsigned arena_id = 1;
+	UT_ASSERTeq(pmemobj_ctl_set(pop, "heap.thread.arena_id", &arena_id), 0);
+
+	filled = 0;
+	done = 0;
+
+	os_thread_t thread;
+	PTHREAD_CREATE(&thread, NULL, worker_idle, NULL);
+
+	util_mutex_lock(&lock);
+	while (!filled)
+		os_cond_wait(&cond, &lock);
+	util_mutex_unlock(&lock);
+
+	size_t nobjects = NOBJECT_THREAD + alloc_all(NULL, SIZE_MAX);
+
+	util_mutex_lock(&lock);
+	done = 1;
+	os_cond_broadcast(&cond);
+	util_mutex_unlock(&lock);
+
+	PTHREAD_JOIN(&thread, NULL);
+	destroy_pool(path);
+
+	return nobjects;
+}
+
+/*
+ * test_enomem -- the allocations fail only once the blocks cached by the idle
+ * thread are used up
+ */
+static void
+test_enomem(const char *path)
+{
+	util_mutex_init(&lock);
+	os_cond_init(&cond);
+
+	size_t nobjects = fill_with_idle_thread(path, 0);
+	UT_ASSERTeq(fill_with_idle_thread(path, DEFAULT_CACHE_SIZE), nobjects);
+	UT_ASSERTeq(fill_with_idle_thread(path, MAX_CACHE_SIZE), nobjects);
+
+	util_mutex_destroy(&lock);
+	os_cond_destroy(&cond);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ctl_thread_cache");
+
+	if (argc != 3 || strlen(argv[2]) != 1)
+		UT_FATAL("usage: %s file c|m|e", argv[0]);
+
+	const char *path = argv[1];
+	char t = argv[2][0];
+
+	if (t == 'c')
+		test_ctl(path);
+	else if (t == 'm')
+		test_magazines(path);
+	else if (t == 'e')
+		test_enomem(path);
+	else
+		UT_FATAL("unknown test %c", t);
+
+	DONE(NULL);
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_recovery_lanes.c -- unit test for the recovery of the redo and undo logs
+ *	left in many lanes
+ *
+ * The redo logs of the lanes are applied by several threads and drained
+ * once, the undo logs of all the lanes are processed before a single drain.
+ */
+
+#include <stddef.h>
+#include "lane.h"
+#include "memops.h"
+#include "obj.h"
+#include "os.h"
+#include "ulog.h"
+#include "unittest.h"
+
+/* enough lanes to be split between several recovery threads */
+#define TEST_LANES 100
+#define REDO_ENTRIES 8
+#define UNDO_LANES 8
+#define UNDO_WORDS 32
+
+/* the external redo log of every tenth lane is torn by the failure */
+#define TORN_LANE(l) ((l) % 10 == 9)
+
+struct root {
+	uint64_t external[TEST_LANES][REDO_ENTRIES];
+	uint64_t internal[TEST_LANES];
+	uint64_t undo[UNDO_LANES][UNDO_WORDS];
+};
+
+static const char *Threads[] = { "1", "4", "64" };
+
+/*
+ * get_layout -- returns the persistent layout of the lane
+ */
+static struct lane_layout *
+get_layout(PMEMobjpool *pop, uint64_t lane)
+{
+	return (struct lane_layout *)((char *)pop + pop->lanes_offset) + lane;
+}
+
+/*
+ * redo_value -- returns the value set by an entry of a redo log
+ */
+static uint64_t
+redo_value(unsigned round, unsigned lane, unsigned entry)
+{
+	return (uint64_t)(round + 1) << 48 | (uint64_t)lane << 16 | entry;
+}
+
+/*
+ * undo_value -- returns the value of a word snapshotted in an undo log
+ */
+static uint64_t
+undo_value(unsigned round, unsigned lane, unsigned word)
+{
+	return (uint64_t)(round + 1) << 48 | (uint64_t)lane << 16 | word | 1;
+}
+
+/*
+ * redo_store -- stores a redo log setting the given words, as if the pool was
+ * interrupted before applying it
+ */
+static void
+redo_store(PMEMobjpool *pop, struct ulog *ulog, size_t capacity,
+	uint64_t *words, unsigned nwords, unsigned round, unsigned lane)
+{
+	/* the data of a ulog must be cacheline aligned */
+	struct ulog *shadow = MEMALIGN(CACHELINE_SIZE, SIZEOF_ULOG(capacity));
+	memset(shadow, 0, SIZEOF_ULOG(capacity));
+	shadow->capacity = capacity;
+
+	struct ulog_next next;
+	VEC_INIT(&next);
+
+	for (unsigned e = 0; e < nwords; ++e)
+		ulog_entry_val_create(shadow, e * sizeof(struct ulog_entry_val),
+			&words[e], redo_value(round, lane, e),
+			ULOG_OPERATION_SET, &pop->p_ops);
+	ulog_store(ulog, shadow, nwords * sizeof(struct ulog_entry_val),
+		capacity, &next, &pop->p_ops);
+
+	VEC_DELETE(&next);
+	ALIGNED_FREE(shadow);
+}
+
+/*
+ * dirty_lanes -- leaves redo logs in the first TEST_LANES lanes and undo logs
+ * in the first UNDO_LANES lanes
+ */
+static void
+dirty_lanes(PMEMobjpool *pop, struct root *root, unsigned round)
+{
+	memset(root, 0, sizeof(*root));
+	for (unsigned l = 0; l < UNDO_LANES; ++l) {
+		for (unsigned w = 0; w < UNDO_WORDS; ++w)
+			root->undo[l][w] = undo_value(round, l, w);
+	}
+	pmemobj_persist(pop, root, sizeof(*root));
+
+	for (unsigned l = 0; l < TEST_LANES; ++l) {
+		struct lane_layout *layout = get_layout(pop, l);
+
+		redo_store(pop, (struct ulog *)&layout->external,
+			LANE_REDO_EXTERNAL_SIZE, root->external[l],
+			REDO_ENTRIES, round, l);
+		if (TORN_LANE(l)) {
+			layout->external.checksum ^= 1;
+			pmemobj_persist(pop, &layout->external.checksum,
+				sizeof(layout->external.checksum));
+		}
+
+		if (l % 2 == 0)
+			redo_store(pop, (struct ulog *)&layout->internal,
+				LANE_REDO_INTERNAL_SIZE, &root->internal[l], 1,
+				round, l);
+	}
+
+	/* the transactions modify the words after taking their snapshots */
+	for (unsigned l = 0; l < UNDO_LANES; ++l) {
+		struct operation_context *ctx = pop->lanes_desc.lane[l].undo;
+
+		operation_start(ctx);
+		UT_ASSERTeq(operation_add_buffer(ctx, root->undo[l],
+			root->undo[l], sizeof(root->undo[l]),
+			ULOG_OPERATION_BUF_CPY), 0);
+
+		memset(root->undo[l], 0xc5, sizeof(root->undo[l]));
+		pmemobj_persist(pop, root->undo[l], sizeof(root->undo[l]));
+	}
+}
+
+/*
+ * check_lanes -- checks that the recovery applied the redo logs, except for
+ * the torn ones, rolled back the undo logs and discarded all of them
+ */
+static void
+check_lanes(PMEMobjpool *pop, struct root *root, unsigned round)
+{
+	for (unsigned l = 0; l < TEST_LANES; ++l) {
+		struct lane_layout *layout = get_layout(pop, l);
+
+		for (unsigned e = 0; e < REDO_ENTRIES; ++e) {
+			uint64_t expected = TORN_LANE(l) ? 0 :
+				redo_value(round, l, e);
+			UT_ASSERTeq(root->external[l][e], expected);
+		}
+		UT_ASSERTeq(root->internal[l],
+			l % 2 == 0 ? redo_value(round, l, 0) : 0);
+
+		/* the torn logs are never applied, nor discarded */
+		if (!TORN_LANE(l))
+			UT_ASSERTeq(ulog_base_nbytes(
+				(struct ulog *)&layout->external), 0);
+		UT_ASSERTeq(ulog_base_nbytes(
+			(struct ulog *)&layout->internal), 0);
+	}
+
+	for (unsigned l = 0; l < UNDO_LANES; ++l) {
+		for (unsigned w = 0; w < UNDO_WORDS; ++w)
+			UT_ASSERTeq(root->undo[l][w], undo_value(round, l, w));
+		UT_ASSERTeq(ulog_base_nbytes(
+			(struct ulog *)&get_layout(pop, l)->undo), 0);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_recovery_lanes");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	PMEMobjpool *pop = NULL;
+
+	if ((pop = pmemobj_create(path, "obj_recovery_lanes",
+			PMEMOBJ_MIN_POOL, S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+	UT_ASSERT(pop->nlanes >= TEST_LANES);
+
+	for (unsigned round = 0; round < ARRAY_SIZE(Threads); ++round) {
+		struct root *root = pmemobj_direct(
+			pmemobj_root(pop, sizeof(struct root)));
+		UT_ASSERTne(root, NULL);
+
+		dirty_lanes(pop, root, round);
+		pmemobj_close(pop);
+
+		UT_ASSERTeq(os_setenv("PMEMOBJ_RECOVERY_THREADS",
+			Threads[round], 1), 0);
+
+		if ((pop = pmemobj_open(path, "obj_recovery_lanes")) == NULL)
+			UT_FATAL("!pmemobj_open: %s", path);
+
+		root = pmemobj_direct(pmemobj_root(pop, sizeof(struct root)));
+		check_lanes(pop, root, round);
+	}
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
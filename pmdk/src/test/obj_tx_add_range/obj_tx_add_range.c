@@ -36,6 +36,7 @@
 #include <string.h>
 #include <stddef.h>
 
+#include "obj.h"
 #include "tx.h"
 #include "unittest.h"
 #include "util.h"
@@ -445,6 +446,116 @@ do_tx_xadd_range_commit(PMEMobjpool *pop)
 	UT_ASSERTeq(D_RO(obj)->value, TEST_VALUE_1);
 }
 
+static flush_fn Flush_orig;
+static uintptr_t Flush_watched;
+static int Flushed;
+
+/*
+ * flush_watch -- flush function which notes whether the watched address was
+ * flushed
+ */
+static int
+flush_watch(void *base, const void *addr, size_t len, unsigned flags)
+{
+	if ((uintptr_t)addr <= Flush_watched &&
+	    Flush_watched < (uintptr_t)addr + len)
+		Flushed = 1;
+
+	return Flush_orig(base, addr, len, flags);
+}
+
+/*
+ * do_tx_xadd_range_no_flush_line -- add a field with POBJ_XADD_NO_FLUSH and
+ * a field which must be flushed, in the same cache line, in either order
+ */
+static void
+do_tx_xadd_range_no_flush_line(PMEMobjpool *pop, int cacheline,
+	int no_flush_first)
+{
+	int ret;
+	TOID(struct object) obj;
+	TOID_ASSIGN(obj, do_tx_zalloc(pop, TYPE_OBJ));
+
+	UT_ASSERTeq(pmemobj_ctl_set(pop, "tx.snapshot.cacheline", &cacheline),
+		0);
+
+	/* both fields at the beginning of a cache line of the object */
+	uint64_t off = ALIGN_UP(obj.oid.off, CACHELINE_SIZE) - obj.oid.off;
+	uint64_t *no_flush = (uint64_t *)((char *)D_RW(obj) + off);
+	uint64_t *value = no_flush + 1;
+
+	Flush_watched = (uintptr_t)value;
+
+	TX_BEGIN(pop) {
+		if (no_flush_first) {
+			ret = pmemobj_tx_xadd_range(obj.oid, off,
+				sizeof(*no_flush), POBJ_XADD_NO_FLUSH);
+			UT_ASSERTeq(ret, 0);
+		}
+
+		ret = pmemobj_tx_add_range(obj.oid, off + sizeof(*no_flush),
+			sizeof(*value));
+		UT_ASSERTeq(ret, 0);
+
+		if (!no_flush_first) {
+			ret = pmemobj_tx_xadd_range(obj.oid, off,
+				sizeof(*no_flush), POBJ_XADD_NO_FLUSH);
+			UT_ASSERTeq(ret, 0);
+		}
+
+		*no_flush = TEST_VALUE_1;
+		*value = TEST_VALUE_2;
+
+		/* only the flushes on commit count */
+		Flushed = 0;
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERT(Flushed);
+	UT_ASSERTeq(*no_flush, TEST_VALUE_1);
+	UT_ASSERTeq(*value, TEST_VALUE_2);
+
+	/* a field added only with POBJ_XADD_NO_FLUSH is still not flushed */
+	Flush_watched = (uintptr_t)no_flush;
+
+	TX_BEGIN(pop) {
+		ret = pmemobj_tx_xadd_range(obj.oid, off, sizeof(*no_flush),
+			POBJ_XADD_NO_FLUSH);
+		UT_ASSERTeq(ret, 0);
+
+		*no_flush = TEST_VALUE_2;
+
+		Flushed = 0;
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERT(!Flushed);
+	UT_ASSERTeq(*no_flush, TEST_VALUE_2);
+
+	cacheline = 0;
+	UT_ASSERTeq(pmemobj_ctl_set(pop, "tx.snapshot.cacheline", &cacheline),
+		0);
+}
+
+/*
+ * do_tx_xadd_range_no_flush -- check which ranges are flushed on commit
+ */
+static void
+do_tx_xadd_range_no_flush(PMEMobjpool *pop)
+{
+	Flush_orig = pop->p_ops.flush;
+	pop->p_ops.flush = flush_watch;
+
+	for (int cacheline = 0; cacheline <= 1; ++cacheline) {
+		do_tx_xadd_range_no_flush_line(pop, cacheline, 1);
+		do_tx_xadd_range_no_flush_line(pop, cacheline, 0);
+	}
+
+	pop->p_ops.flush = Flush_orig;
+}
+
 /*
  * do_tx_add_range_overlapping -- call pmemobj_tx_add_range with overlapping
  */
@@ -642,9 +753,10 @@ main(int argc, char *argv[])
 	util_init();
 
 	if (argc != 3)
-		UT_FATAL("usage: %s [file] [0|1]", argv[0]);
+		UT_FATAL("usage: %s [file] [0|1|2]", argv[0]);
 
-	int do_reopen = atoi(argv[2]);
+	int do_reopen = atoi(argv[2]) == 1;
+	int do_no_flush = atoi(argv[2]) == 2;
 
 	PMEMobjpool *pop;
 	if ((pop = pmemobj_create(argv[1], LAYOUT_NAME, PMEMOBJ_MIN_POOL * 2,
@@ -654,6 +766,9 @@ main(int argc, char *argv[])
 	if (do_reopen) {
 		pmemobj_close(pop);
 		do_tx_add_range_reopen(argv[1]);
+	} else if (do_no_flush) {
+		do_tx_xadd_range_no_flush(pop);
+		pmemobj_close(pop);
 	} else {
 		do_tx_add_range_commit(pop);
 		VALGRIND_WRITE_STATS;
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_ulog_checksum.c -- unit test for the checksum variants of the ulog
+ *
+ * The SIMD variants supported by the CPU and the selected one have to
+ * return the same checksums as util_checksum_seq and util_checksum, for
+ * any length and alignment of the buffer.
+ */
+
+#include "checksum.h"
+#include "unittest.h"
+#include "util.h"
+
+#include <inttypes.h>
+
+#define MAX_MISALIGNMENT 64
+#define BUF_SIZE (16384 + MAX_MISALIGNMENT)
+
+typedef uint64_t (*checksum_seq_fn)(const void *addr, size_t len,
+	uint64_t csum);
+
+static checksum_seq_fn Variants[3];
+static const char *Variant_names[3];
+static unsigned Nvariants;
+
+/*
+ * add_variant -- registers a checksum variant to test
+ */
+static void
+add_variant(checksum_seq_fn fn, const char *name)
+{
+	Variants[Nvariants] = fn;
+	Variant_names[Nvariants] = name;
+	Nvariants++;
+}
+
+/*
+ * test_seq -- compares the variants with util_checksum_seq, continuing
+ *	from a zero and a non-zero checksum
+ */
+static void
+test_seq(const char *buf, size_t off, size_t len)
+{
+	const uint64_t seeds[] = {0, 0xdeadbeef12345678ULL};
+
+	for (unsigned s = 0; s < ARRAY_SIZE(seeds); ++s) {
+		uint64_t expected = util_checksum_seq(buf + off, len, seeds[s]);
+
+		for (unsigned v = 0; v < Nvariants; ++v) {
+			uint64_t csum = Variants[v](buf + off, len, seeds[s]);
+			if (csum != expected)
+				UT_FATAL("%s: off %zu len %zu: 0x%" PRIx64
+					" != 0x%" PRIx64, Variant_names[v],
+					off, len, csum, expected);
+		}
+	}
+}
+
+/*
+ * test_compute -- compares checksum_compute with util_checksum for the
+ *	checksum at every 8-byte offset of the buffer
+ */
+static void
+test_compute(char *buf, size_t off, size_t len)
+{
+	for (size_t coff = 0; coff + sizeof(uint64_t) <= len;
+			coff += sizeof(uint64_t)) {
+		uint64_t *csump = (uint64_t *)(buf + off + coff);
+		uint64_t old = *csump;
+
+		util_checksum(buf + off, len, csump, 1, 0);
+		uint64_t expected = *csump;
+
+		*csump = old;
+		UT_ASSERTeq(checksum_compute(buf + off, len, csump, 1), 1);
+		UT_ASSERTeq(*csump, expected);
+		UT_ASSERTeq(checksum_compute(buf + off, len, csump, 0), 1);
+
+		*csump = expected + 1;
+		UT_ASSERTeq(checksum_compute(buf + off, len, csump, 0), 0);
+
+		*csump = old;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ulog_checksum");
+
+	checksum_init();
+	add_variant(checksum_seq, "checksum_seq");
+#if defined(__x86_64__) || defined(__amd64__)
+	if (__builtin_cpu_supports("sse4.2"))
+		add_variant(checksum_seq_sse42, "sse4.2");
+	if (__builtin_cpu_supports("avx2"))
+		add_variant(checksum_seq_avx2, "avx2");
+#endif
+
+	char *buf = MALLOC(BUF_SIZE);
+	uint32_t seed = 1;
+	for (size_t i = 0; i < BUF_SIZE; ++i) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (char)(seed >> 16);
+	}
+
+	for (size_t off = 0; off < MAX_MISALIGNMENT; ++off) {
+		for (size_t len = 0; len <= 1024; len += 4)
+			test_seq(buf, off, len);
+
+		test_seq(buf, off, 4092);
+		test_seq(buf, off, 4096);
+		test_seq(buf, off, 16384);
+	}
+
+	for (size_t off = 0; off < MAX_MISALIGNMENT; off += 4) {
+		test_compute(buf, off, 64);
+		test_compute(buf, off, 260);
+		test_compute(buf, off, 1024);
+	}
+
+	/* a buffer of all ones overflows every 32-bit sum */
+	memset(buf, 0xff, BUF_SIZE);
+	test_seq(buf, 0, 16384);
+	test_compute(buf, 0, 1024);
+
+	FREE(buf);
+
+	DONE(NULL);
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * obj_ulog_process.c -- unit test for applying a redo log
+ *
+ * The entries are written in log order, then every modified cacheline is
+ * flushed, sorted and merged, before a single drain.
+ */
+
+#include <stddef.h>
+#include "obj.h"
+#include "ulog.h"
+#include "unittest.h"
+#include "util.h"
+
+/* more than the ranges collected by ulog_process before they are flushed */
+#define TEST_LINES 128
+
+#define TEST_LOG_SIZE (16 * 1024)
+
+#define LINE_WORDS (CACHELINE_SIZE / sizeof(uint64_t))
+
+#define BUF_OFFSET 40
+#define BUF_SIZE 150
+
+#define MAX_FLUSHES 1024
+
+struct test_object {
+	uint8_t padding[CACHELINE_SIZE - 16]; /* align to a cacheline */
+	struct ULOG(TEST_LOG_SIZE) redo;
+	/* only every other line is modified, so the ranges are never merged */
+	uint64_t values[2 * TEST_LINES][LINE_WORDS];
+	uint8_t buf[4 * CACHELINE_SIZE];
+};
+
+static uint64_t Model[2 * TEST_LINES][LINE_WORDS];
+
+static struct {
+	uintptr_t begin;
+	uintptr_t end;
+} Flushes[MAX_FLUSHES];
+static unsigned Nflushes;
+static unsigned Ndrains;
+static unsigned Nflushes_drained;
+
+static flush_fn Flush_orig;
+static drain_fn Drain_orig;
+
+/*
+ * flush_record -- flush function which records the flushed ranges
+ */
+static int
+flush_record(void *base, const void *addr, size_t len, unsigned flags)
+{
+	UT_ASSERT(Nflushes < MAX_FLUSHES);
+	Flushes[Nflushes].begin = (uintptr_t)addr;
+	Flushes[Nflushes].end = (uintptr_t)addr + len;
+	Nflushes++;
+
+	return Flush_orig(base, addr, len, flags);
+}
+
+/*
+ * drain_record -- drain function which counts the drains
+ */
+static void
+drain_record(void *base)
+{
+	Ndrains++;
+	Nflushes_drained = Nflushes;
+
+	Drain_orig(base);
+}
+
+/*
+ * line_flushes -- returns how many times the cacheline was flushed
+ */
+static unsigned
+line_flushes(const void *line)
+{
+	unsigned n = 0;
+	for (unsigned i = 0; i < Nflushes; ++i) {
+		if (Flushes[i].begin <= (uintptr_t)line &&
+		    (uintptr_t)line < Flushes[i].end)
+			n++;
+	}
+
+	return n;
+}
+
+/*
+ * add_entry -- appends a value entry to the redo log and applies it to the
+ * model of the values
+ */
+static void
+add_entry(PMEMobjpool *pop, struct test_object *object, size_t *offset,
+	unsigned line, unsigned word, uint64_t value, ulog_operation_type type)
+{
+	ulog_entry_val_create((struct ulog *)&object->redo, *offset,
+		&object->values[line][word], value, type, &pop->p_ops);
+	*offset += sizeof(struct ulog_entry_val);
+
+	uint64_t *m = &Model[line][word];
+	switch (type) {
+		case ULOG_OPERATION_SET:
+			*m = value;
+			break;
+		case ULOG_OPERATION_AND:
+			*m &= value;
+			break;
+		case ULOG_OPERATION_OR:
+			*m |= value;
+			break;
+		default:
+			UT_ASSERT(0);
+	}
+}
+
+/*
+ * test_process -- applies a redo log modifying nlines cachelines, in an
+ * order other than their addresses, with several entries on the same words
+ */
+static void
+test_process(PMEMobjpool *pop, struct test_object *object, unsigned nlines,
+	int one_batch)
+{
+	memset(object->values, 0, sizeof(object->values));
+	memset(object->buf, 0, sizeof(object->buf));
+	pmemobj_persist(pop, object->values, sizeof(object->values));
+	pmemobj_persist(pop, object->buf, sizeof(object->buf));
+	memset(Model, 0, sizeof(Model));
+
+	ulog_construct(OBJ_PTR_TO_OFF(pop, &object->redo), TEST_LOG_SIZE, 1,
+		&pop->p_ops);
+
+	/* the buffer entry starts and ends in the middle of a cacheline */
+	uint8_t src[BUF_SIZE];
+	for (unsigned i = 0; i < BUF_SIZE; ++i)
+		src[i] = (uint8_t)(i * 7 + 1);
+
+	size_t offset = 0;
+	ulog_entry_buf_create((struct ulog *)&object->redo, offset,
+		(uint64_t *)(object->buf + BUF_OFFSET), src, BUF_SIZE,
+		ULOG_OPERATION_BUF_CPY, &pop->p_ops);
+	offset += ALIGN_UP(sizeof(struct ulog_entry_buf) + BUF_SIZE,
+		CACHELINE_SIZE);
+
+	for (unsigned i = 0; i < nlines; ++i) {
+		unsigned line = 2 * ((i * 37) % nlines);
+
+		add_entry(pop, object, &offset, line, 0, line + 1,
+			ULOG_OPERATION_SET);
+		add_entry(pop, object, &offset, line, 0, 1ULL << 40,
+			ULOG_OPERATION_OR);
+		add_entry(pop, object, &offset, line, 0, ~1ULL,
+			ULOG_OPERATION_AND);
+		add_entry(pop, object, &offset, line, LINE_WORDS - 1, ~line,
+			ULOG_OPERATION_SET);
+	}
+	UT_ASSERT(offset <= TEST_LOG_SIZE);
+
+	struct pmem_ops ops = pop->p_ops;
+	Flush_orig = ops.flush;
+	Drain_orig = ops.drain;
+	ops.flush = flush_record;
+	ops.drain = drain_record;
+	Nflushes = 0;
+	Ndrains = 0;
+	Nflushes_drained = 0;
+
+	ulog_process((struct ulog *)&object->redo, NULL, &ops);
+
+	/* everything is flushed before the one drain */
+	UT_ASSERTeq(Ndrains, 1);
+	UT_ASSERTeq(Nflushes_drained, Nflushes);
+
+	for (unsigned line = 0; line < 2 * TEST_LINES; ++line) {
+		unsigned n = line_flushes(object->values[line]);
+		if (line % 2 != 0 || line >= 2 * nlines)
+			UT_ASSERTeq(n, 0);
+		else if (one_batch)
+			UT_ASSERTeq(n, 1);
+		else
+			UT_ASSERT(n >= 1);
+	}
+
+	for (unsigned line = 0; line < 4; ++line) {
+		unsigned n = line_flushes(object->buf + line * CACHELINE_SIZE);
+		if (line * CACHELINE_SIZE >= BUF_OFFSET + BUF_SIZE)
+			UT_ASSERTeq(n, 0);
+		else if (one_batch)
+			UT_ASSERTeq(n, 1);
+		else
+			UT_ASSERT(n >= 1);
+	}
+
+	/* a single batch is flushed in the order of the addresses */
+	if (one_batch) {
+		for (unsigned i = 1; i < Nflushes; ++i)
+			UT_ASSERT(Flushes[i - 1].end < Flushes[i].begin);
+	}
+
+	UT_ASSERTeq(memcmp(object->values, Model, sizeof(Model)), 0);
+	UT_ASSERTeq(memcmp(object->buf + BUF_OFFSET, src, BUF_SIZE), 0);
+	for (unsigned i = 0; i < sizeof(object->buf); ++i) {
+		if (i < BUF_OFFSET || i >= BUF_OFFSET + BUF_SIZE)
+			UT_ASSERTeq(object->buf[i], 0);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ulog_process");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	PMEMobjpool *pop = NULL;
+
+	if ((pop = pmemobj_create(path, "obj_ulog_process",
+			PMEMOBJ_MIN_POOL, S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	struct test_object *object =
+		pmemobj_direct(pmemobj_root(pop, sizeof(struct test_object)));
+	UT_ASSERTne(object, NULL);
+	UT_ASSERTeq((uintptr_t)object->values % CACHELINE_SIZE, 0);
+
+	test_process(pop, object, 1, 1);
+	test_process(pop, object, TEST_LINES / 4, 1);
+	test_process(pop, object, TEST_LINES, 0);
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
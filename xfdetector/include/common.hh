@@ -31,8 +31,36 @@ using std::queue;
 #define POST_FAILURE_FIFO "post_fifo"
 #define SIGNAL_FIFO "signal_fifo"
 
+// Environment of workloads built with the compiler-instrumentation runtime
+#define XFD_RT_TRACE_ENV "XFD_RT_TRACE"
+#define XFD_RT_EXEC_ID_ENV "XFD_RT_EXEC_ID"
+#define XFD_RT_FAILURE_LIST_ENV "XFD_RT_FAILURE_LIST"
+#define XFD_RT_RESUME_ID_ENV "XFD_RT_RESUME_ID"
+#define XFD_RT_COALESCE_ENV "XFD_RT_COALESCE"
+#define XFD_RT_AUTO_FAILURE_ENV "XFD_RT_AUTO_FAILURE"
+
+// Enables the annotations of xfdetector_interface.h (XFDETECTOR_ATTACHED_ENV)
+#define XFD_ATTACHED_ENV "XFD_ATTACHED"
+
+// Pintool flags
+#define PIN_TRACK_READ string("-r 1 ")
+#define PIN_ENABLE_FIFO string("-t 1 ")
+#define PIN_ENABLE_FAILURE string("-f 1 ")
+#define PIN_REDIRECT_OUT string("-o out ")
+#define PIN_COALESCE_WRITES string("-c 1 ")
+#define PIN_AUTO_FAILURE(val) (string(" -a ") + val)
+#define PIN_SET_EXECID(val) (string("-i ") + std::to_string(val))
+#define PIN_SET_FAILURE_FILE(val) (string("-l ") + val)
+#define PIN_SET_RESUME_ID(val) (string(" -s ") + std::to_string(val))
+
 // Number of buffer entries
 #define PIN_FIFO_BUF_SIZE (1024 * sizeof(trace_entry_t))
+// Trace ingestion queue between the FIFO reader and the analysis
+// (number of batches must be a power of 2)
+#define TRACE_BATCH_SIZE (16 * PIN_FIFO_BUF_SIZE)
+#define TRACE_QUEUE_DEPTH 8
+// Interval to check for stop requests and timeouts (ms)
+#define TRACE_QUEUE_POLL_MS 100
 
 // Signals for inter-process communication
 #define MAX_SIGNAL_LEN 100
@@ -58,6 +86,18 @@ using std::queue;
 #define POST_FAILURE_EXEC_TIMEOUT 15
 #define PRE_FAILURE_FIFO_TIMEOUT 15
 
+/* Crash images: granularity of reverted stores and default limits */
+#define CACHE_LINE_SIZE 64
+#define CRASH_IMAGE_DEFAULT_LIMIT 16
+#define CRASH_IMAGE_DEFAULT_SUBSET 2
+
+/* Campaign checkpoint frequency (failure points / seconds) */
+#define CHECKPOINT_INTERVAL 8
+#define CHECKPOINT_PERIOD 60
+
+/* Failure points tested per run of the pre-failure program with --budget */
+#define SCHEDULE_DEFAULT_BATCH 16
+
 typedef uint64_t addr_t;
 typedef uint64_t size_t;
 typedef int timestamp_t;
@@ -97,13 +137,16 @@ static inline char** str2cmd(string str)
     int cnt = 0;
     for (unsigned i = 0; i < str.length(); ++i) {
         if (str[i] == ' ') {
-            cmd[cnt++] = alloc_print(tmp.c_str());
+            // Skip empty arguments from repeated spaces
+            if (!tmp.empty())
+                cmd[cnt++] = alloc_print(tmp.c_str());
             tmp.clear();
             continue;
         }
         tmp+=str[i];
     }
-    cmd[cnt++] = alloc_print(tmp.c_str());
+    if (!tmp.empty())
+        cmd[cnt++] = alloc_print(tmp.c_str());
     cmd[cnt++] = NULL;
     return cmd; 
 }
@@ -118,9 +161,10 @@ static inline string cmd2str(char** cmd) {
     return out;
 }
 
+#include "pm_range.hh"
+
 // Check whether input address is on PM
 #define isPmemAddr(addr, size) \
-    (((uint64_t)addr + size < PM_ADDR_BASE + PM_ADDR_SIZE) \
-        && ((uint64_t)addr >= PM_ADDR_BASE))
+    pm_range_table.contains((uint64_t)(addr), (size))
 
 #endif
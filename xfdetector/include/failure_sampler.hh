@@ -0,0 +1,99 @@
+#ifndef FAILURE_SAMPLER_HH
+#define FAILURE_SAMPLER_HH
+
+/*
+ * Selection of automatically injected failure points.
+ *
+ * With auto injection, the pintool and libxfdetector_rt add a failure point
+ * before every ordering point (fence, TX_ADD and TX commit) of the RoI
+ * thread. Every ordering point takes a failure ID, injected or not, so that
+ * IDs stay the same across campaigns with different controls. A point is
+ * injected if it passes, in order:
+ *  - the stride: every Nth ordering point,
+ *  - random sampling with a fixed seed,
+ *  - the limit of failure points per unique call stack.
+ * Selection only depends on the sequence of ordering points, so resumed
+ * campaigns select the same points.
+ *
+ * The detector passes the controls as "stride:sample:seed:per_stack".
+ */
+
+#include <string>
+#include <unordered_map>
+
+struct failure_sample_config_t {
+    bool enabled = false;
+    unsigned stride = 1;
+    // Probability of injecting a failure point that passes the stride
+    double sample = 1.0;
+    unsigned seed = 0;
+    // Failure points per call stack, 0 for no limit
+    unsigned per_stack = 0;
+
+    std::string to_spec() const
+    {
+        return std::to_string(stride) + ":" + std::to_string(sample) + ":"
+            + std::to_string(seed) + ":" + std::to_string(per_stack);
+    }
+};
+
+class FailureSampler {
+public:
+    // Enable auto injection with controls from the detector
+    bool parse(const char* spec)
+    {
+        failure_sample_config_t parsed;
+        if (sscanf(spec, "%u:%lf:%u:%u", &parsed.stride, &parsed.sample,
+                    &parsed.seed, &parsed.per_stack) != 4 || !parsed.stride)
+            return false;
+        parsed.enabled = true;
+        config = parsed;
+        rng_state = config.seed;
+        return true;
+    }
+
+    bool enabled() {return config.enabled;}
+    // The call stack ID is only used with a per-stack limit
+    bool needs_stack() {return config.per_stack > 0;}
+
+    // Call for each ordering point of the RoI thread, in trace order
+    bool select(uint64_t stack)
+    {
+        if (count++ % config.stride) return false;
+        if (config.sample < 1.0 && next_random() >= config.sample) return false;
+        if (config.per_stack) {
+            unsigned& injected = per_stack_count[stack];
+            if (injected >= config.per_stack) return false;
+            injected++;
+        }
+        return true;
+    }
+
+    // Call stack ID of a list of return addresses
+    static uint64_t stack_id(void* const* frames, int count)
+    {
+        uint64_t id = 0xcbf29ce484222325ULL;
+        for (int i = 0; i < count; ++i) {
+            id = (id ^ (uint64_t)frames[i]) * 0x100000001b3ULL;
+        }
+        return id;
+    }
+
+private:
+    // splitmix64, uniform in [0, 1)
+    double next_random()
+    {
+        uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        return (z >> 11) * (1.0 / (1ULL << 53));
+    }
+
+    failure_sample_config_t config;
+    uint64_t count = 0;
+    uint64_t rng_state = 0;
+    std::unordered_map<uint64_t, unsigned> per_stack_count;
+};
+
+#endif // FAILURE_SAMPLER_HH
@@ -0,0 +1,182 @@
+#ifndef PM_RANGE_HH
+#define PM_RANGE_HH
+
+/*
+ * Table of mapped PM ranges, filled by pmem_map_file()/pm_trace_pm_addr_add()
+ * and emptied by pmem_unmap()/pm_trace_pm_addr_remove().
+ *
+ * Lookups run on every traced load and store, possibly from many threads,
+ * while updates only happen when pools are mapped or unmapped. The ranges
+ * are kept in a small sorted array that is never modified once published:
+ * updates build a new array, sized for the ranges it can end up with, and
+ * swap the pointer, and old arrays are never freed, so lookups need no lock.
+ * The last matching range is checked first, which makes the common lookup a
+ * single compare.
+ *
+ * Until the first range is added, the fixed window at PM_ADDR_BASE is used,
+ * for workloads that map PM by other means (PMEM_MMAP_HINT).
+ */
+
+#include <algorithm>
+
+struct pm_range_list_t {
+    unsigned count;
+    unsigned capacity;
+    addr_t* start;
+    addr_t* length;
+};
+
+class PMRangeTable {
+public:
+    // Constant initialized, may be used before static constructors run
+    constexpr PMRangeTable() : ranges(NULL), last_hit(0), lock(false) {}
+    PMRangeTable(const PMRangeTable& in)
+        : ranges(in.load()), last_hit(0), lock(false) {}
+    PMRangeTable& operator=(const PMRangeTable& in)
+    {
+        publish(in.load());
+        return *this;
+    }
+
+    void add(addr_t addr, size_t size)
+    {
+        if (!size) return;
+        acquire();
+        const pm_range_list_t* old_list = load();
+        // Adds at most one range
+        pm_range_list_t* new_list = alloc_list(old_list ? old_list->count + 1 : 1);
+
+        // Merge the new range with overlapping or adjacent ranges
+        addr_t start = addr;
+        addr_t end = addr + size;
+        bool inserted = false;
+        for (unsigned i = 0; old_list && i < old_list->count; ++i) {
+            addr_t cur_start = old_list->start[i];
+            addr_t cur_end = cur_start + old_list->length[i];
+            if (cur_end < start) {
+                append(new_list, cur_start, cur_end);
+            } else if (cur_start > end) {
+                if (!inserted) append(new_list, start, end);
+                inserted = true;
+                append(new_list, cur_start, cur_end);
+            } else {
+                start = std::min(start, cur_start);
+                end = std::max(end, cur_end);
+            }
+        }
+        if (!inserted) append(new_list, start, end);
+
+        publish(new_list);
+        release();
+    }
+
+    void remove(addr_t addr, size_t size)
+    {
+        if (!size) return;
+        acquire();
+        const pm_range_list_t* old_list = load();
+        if (!old_list) {
+            release();
+            return;
+        }
+        // Splitting a range adds at most one range
+        pm_range_list_t* new_list = alloc_list(old_list->count + 1);
+
+        addr_t end = addr + size;
+        for (unsigned i = 0; i < old_list->count; ++i) {
+            addr_t cur_start = old_list->start[i];
+            addr_t cur_end = cur_start + old_list->length[i];
+            // Keep the parts outside of the removed range
+            if (cur_start < addr)
+                append(new_list, cur_start, std::min(cur_end, addr));
+            if (cur_end > end)
+                append(new_list, std::max(cur_start, end), cur_end);
+        }
+
+        publish(new_list);
+        release();
+    }
+
+    // Check whether an access of size bytes at addr is on PM
+    inline bool contains(addr_t addr, size_t size) const
+    {
+        const pm_range_list_t* list = load();
+        if (!list) {
+            return (addr + size < PM_ADDR_BASE + PM_ADDR_SIZE) && (addr >= PM_ADDR_BASE);
+        }
+
+        unsigned hint = __atomic_load_n(&last_hit, __ATOMIC_RELAXED);
+        if (hint < list->count && in_range(list, hint, addr, size))
+            return true;
+
+        // Find the last range that starts at or below addr
+        unsigned lo = 0, hi = list->count;
+        while (lo < hi) {
+            unsigned mid = (lo + hi) / 2;
+            if (list->start[mid] <= addr) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == 0 || !in_range(list, lo-1, addr, size))
+            return false;
+        __atomic_store_n(&last_hit, lo-1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    unsigned size() const
+    {
+        const pm_range_list_t* list = load();
+        return list ? list->count : 0;
+    }
+
+private:
+    // Adjacent ranges are merged, so an access never spans two of them
+    static inline bool in_range(const pm_range_list_t* list, unsigned i,
+                                addr_t addr, size_t size)
+    {
+        addr_t offset = addr - list->start[i];
+        return offset < list->length[i] && size <= list->length[i] - offset;
+    }
+    static pm_range_list_t* alloc_list(unsigned capacity)
+    {
+        pm_range_list_t* list = new pm_range_list_t;
+        list->count = 0;
+        list->capacity = capacity;
+        list->start = new addr_t[capacity];
+        list->length = new addr_t[capacity];
+        return list;
+    }
+    static void append(pm_range_list_t* list, addr_t start, addr_t end)
+    {
+        if (start >= end) return;
+        assert(list->count < list->capacity && "PM range list too small");
+        list->start[list->count] = start;
+        list->length[list->count] = end - start;
+        list->count++;
+    }
+    const pm_range_list_t* load() const
+    {
+        return __atomic_load_n(&ranges, __ATOMIC_ACQUIRE);
+    }
+    void publish(const pm_range_list_t* list)
+    {
+        // The old list may still be in use by other threads, leak it
+        __atomic_store_n(&ranges, list, __ATOMIC_RELEASE);
+    }
+    void acquire()
+    {
+        while (__atomic_test_and_set(&lock, __ATOMIC_ACQUIRE)) ;
+    }
+    void release()
+    {
+        __atomic_clear(&lock, __ATOMIC_RELEASE);
+    }
+
+    const pm_range_list_t* ranges;
+    mutable unsigned last_hit;
+    bool lock;
+};
+
+// Ranges of the traced program, defined by the pintool and the runtime
+extern PMRangeTable pm_range_table;
+
+#endif // PM_RANGE_HH
@@ -0,0 +1,61 @@
+#ifndef PMDK_FUNCS_HH
+#define PMDK_FUNCS_HH
+
+/* PMDK's API functions. These are PMDK's internal functions which can be
+ * assumed to be safe, PM writes inside them are regarded as consistent.
+ * Shared by the pintool and the compiler-instrumentation runtime. */
+static const char* const pmdk_internal_func_names[] = {
+    // From tx.c
+    "pmemobj_tx_begin",
+    "pmemobj_tx_stage",
+    "pmemobj_tx_process",
+    "pmemobj_tx_lock",
+    "pmemobj_tx_abort",
+    "pmemobj_tx_commit",
+    "pmemobj_tx_end",
+    //"pmemobj_tx_add_common",
+    "pmemobj_tx_add_range_direct",
+    "pmemobj_tx_xadd_range_direct",
+    "pmemobj_tx_add_range",
+    "pmemobj_tx_xadd_range",
+    "pmemobj_tx_alloc",
+    "pmemobj_tx_zalloc",
+    "pmemobj_tx_xalloc",
+    "pmemobj_tx_realloc",
+    "pmemobj_tx_zrealloc",
+    "pmemobj_tx_strdup",
+    "pmemobj_tx_wcsdup",
+    "pmemobj_tx_free",
+    "pmemobj_tx_publish",
+    // From obj.c
+    "pmemobj_create",
+    "pmemobj_open",
+    "pmemobj_close",
+    "pmemobj_check",
+    "pmemobj_alloc",
+    "pmemobj_xalloc",
+    "pmemobj_zalloc",
+    "pmemobj_realloc",
+    "pmemobj_zrealloc",
+    "pmemobj_strdup",
+    "pmemobj_wcsdup",
+    "pmemobj_free",
+    "pmemobj_root_construct",
+    "pmemobj_root",
+    "pmemobj_reserve",
+    "pmemobj_xreserve",
+    "pmemobj_publish",
+    "pmemobj_cancel",
+    "pmemobj_list_insert",
+    "pmemobj_list_insert_new",
+    "pmemobj_list_remove",
+    "pmemobj_list_move",
+    "pmemobj_ctl_set",
+    "pmemobj_ctl_exec",
+    // TODO, add pmemobj version of pmem functions
+};
+
+#define NUM_PMDK_INTERNAL_FUNCS \
+    (sizeof(pmdk_internal_func_names)/sizeof(pmdk_internal_func_names[0]))
+
+#endif // PMDK_FUNCS_HH
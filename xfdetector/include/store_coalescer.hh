@@ -0,0 +1,160 @@
+#ifndef STORE_COALESCER_HH
+#define STORE_COALESCER_HH
+
+/*
+ * Coalescing of adjacent PM stores before they are sent to the detector.
+ *
+ * memcpy/memset loops and struct initializations generate long runs of
+ * small adjacent stores. A run of stores from the same thread that extend
+ * each other is held back and sent as a single WRITE entry. Every entry
+ * passes through push() in trace order, and any entry that is not merged
+ * (flush, fence, TX hook, RoI, failure point, another thread or a
+ * non-adjacent store) closes the pending run first, so the detector sees
+ * the same order of events.
+ *
+ * The detector handles a range exactly as the stores it is made of only
+ * when it does not depend on where a store starts. Stores are therefore
+ * not merged:
+ *  - across registered commit variables, which are matched by containment,
+ *  - inside a transaction, where each store is checked against TX_ADD-ed
+ *    ranges, unless in a PMDK internal function,
+ *  - from different instructions, unless in a PMDK internal function, to
+ *    keep the write IPs in bug reports exact.
+ * The levels are tracked from the same trace entries the detector uses.
+ */
+
+#include <map>
+
+// Largest coalesced store (bytes)
+#define COALESCE_MAX_SIZE 4096
+
+class StoreCoalescer {
+public:
+    bool enabled = false;
+
+    // Feed the next entry of the trace. Returns the number of entries to
+    // send (0, 1 or 2), copied to out[] in order.
+    unsigned push(const trace_entry_t* trace, trace_entry_t* out)
+    {
+        if (!enabled) {
+            out[0] = *trace;
+            return 1;
+        }
+
+        unsigned count = 0;
+        if (trace->operation == WRITE && !trace->func_ret) {
+            if (pending && can_merge(trace)) {
+                run.size += trace->size;
+                last_ip = trace->instr_ptr;
+                return 0;
+            }
+            count = flush(out);
+            if (can_start(trace)) {
+                run = *trace;
+                last_ip = trace->instr_ptr;
+                pending = true;
+            } else {
+                out[count++] = *trace;
+            }
+            return count;
+        }
+
+        count = flush(out);
+        if (!trace->func_ret) track(trace);
+        out[count++] = *trace;
+        return count;
+    }
+
+    // Close the pending run. Returns the number of entries copied to out.
+    unsigned flush(trace_entry_t* out)
+    {
+        if (!pending) return 0;
+        pending = false;
+        *out = run;
+        return 1;
+    }
+
+private:
+    void track(const trace_entry_t* trace)
+    {
+        int tid = trace->tid;
+        if (tid < 0 || tid >= MAX_THREADS) return;
+        switch (trace->operation) {
+            case PM_TRACE_TX_BEGIN:
+                tx_level[tid]++;
+                break;
+            case PM_TRACE_TX_END:
+                if (tx_level[tid] > 0) tx_level[tid]--;
+                break;
+            case PMDK_INTERNAL_CALL:
+                internal_level[tid]++;
+                break;
+            case PMDK_INTERNAL_RET:
+                if (internal_level[tid] > 0) internal_level[tid]--;
+                break;
+            case _ADD_COMMIT_VAR:
+                add_commit_var(trace->src_addr, trace->size);
+                break;
+            default:
+                break;
+        }
+    }
+
+    bool in_internal_funct(int tid)
+    {
+        return internal_level[tid] > 0;
+    }
+
+    bool can_start(const trace_entry_t* trace)
+    {
+        int tid = trace->tid;
+        if (tid < 0 || tid >= MAX_THREADS) return false;
+        if (trace->size >= COALESCE_MAX_SIZE) return false;
+        if (tx_level[tid] > 0 && !in_internal_funct(tid)) return false;
+        return !overlaps_commit_var(trace->dst_addr, trace->size);
+    }
+
+    bool can_merge(const trace_entry_t* trace)
+    {
+        if (trace->tid != run.tid
+                || trace->non_temporal != run.non_temporal
+                || trace->dst_addr != run.dst_addr + run.size
+                || run.size + trace->size > COALESCE_MAX_SIZE)
+            return false;
+        if (trace->instr_ptr != last_ip && !in_internal_funct(trace->tid))
+            return false;
+        return !overlaps_commit_var(trace->dst_addr, trace->size);
+    }
+
+    void add_commit_var(addr_t addr, size_t size)
+    {
+        if (!size) return;
+        addr_t& end = commit_vars[addr];
+        end = std::max(end, addr + size);
+        max_commit_var_size = std::max(max_commit_var_size, size);
+    }
+
+    bool overlaps_commit_var(addr_t addr, size_t size)
+    {
+        if (commit_vars.empty()) return false;
+        // Only variables starting less than the largest size before addr
+        // can reach into the range
+        addr_t from = addr > max_commit_var_size ? addr - max_commit_var_size : 0;
+        for (auto it = commit_vars.lower_bound(from);
+                it != commit_vars.end() && it->first < addr + size; ++it) {
+            if (it->second > addr) return true;
+        }
+        return false;
+    }
+
+    bool pending = false;
+    trace_entry_t run;
+    addr_t last_ip = 0;
+    int tx_level[MAX_THREADS] = {};
+    int internal_level[MAX_THREADS] = {};
+    // Start and end of registered commit variables
+    std::map<addr_t, addr_t> commit_vars;
+    size_t max_commit_var_size = 0;
+};
+
+#endif // STORE_COALESCER_HH
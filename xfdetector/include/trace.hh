@@ -59,8 +59,15 @@ struct trace_entry_t {
     // size_t dst_size = 0;
     addr_t instr_ptr = 0;
     int non_temporal = 0;
+    // ID of the failure point (TRACE_END only), src_addr holds the
+    // call stack ID of the failure point
+    int failure_id = -1;
     // size_t line_number = 0;
     // char file_name[20];
 };
 
+#include "store_coalescer.hh"
+#include "trace_codec.hh"
+#include "failure_sampler.hh"
+
 #endif // TRACE_HH
\ No newline at end of file
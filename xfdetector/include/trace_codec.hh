@@ -0,0 +1,236 @@
+#ifndef TRACE_CODEC_HH
+#define TRACE_CODEC_HH
+
+/*
+ * Packed wire format of the trace FIFOs.
+ *
+ * A trace_entry_t takes 64 bytes, while a typical WRITE only needs an
+ * opcode, an address close to the previous one, a small size and an IP
+ * close to the previous one. Each entry is sent as:
+ *
+ *   header   op (bits 0-4), func_ret (bit 5), non_temporal (bit 6),
+ *            tid differs from the previous entry (bit 7)
+ *   fields   bit set for each non-default field that follows
+ *   tid      varint, if changed
+ *   src_addr zigzag varint delta from the previous address
+ *   dst_addr zigzag varint delta from the previous address
+ *   size     varint
+ *   instr_ptr  zigzag varint delta from the previous IP
+ *   failure_id zigzag varint
+ *
+ * Varints are LEB128. Deltas are taken against the last address of either
+ * kind, as stores, flushes and reads of the same data follow each other.
+ * The encoder and decoder state starts over for every traced process.
+ */
+
+#include <vector>
+
+#define TRACE_CODEC_MAX_SIZE 64
+
+#define TRACE_CODEC_OP_MASK 0x1f
+#define TRACE_CODEC_FUNC_RET 0x20
+#define TRACE_CODEC_NON_TEMPORAL 0x40
+#define TRACE_CODEC_NEW_TID 0x80
+
+#define TRACE_CODEC_SRC 0x01
+#define TRACE_CODEC_DST 0x02
+#define TRACE_CODEC_SIZE 0x04
+#define TRACE_CODEC_IP 0x08
+#define TRACE_CODEC_FAILURE_ID 0x10
+
+static_assert(PM_TRACE_DETECTION_SKIP_END <= TRACE_CODEC_OP_MASK,
+                "Trace operation does not fit in the packed header");
+
+struct trace_codec_state_t {
+    int tid = 0;
+    addr_t addr = 0;
+    addr_t ip = 0;
+};
+
+class TraceEncoder {
+public:
+    // Encode count entries to buf, which holds at least
+    // count * TRACE_CODEC_MAX_SIZE bytes. Returns the encoded size.
+    size_t encode(const trace_entry_t* traces, unsigned count, uint8_t* buf)
+    {
+        uint8_t* cur = buf;
+        for (unsigned i = 0; i < count; ++i) {
+            cur = encode_one(&traces[i], cur);
+        }
+        return cur - buf;
+    }
+
+    void reset() {state = trace_codec_state_t();}
+
+private:
+    static uint8_t* put_varint(uint8_t* cur, uint64_t val)
+    {
+        while (val >= 0x80) {
+            *cur++ = (uint8_t)val | 0x80;
+            val >>= 7;
+        }
+        *cur++ = (uint8_t)val;
+        return cur;
+    }
+
+    static uint8_t* put_delta(uint8_t* cur, addr_t val, addr_t* last)
+    {
+        int64_t delta = (int64_t)(val - *last);
+        *last = val;
+        return put_varint(cur, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    }
+
+    uint8_t* encode_one(const trace_entry_t* trace, uint8_t* cur)
+    {
+        uint8_t header = trace->operation;
+        if (trace->func_ret) header |= TRACE_CODEC_FUNC_RET;
+        if (trace->non_temporal) header |= TRACE_CODEC_NON_TEMPORAL;
+        if (trace->tid != state.tid) header |= TRACE_CODEC_NEW_TID;
+
+        uint8_t fields = 0;
+        if (trace->src_addr) fields |= TRACE_CODEC_SRC;
+        if (trace->dst_addr) fields |= TRACE_CODEC_DST;
+        if (trace->size) fields |= TRACE_CODEC_SIZE;
+        if (trace->instr_ptr) fields |= TRACE_CODEC_IP;
+        if (trace->failure_id != -1) fields |= TRACE_CODEC_FAILURE_ID;
+
+        *cur++ = header;
+        *cur++ = fields;
+        if (header & TRACE_CODEC_NEW_TID) {
+            cur = put_varint(cur, (uint32_t)trace->tid);
+            state.tid = trace->tid;
+        }
+        if (fields & TRACE_CODEC_SRC) cur = put_delta(cur, trace->src_addr, &state.addr);
+        if (fields & TRACE_CODEC_DST) cur = put_delta(cur, trace->dst_addr, &state.addr);
+        if (fields & TRACE_CODEC_SIZE) cur = put_varint(cur, trace->size);
+        if (fields & TRACE_CODEC_IP) cur = put_delta(cur, trace->instr_ptr, &state.ip);
+        if (fields & TRACE_CODEC_FAILURE_ID) {
+            int64_t id = trace->failure_id;
+            cur = put_varint(cur, ((uint64_t)id << 1) ^ (uint64_t)(id >> 63));
+        }
+        return cur;
+    }
+
+    trace_codec_state_t state;
+};
+
+class TraceDecoder {
+public:
+    // Decode the entries in buf and append them to out. An entry split
+    // across calls is kept until the rest of it arrives.
+    void decode(const uint8_t* buf, size_t size, std::vector<trace_entry_t>* out)
+    {
+        const uint8_t* end = buf + size;
+
+        // Complete the entry left over from the last call
+        if (carry_size) {
+            size_t take = std::min((size_t)(end - buf), sizeof(carry) - carry_size);
+            memcpy(carry + carry_size, buf, take);
+            trace_entry_t trace;
+            size_t used = decode_one(carry, carry + carry_size + take, &trace);
+            if (!used) {
+                carry_size += take;
+                assert(carry_size < sizeof(carry) && "Corrupted trace");
+                return;
+            }
+            out->push_back(trace);
+            buf += used - carry_size;
+            carry_size = 0;
+        }
+
+        while (buf < end) {
+            trace_entry_t trace;
+            size_t used = decode_one(buf, end, &trace);
+            if (!used) {
+                carry_size = end - buf;
+                memcpy(carry, buf, carry_size);
+                return;
+            }
+            out->push_back(trace);
+            buf += used;
+        }
+    }
+
+    void reset()
+    {
+        state = trace_codec_state_t();
+        carry_size = 0;
+    }
+
+private:
+    static bool get_varint(const uint8_t** cur, const uint8_t* end, uint64_t* val)
+    {
+        uint64_t result = 0;
+        for (unsigned shift = 0; *cur < end && shift < 64; shift += 7) {
+            uint8_t byte = *(*cur)++;
+            result |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                *val = result;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool get_signed(const uint8_t** cur, const uint8_t* end, int64_t* val)
+    {
+        uint64_t zigzag;
+        if (!get_varint(cur, end, &zigzag)) return false;
+        *val = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        return true;
+    }
+
+    // Returns the size of the entry, or 0 if it is incomplete. The state
+    // is only updated once the whole entry is decoded.
+    size_t decode_one(const uint8_t* buf, const uint8_t* end, trace_entry_t* trace)
+    {
+        if (end - buf < 2) return 0;
+        const uint8_t* cur = buf;
+        uint8_t header = *cur++;
+        uint8_t fields = *cur++;
+        trace_codec_state_t next = state;
+        uint64_t val;
+        int64_t delta;
+
+        trace->operation = (pm_op_t)(header & TRACE_CODEC_OP_MASK);
+        trace->func_ret = header & TRACE_CODEC_FUNC_RET;
+        trace->non_temporal = (header & TRACE_CODEC_NON_TEMPORAL) ? 1 : 0;
+        if (header & TRACE_CODEC_NEW_TID) {
+            if (!get_varint(&cur, end, &val)) return 0;
+            next.tid = (int)val;
+        }
+        trace->tid = next.tid;
+        if (fields & TRACE_CODEC_SRC) {
+            if (!get_signed(&cur, end, &delta)) return 0;
+            next.addr += delta;
+            trace->src_addr = next.addr;
+        }
+        if (fields & TRACE_CODEC_DST) {
+            if (!get_signed(&cur, end, &delta)) return 0;
+            next.addr += delta;
+            trace->dst_addr = next.addr;
+        }
+        if (fields & TRACE_CODEC_SIZE) {
+            if (!get_varint(&cur, end, &val)) return 0;
+            trace->size = val;
+        }
+        if (fields & TRACE_CODEC_IP) {
+            if (!get_signed(&cur, end, &delta)) return 0;
+            next.ip += delta;
+            trace->instr_ptr = next.ip;
+        }
+        if (fields & TRACE_CODEC_FAILURE_ID) {
+            if (!get_signed(&cur, end, &delta)) return 0;
+            trace->failure_id = (int)delta;
+        }
+
+        state = next;
+        return cur - buf;
+    }
+
+    trace_codec_state_t state;
+    uint8_t carry[2 * TRACE_CODEC_MAX_SIZE];
+    size_t carry_size = 0;
+};
+
+#endif // TRACE_CODEC_HH
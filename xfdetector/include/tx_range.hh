@@ -0,0 +1,123 @@
+#ifndef TX_RANGE_HH
+#define TX_RANGE_HH
+
+/*
+ * Range containers for the transaction-scoped state of ShadowPM.
+ *
+ * The ranges TX_ADD-ed or written in a transaction are few, and all of
+ * them are dropped when the outermost transaction ends. They are kept in
+ * sorted vectors of closed ranges instead of boost interval containers:
+ * clear() keeps the storage, so once a thread has run a transaction of a
+ * given size, later transactions update their state without allocating.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#define TX_RANGE_INIT_CAPACITY 64
+
+struct tx_range_t {
+    addr_t lower;
+    addr_t upper;
+};
+
+struct tx_range_value_t {
+    addr_t lower;
+    addr_t upper;
+    addr_t value;
+};
+
+// Set of addresses, adjacent ranges are joined
+class TxRangeSet {
+public:
+    TxRangeSet() {ranges.reserve(TX_RANGE_INIT_CAPACITY);}
+
+    void add(addr_t addr, size_t size)
+    {
+        addr_t lower = addr;
+        addr_t upper = addr + size - 1;
+        // First range that overlaps or touches the new one
+        auto first = std::lower_bound(ranges.begin(), ranges.end(), lower,
+            [](const tx_range_t& range, addr_t val) {return range.upper + 1 < val;});
+        auto last = first;
+        while (last != ranges.end() && last->lower <= upper + 1) {
+            lower = std::min(lower, last->lower);
+            upper = std::max(upper, last->upper);
+            ++last;
+        }
+        if (first == last) {
+            ranges.insert(first, tx_range_t{lower, upper});
+        } else {
+            *first = tx_range_t{lower, upper};
+            ranges.erase(first + 1, last);
+        }
+    }
+
+    // Check whether the whole range is in the set
+    bool contains(addr_t addr, size_t size) const
+    {
+        addr_t upper = addr + size - 1;
+        // Last range starting at or below addr
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), addr,
+            [](addr_t val, const tx_range_t& range) {return val < range.lower;});
+        if (it == ranges.begin()) return false;
+        --it;
+        return upper <= it->upper;
+    }
+
+    void clear() {ranges.clear();}
+    bool empty() const {return ranges.empty();}
+    std::vector<tx_range_t>::const_iterator begin() const {return ranges.begin();}
+    std::vector<tx_range_t>::const_iterator end() const {return ranges.end();}
+
+private:
+    std::vector<tx_range_t> ranges;
+};
+
+// Map from addresses to a value, later updates overwrite earlier ones
+class TxRangeMap {
+public:
+    TxRangeMap() {ranges.reserve(TX_RANGE_INIT_CAPACITY);}
+
+    void update(addr_t addr, size_t size, addr_t value)
+    {
+        addr_t lower = addr;
+        addr_t upper = addr + size - 1;
+        // Ranges overlapping the new one are [first, last)
+        auto first = std::lower_bound(ranges.begin(), ranges.end(), lower,
+            [](const tx_range_value_t& range, addr_t val) {return range.upper < val;});
+        auto last = first;
+        while (last != ranges.end() && last->lower <= upper) ++last;
+
+        // Keep the parts of them outside of the new range
+        tx_range_value_t pieces[3];
+        unsigned count = 0;
+        if (first != last && first->lower < lower)
+            pieces[count++] = tx_range_value_t{first->lower, lower - 1, first->value};
+        pieces[count++] = tx_range_value_t{lower, upper, value};
+        if (first != last && (last - 1)->upper > upper)
+            pieces[count++] = tx_range_value_t{upper + 1, (last - 1)->upper, (last - 1)->value};
+
+        size_t idx = first - ranges.begin();
+        ranges.erase(first, last);
+        ranges.insert(ranges.begin() + idx, pieces, pieces + count);
+    }
+
+    // Value at the lowest address of the range that is in the map
+    bool lookup_first(addr_t addr, size_t size, addr_t* value) const
+    {
+        addr_t upper = addr + size - 1;
+        auto it = std::lower_bound(ranges.begin(), ranges.end(), addr,
+            [](const tx_range_value_t& range, addr_t val) {return range.upper < val;});
+        if (it == ranges.end() || it->lower > upper) return false;
+        *value = it->value;
+        return true;
+    }
+
+    void clear() {ranges.clear();}
+
+private:
+    std::vector<tx_range_value_t> ranges;
+};
+
+#endif // TX_RANGE_HH
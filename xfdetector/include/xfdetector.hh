@@ -19,6 +19,9 @@ using std::unordered_set;
 using namespace boost::icl;
 using namespace boost::filesystem;
 
+#include "tx_range.hh"
+#include "xfdetector_cow.h"
+
 /* Names of PM operations for print out */
 static const char* pm_op_name[] = {
     // Uninitialized operation
@@ -60,7 +63,7 @@ const std::string PIN_ROOT_ENV = "PIN_ROOT";
 const string HELP_STR = "HELP\n"
     "\n"
     "  USAGE\n"
-    "    xfdetector pintool_path pm_image_name [--failure-points=path] -- target_cmd\n"
+    "    xfdetector pintool_path pm_image_name [--failure-points=path] [--frontend=pin|cc] -- target_cmd\n"
     "\n"
     "  REQUIRED ARGUMENTS\n"
     "               pintool_path     Path to the pintool\n"
@@ -69,6 +72,35 @@ const string HELP_STR = "HELP\n"
     "\n"
     "  OPTIONAL ARGUMENTS\n"
     "          --failure-points=     Path to the file container failure points.\n"
+    "     --auto-failure-points=     on or off (default). Also inject failure points before every\n"
+    "                                fence, TX_ADD and TX commit of the RoI.\n"
+    "    --failure-point-stride=     Only inject at every Nth ordering point (default 1).\n"
+    "    --failure-point-sample=     Probability of injecting at an ordering point (default 1.0).\n"
+    "      --failure-point-seed=     Seed of the sampling (default 0).\n"
+    "--failure-points-per-stack=     Maximum number of ordering point failures per call stack\n"
+    "                                (default 0, no limit).\n"
+    "              --checkpoint=     Path to the campaign checkpoint. Progress is saved periodically\n"
+    "                                and completed failure points are skipped on restart.\n"
+    "                --frontend=     pin (default) or cc. cc runs a target built against\n"
+    "                                libxfdetector_rt with -fsanitize=thread, without Pin.\n"
+    "            --crash-images=     Also test crash images where unpersisted cache lines keep their\n"
+    "                                last persisted value: one (one line at a time), random or bounded.\n"
+    "       --crash-image-limit=     Maximum number of crash images per failure point (default 16).\n"
+    "        --crash-image-seed=     Seed of the random crash images (default 0).\n"
+    "      --crash-image-subset=     Maximum number of reverted lines of bounded crash images (default 2).\n"
+    "            --post-workers=     Number of threads checking post-failure reads (default 1).\n"
+    "       --post-failure-stop=     never (default), new or known. Terminate a post-failure execution\n"
+    "                                at its first new consistency bug, or at a bug once all of its\n"
+    "                                bugs were found before.\n"
+    "         --coalesce-stores=     on or off (default). Send runs of adjacent stores of a thread\n"
+    "                                as one trace entry.\n"
+    "               --cow-image=     on or off (default). Map the image privately in post-failure\n"
+    "                                executions instead of copying it. Not with --frontend=cc.\n"
+    "             --incremental=     Path to the results of the last campaign. Failure points whose\n"
+    "                                PM-accessing functions are unchanged reuse their results.\n"
+    "                  --budget=     Time budget in seconds. Test the failure points that add the\n"
+    "                                most coverage first, over multiple runs of the target.\n"
+    "          --schedule-batch=     Failure points tested per run with --budget (default 16).\n"
     "\n"
     "  TARGET COMMAND FORMAT\n"
     "             __POOL_IMAGE__     Name of the pool image, this part will be automatically replaced\n";
@@ -90,7 +122,8 @@ template <typename Type> struct inplace_assign:
 static pid_t pre_failure_pid;
 static pid_t post_failure_pid;
 
-static int exec_id;
+// Defined in xfdetector.cc
+extern int exec_id;
 
 #define XFD_ASSERT(cond) \
     assert(cond)
@@ -162,36 +195,31 @@ struct Bug_t {
 };
 
 // Trace entries that triggers a warning
-static vector<Bug_t> warn_vec;
+extern vector<Bug_t> warn_vec;
 // Trace entries that triggers a bug
-static vector<Bug_t> error_vec;
+extern vector<Bug_t> error_vec;
+// Dedup keys of the consistency bugs found by post-failure executions
+extern vector<uint64_t> finding_vec;
 
+// Record a bug found by ShadowPM in its warn_list/error_list
 #define WARN(op_ptr, message) {\
         Bug_t bug; \
         bug.op = *op_ptr; \
         strcpy(bug.description, message); \
-        warn_vec.push_back(bug); \
+        warn_list->push_back(bug); \
     }
 
 #define ERROR(op_ptr, message) {\
         Bug_t bug; \
         bug.op = *op_ptr; \
         strcpy(bug.description, message); \
-        error_vec.push_back(bug); \
+        error_list->push_back(bug); \
     }
 
 // Color output
 #define WARN_PRINT "\033[1;33m[WARN]\033[0m\n"
 #define ERROR_PRINT "\033[1;31m[ERROR]\033[0m\n"
 
-// Pintool flags
-#define PIN_TRACK_READ string("-r 1 ")
-#define PIN_ENABLE_FIFO string("-t 1 ")
-#define PIN_ENABLE_FAILURE string("-f 1 ")
-#define PIN_REDIRECT_OUT string("-o out ")
-#define PIN_SET_EXECID(val) (string("-i ") + std::to_string(val))
-#define PIN_SET_FAILURE_FILE(val) (string("-l ") + val)
-
 class ShadowPM {
 public:
     /* ========Constructor======== */
@@ -234,18 +262,32 @@ public:
     bool is_consistent(trace_entry_t*, addr_t, size_t);
     // Check if addr is within allocated PM locations
     bool is_pm_addr(trace_entry_t*, addr_t, size_t);
+    // Check if addr has no pending (unpersisted) modification
+    bool is_persisted(addr_t, size_t);
+    // Cache lines with modifications that are not persisted yet
+    void get_unpersisted_lines(std::set<addr_t>&);
+    // Same, with the IP of each write to them
+    void get_unpersisted_writes(vector<std::pair<addr_t, addr_t> >&);
+    // Translate a post-failure address to the pre-failure mapping of the
+    // same pool, pools are matched by the order they are mapped in
+    addr_t rebase_post_addr(addr_t);
 
     bool is_added_addr(trace_entry_t*, addr_t, size_t);
     bool is_non_added_write_addr(trace_entry_t*, addr_t, size_t);
     void add_tx_add_addr(trace_entry_t*, addr_t, size_t, int, bool);
     // void add_tx_alloc_addr(trace_entry_t*, addr_t, size_t, int);
     void add_non_tx_add_addr(trace_entry_t*, addr_t, size_t);
-    interval_set_addr get_tx_added_addr(int tid);
+    const TxRangeSet& get_tx_added_addr(int tid);
     void add_commit_var_addr(trace_entry_t* op_ptr, addr_t addr, size_t size);
     bool is_commit_var_addr(trace_entry_t* op_ptr, addr_t addr, size_t size);
     bool is_recent_commit_update(trace_entry_t* op_ptr, addr_t addr, size_t size);
     void add_write_addr_IP_mapping(trace_entry_t* op_ptr);
     bool print_look_up_write_addr_IP_mapping(trace_entry_t* op_ptr, addr_t addr, size_t size, FILE* file);
+    // Dedup key of an inconsistent read: the writers of the read range,
+    // the call stack of the failure point and the reason. Addresses are
+    // left out as heap objects move between executions, and read IPs as
+    // they change with ASLR between post-failure executions.
+    uint64_t finding_key(addr_t addr, size_t size, int reason);
 
     bool lookup_checked_addr(addr_t addr, size_t size);
     void insert_checked_addr(addr_t addr, size_t size);
@@ -262,8 +304,21 @@ public:
     int is_detection_disabled(int tid);
     void update_commitVar_timestamp();
     timestamp_t global_timestamp = 0;
+    // Destination of bug reports, redirected by post-failure workers
+    FILE* report_file = stderr;
+    vector<Bug_t>* warn_list = &warn_vec;
+    vector<Bug_t>* error_list = &error_vec;
+    vector<uint64_t>* finding_list = &finding_vec;
+    // Call stack ID of the last failure point, inherited by the copies
+    // checking its post-failure executions
+    uint64_t failure_stack = 0;
 
 private:
+    // Mapped PM ranges
+    PMRangeTable pm_ranges;
+    // Pre-failure and post-failure pool mappings, in mapping order
+    vector<std::pair<addr_t, size_t> > pre_pools;
+    vector<std::pair<addr_t, size_t> > post_pools;
     // PM address to memory status mapping
     interval_map_addr_status pm_status;
     // PM address to modification timestamp mapping
@@ -272,12 +327,12 @@ private:
     // Keep track of library function calls.
     int pre_InternalFunctLevel[MAX_THREADS];
     // Address set for tracking TX_ADD-ed addresses inside the transaction.
-    interval_set_addr tx_added_addr[MAX_THREADS];
-    interval_map_addr_IP tx_alloc_addr_IP_mapping[MAX_THREADS];
-    interval_map_addr_IP tx_added_addr_IP_mapping[MAX_THREADS];
+    TxRangeSet tx_added_addr[MAX_THREADS];
+    TxRangeMap tx_alloc_addr_IP_mapping[MAX_THREADS];
+    TxRangeMap tx_added_addr_IP_mapping[MAX_THREADS];
     // Address set for tracking non TX_ADD-ed write inside the transaction.
     // We use this to detect inconsistency caused by having TX_ADD after write.
-    interval_set_addr tx_non_added_write_addr[MAX_THREADS];
+    TxRangeSet tx_non_added_write_addr[MAX_THREADS];
     // Counter for nested transaction.
     int tx_level[MAX_THREADS];
     // Filter out checked addresses
@@ -293,14 +348,62 @@ private:
 
 #define NUM_OPTIONS 5
 
+// When to terminate a post-failure execution before it completes
+enum PostStopPolicy {
+    // Run recovery to completion
+    POST_STOP_NEVER,
+    // Stop at the first finding that was not found before
+    POST_STOP_NEW,
+    // Stop at a finding once all findings of the execution are known
+    POST_STOP_KNOWN
+};
+
+enum CrashImageMode {
+    CRASH_IMAGE_NONE,
+    // Revert one unpersisted line per image
+    CRASH_IMAGE_ONE,
+    // Revert a random subset of unpersisted lines per image
+    CRASH_IMAGE_RANDOM,
+    // Revert every subset of up to subset_size unpersisted lines
+    CRASH_IMAGE_BOUNDED
+};
+
+struct crash_image_config_t {
+    CrashImageMode mode = CRASH_IMAGE_NONE;
+    unsigned limit = CRASH_IMAGE_DEFAULT_LIMIT;
+    unsigned seed = 0;
+    unsigned subset_size = CRASH_IMAGE_DEFAULT_SUBSET;
+};
+
+class CrashImageGen;
+
 class ExeCtrl {
 public:
     void init(int, std::vector<string>);
     void execute_pre_failure();
-    string execute_post_failure();
+    // Run post-failure on a copy of the image, optionally turned into
+    // the given crash image first. Returns the temporary file to remove
+    // once the execution completes, if any.
+    string execute_post_failure(CrashImageGen* = NULL, unsigned = 0);
     string get_executable_path() {return executable_path; }
+    string get_checkpoint_file() {return checkpoint_file; }
+    string get_pm_image_name() {return pm_image_name; }
+    crash_image_config_t get_crash_image_config() {return crash_image_config; }
+    unsigned get_post_workers() {return post_workers; }
+    PostStopPolicy get_post_stop_policy() {return post_stop_policy; }
+    failure_sample_config_t get_failure_sample_config() {return failure_sample_config; }
+    string get_incremental_file() {return incremental_file; }
+    unsigned get_budget() {return budget; }
+    unsigned get_schedule_batch() {return schedule_batch; }
+    string get_target_command() {return pre_failure_exec_command; }
+    pid_t get_pre_failure_pid();
+    void set_resume_failure_id(int);
+    // Failure list of the following pre-failure executions
+    void set_failure_point_file(string);
     // void kill_proc(unsigned);
     void term_pre_failure();
+    // Kill the pre-failure process and wait until it exits
+    void finish_pre_failure();
     void term_post_failure();
     int post_failure_status();
     // int exec_id = -1; // Change to global
@@ -308,11 +411,34 @@ private:
     string copy_pm_image();
     char *change_env(char *kv);
     char** genPinCommand(int, string);
+    int add_frontend_env(char**, int, int);
+    int add_cow_env(char**, int, string);
+    void disable_aslr();
     void parse_exec_command(std::vector<string>);
     string rename_pool_img(string);
     string getExeName();
     string config_file;
     string failure_point_file;
+    string checkpoint_file;
+    // Target is built with the compiler-instrumentation runtime
+    bool cc_frontend = false;
+    int resume_failure_id = -1;
+    crash_image_config_t crash_image_config;
+    unsigned post_workers = 1;
+    PostStopPolicy post_stop_policy = POST_STOP_NEVER;
+    // Failure points at ordering points
+    failure_sample_config_t failure_sample_config;
+    // Merge adjacent stores in the trace
+    bool coalesce_stores = false;
+    // Map the image privately in post-failure executions instead of
+    // copying it (libxfdetector_cow)
+    bool cow_image = false;
+    string cow_library;
+    // Results of the last campaign, targets run without ASLR if set
+    string incremental_file;
+    // Scheduling of failure points, targets run without ASLR if set
+    unsigned budget = 0; // s
+    unsigned schedule_batch = SCHEDULE_DEFAULT_BATCH;
     string pintool_path;
     string executable_path;
     string pm_image_name;
@@ -328,6 +454,59 @@ private:
         = PIN_TRACK_READ + PIN_ENABLE_FIFO + PIN_REDIRECT_OUT; // + PIN_SET_EXECID(exec_id);
 };
 
+struct trace_batch_t {
+    // Packed trace, entries may be split across batches
+    char* data;
+    size_t size;
+};
+
+/*
+ * Single-producer single-consumer queue of trace batches. An ingestion
+ * thread drains a trace FIFO into the batches while the analysis consumes
+ * them, so reading the trace overlaps with updating the shadow PM. The
+ * pintool is only blocked on a full FIFO when all batches are in use.
+ */
+class TraceQueue {
+public:
+    TraceQueue();
+    ~TraceQueue();
+    // Start draining the FIFO, from an ingestion thread if threaded
+    void start(int, bool);
+    // Stop and join the ingestion thread
+    void stop();
+    // Wait for the next batch, up to a timeout in ms (< 0 waits until the
+    // writer closes the FIFO). Returns its size, or 0 if there is none.
+    int pop(char**, int);
+    // Return the popped batch to the ingestion thread
+    void release();
+
+private:
+    void ingest();
+    bool wait(std::atomic<bool>*, std::condition_variable*, unsigned*,
+                const std::function<bool()>&);
+    void notify(std::atomic<bool>*, std::condition_variable*);
+
+    trace_batch_t batches[TRACE_QUEUE_DEPTH];
+    // Batches published by the ingestion thread
+    std::atomic<unsigned> tail;
+    // Batches released by the analysis
+    std::atomic<unsigned> head;
+    bool holding = false;
+    // No writer on the FIFO
+    std::atomic<bool> eof;
+    std::atomic<bool> stopping;
+    int fd = -1;
+    bool threaded = false;
+    std::thread ingest_thread;
+
+    // Sleeping on an empty or full queue
+    std::mutex wait_lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::atomic<bool> consumer_waiting{false};
+    std::atomic<bool> producer_waiting{false};
+};
+
 class XFDetectorFIFO {
 public:
     // Read from pre-failure FIFO
@@ -337,8 +516,8 @@ public:
     // Send control signals
     void pin_continue_send();
     trace_entry_t* get_trace(int, unsigned);
-    void clear_pre_fifo_buf() {memset(pre_fifo_buf, 0, PIN_FIFO_BUF_SIZE);}
-    void clear_post_fifo_buf() {memset(post_fifo_buf, 0, PIN_FIFO_BUF_SIZE);}
+    // Number of trace entries read from a stage so far
+    uint64_t trace_count(int);
 
     XFDetectorFIFO(int);
     ~XFDetectorFIFO();
@@ -358,12 +537,24 @@ private:
     // Create all FIFOs
     void fifo_create(int exec_id);
 
-    // FIFO buffer for pre-failure trace
-    trace_entry_t* pre_fifo_buf;
-    // FIFO buffer for post-failure trace
-    trace_entry_t* post_fifo_buf;
+    // Unpack the next batch of a FIFO into traces, returns its size in bytes
+    int read_traces(TraceQueue*, TraceDecoder*, vector<trace_entry_t>*, int);
+
+    // Batch of pre-failure trace being analyzed
+    vector<trace_entry_t> pre_traces;
+    // Batch of post-failure trace being analyzed
+    vector<trace_entry_t> post_traces;
+    uint64_t pre_trace_count = 0;
+    uint64_t post_trace_count = 0;
+    TraceDecoder pre_decoder;
+    TraceDecoder post_decoder;
     char* signal_buf;
 
+    // Trace read ahead from the FIFOs
+    bool pipelined;
+    TraceQueue pre_queue;
+    TraceQueue post_queue;
+
     // FIFO for PIN tool
     int pre_fifo_fd;
     int post_fifo_fd;
@@ -385,7 +576,341 @@ public:
     bool pre_testing_complete = INCOMPLETE;
     bool pre_failure_point_complete = INCOMPLETE;
     bool post_testing_complete = INCOMPLETE;
+    // ID of the last failure point reached in pre-failure execution
+    int failure_id = -1;
+    // and its call stack ID
+    uint64_t failure_stack = 0;
+private:
+};
+
+/*
+ * Checks post-failure executions on multiple threads. Each worker keeps its
+ * own copy of the pre-failure shadow PM and applies all post-failure updates
+ * to it, but only checks the reads of the cache lines it owns, so every read
+ * is checked against the same state as in sequential checking. Reports are
+ * buffered by the workers and printed in trace order after each batch.
+ */
+class PostFailureChecker {
+public:
+    PostFailureChecker(unsigned);
+    ~PostFailureChecker();
+    // Start checking a post-failure execution against the pre-failure state
+    void begin(ShadowPM*);
+    // Check a batch of post-failure trace and print its reports
+    void check(trace_entry_t*, unsigned);
+    // TESTING_END has been checked
+    bool testing_complete() {return workers[0].detector.post_testing_complete;}
+    // Destination of the reports in trace order
+    FILE* report_out = stderr;
+
 private:
+    enum worker_cmd_t {WORKER_BEGIN, WORKER_CHECK, WORKER_STOP};
+    struct report_t {
+        unsigned long long seq;
+        unsigned worker;
+        long start;
+        long end;
+    };
+    struct worker_t {
+        ShadowPM* shadow_mem = NULL;
+        XFDetectorDetector detector;
+        // Reports of the current batch
+        FILE* report_file = NULL;
+        char* report_buf = NULL;
+        size_t report_size = 0;
+        vector<report_t> reports;
+        vector<Bug_t> warns;
+        vector<Bug_t> errors;
+        vector<uint64_t> findings;
+        // Reports of updates that another worker also applies
+        FILE* null_file = NULL;
+        vector<Bug_t> discarded;
+        vector<uint64_t> discarded_findings;
+        std::thread thread;
+    };
+
+    void run_worker(unsigned);
+    void check_batch(unsigned);
+    void run_cmd(worker_cmd_t);
+    void print_reports();
+
+    unsigned num_workers;
+    worker_t* workers;
+    ShadowPM* snapshot = NULL;
+    trace_entry_t* batch = NULL;
+    unsigned batch_count = 0;
+    // Trace position of the first entry in the batch
+    unsigned long long batch_seq = 0;
+
+    std::mutex cmd_lock;
+    std::condition_variable cmd_ready;
+    std::condition_variable cmd_done;
+    worker_cmd_t cmd = WORKER_BEGIN;
+    unsigned cmd_generation = 0;
+    unsigned workers_done = 0;
+};
+
+class CampaignCheckpoint {
+public:
+    // Restore progress from a checkpoint file, returns false if there is none
+    bool load(string);
+    // Write progress to the checkpoint file
+    void save(bool);
+    // Call when the post-failure execution of a failure point completes.
+    // Saves the checkpoint every CHECKPOINT_INTERVAL failure points or
+    // CHECKPOINT_PERIOD seconds.
+    void complete_failure_point(int, long long);
+    bool enabled() {return !checkpoint_file.empty();}
+    // Last failure point with a completed post-failure execution
+    int last_failure_id = -1;
+    // Whether the last saved campaign reached the end of testing
+    bool campaign_complete = false;
+    // Accumulated stats, including previous runs
+    unsigned failure_points_tested = 0;
+    long long post_failure_time = 0; // ms
+    long long total_time = 0; // ms
+private:
+    string checkpoint_file;
+    unsigned unsaved_failure_points = 0;
+    time_t last_save_time = 0;
+};
+
+// Crash image: cache lines reverted to their last persisted contents
+struct crash_image_t {
+    vector<addr_t> lines;
+};
+
+class CrashImageGen {
+public:
+    ~CrashImageGen();
+    void init(crash_image_config_t, string);
+    bool enabled() {return config.mode != CRASH_IMAGE_NONE;}
+    // Call before another pre-failure execution from the original image
+    void restart();
+    // Call when pmem_map_file() maps the image in pre-failure execution
+    void set_image_base(addr_t);
+    // Call for every pre-failure write
+    void touch(addr_t, size_t, bool);
+    // Call for every pre-failure flush
+    void flush(addr_t, size_t);
+    // Call at a failure point, while pre-failure execution is stopped.
+    // Snapshots the lines persisted since the last failure point and
+    // generates the crash images of this failure point.
+    void generate(ShadowPM*, int);
+    unsigned num_images() {return images.size();}
+    // Write the reverted lines of an image to a copy of the PM image
+    void apply(unsigned, string);
+    // Write them to a patch file of libxfdetector_cow instead
+    void write_patch(unsigned, string);
+    string describe(unsigned);
+private:
+    void snapshot_line(int, addr_t);
+    void read_base_line(addr_t, char*);
+    bool line_offset(addr_t, off_t*);
+    crash_image_config_t config;
+    string pm_image_name;
+    // Copy of the image before pre-failure execution, if it existed
+    string base_image_name;
+    int base_fd = -1;
+    addr_t image_base = 0;
+    off_t image_size = 0;
+    // Lines written since they were last snapshotted
+    std::set<addr_t> dirty_lines;
+    // Dirty lines flushed since they were last snapshotted
+    std::set<addr_t> stale_lines;
+    // Last persisted contents of written lines
+    unordered_map<addr_t, string> persisted_lines;
+    vector<crash_image_t> images;
+};
+
+// Code of a function in an ELF file
+struct elf_func_t {
+    addr_t start;
+    size_t size;
+    string name;
+};
+
+class ElfImage {
+public:
+    bool load(string);
+    // Function containing a file offset / with a given name
+    const elf_func_t* find_by_offset(off_t);
+    const elf_func_t* find_by_name(const string&);
+    // Hash of the code, calls and jumps to functions are hashed by
+    // the name of their target, so that moving code around does not
+    // change the hash of its callers
+    uint64_t hash(const elf_func_t*);
+private:
+    bool vaddr_to_offset(addr_t, off_t*);
+    bool offset_to_vaddr(off_t, addr_t*);
+    vector<char> data;
+    vector<std::pair<off_t, addr_t> > segments; // file offset, vaddr
+    vector<size_t> segment_sizes;
+    // Sorted by start, one name per address
+    vector<elf_func_t> funcs;
+    unordered_map<string, unsigned> func_names;
+};
+
+struct inc_failure_point_t {
+    // Functions of the failure point, the PM accesses since the previous
+    // one and in post-failure executions (indices of the function table)
+    int site = -1;
+    vector<unsigned> pre_funcs;
+    vector<unsigned> post_funcs;
+    // Some accesses could not be mapped to a function
+    bool unknown = false;
+    // Taken from the last campaign without testing
+    bool reused = false;
+    string report;
+};
+
+struct inc_func_t {
+    string module;
+    string name;
+    uint64_t hash;
+};
+
+/*
+ * Results of the last campaign, to only test the failure points whose
+ * PM-accessing code changed since then. Shadow PM at a failure point
+ * depends on all the trace before it, so once a failure point differs from
+ * the last campaign, none of the following ones reuse their results.
+ */
+class IncrementalDB {
+public:
+    // Load the last campaign, returns false if there is none
+    bool load(string, string);
+    void save();
+    bool enabled() {return !db_file.empty();}
+    // Call for every trace entry of the current failure point
+    void record_pre(trace_entry_t*);
+    void record_post(trace_entry_t*, unsigned);
+    // Call at a failure point while the pre-failure process is stopped.
+    // Returns true after printing the result of the last campaign if it
+    // can be reused, false if the failure point has to be tested.
+    bool reuse_failure_point(int, pid_t);
+    // Reports of the post-failure executions of the failure point
+    FILE* get_report_file() {return report_file;}
+    // Call once the failure point is tested
+    void complete_failure_point(int);
+    ~IncrementalDB();
+
+private:
+    struct module_range_t {
+        addr_t start;
+        addr_t end;
+        off_t offset;
+        string path;
+    };
+    static ssize_t capture_report(void*, const char*, size_t);
+    void read_maps(pid_t);
+    bool find_in_maps(addr_t);
+    int resolve(addr_t);
+    int add_func(const string&, const string&);
+    uint64_t current_hash(const string&, const string&, bool*);
+    bool unchanged(const inc_func_t&);
+    void resolve_set(const unordered_set<addr_t>&, vector<unsigned>*);
+
+    string db_file;
+    string config;
+    // Last campaign
+    vector<inc_func_t> old_funcs;
+    std::map<int, inc_failure_point_t> old_points;
+    // This campaign
+    vector<inc_func_t> funcs;
+    unordered_map<string, unsigned> func_index;
+    std::map<int, inc_failure_point_t> points;
+    bool diverged = false;
+
+    // Current failure point
+    unordered_set<addr_t> pre_ips;
+    unordered_set<addr_t> post_ips;
+    addr_t failure_ip = 0;
+    inc_failure_point_t cur_point;
+    string cur_report;
+    FILE* report_file = NULL;
+    vector<module_range_t> maps;
+    unordered_map<string, ElfImage*> images;
+};
+
+struct sched_failure_point_t {
+    int id;
+    // Call stack ID of the failure point
+    uint64_t stack = 0;
+    // Write IPs of the unpersisted data, sorted, and their hash
+    vector<addr_t> write_ips;
+    uint64_t write_set = 0;
+    // Unpersisted lines (pool location) and the IPs of their writes
+    vector<std::pair<uint64_t, addr_t> > writes;
+    bool tested = false;
+};
+
+/*
+ * Tests the most novel failure points first within a wall-clock budget.
+ * The first run of the pre-failure program only collects the state of
+ * every failure point. Each following run tests the best-scoring batch
+ * through the failure list. A failure point scores for a call stack, a set
+ * of unpersisted write IPs and pairs of a recovery read site and a write
+ * to the data it reads that no tested failure point covered, where read
+ * sites are taken from the post-failure executions so far.
+ */
+class FailureScheduler {
+public:
+    void init(unsigned, unsigned, string);
+    ~FailureScheduler();
+    bool enabled() {return budget > 0;}
+    // Call before each run of the pre-failure program. Returns false once
+    // the budget is used up or every failure point is tested.
+    bool begin_round();
+    // Failure points are only collected in the first run
+    bool profiling() {return round == 1;}
+    // Failure list of the current run
+    string get_failure_list() {return list_file;}
+    // Call for every pre-failure trace entry
+    void record_pre(trace_entry_t*);
+    // Call before each post-failure execution and for its traces
+    void begin_post();
+    void record_post(trace_entry_t*, unsigned);
+    // Call at a failure point while the pre-failure process is stopped
+    void add_failure_point(int, uint64_t, ShadowPM*);
+    // Call once a failure point is tested
+    void complete_failure_point(int);
+    // All failure points of the current run are tested. The last run
+    // continues to the end of testing, which is tested as well.
+    bool round_complete() {return !profiling() && !last_round && round_tested == round_size;}
+    bool out_of_budget();
+    void print_summary();
+private:
+    uint64_t location(const vector<std::pair<addr_t, size_t> >&, addr_t);
+    // Failure points already selected for the run count as covered
+    unsigned score(const sched_failure_point_t&, const unordered_set<uint64_t>&,
+                    const unordered_set<addr_t>&);
+    void restore_image();
+
+    unsigned budget = 0; // s
+    unsigned batch = SCHEDULE_DEFAULT_BATCH;
+    time_t start_time = 0;
+    string pm_image_name;
+    // Copy of the image before the first run, if it existed
+    string base_image_name;
+    string list_file;
+    unsigned round = 0;
+    std::set<int> round_points;
+    unsigned round_size = 0;
+    unsigned round_tested = 0;
+    bool last_round = false;
+    unsigned unreached = 0;
+    std::map<int, sched_failure_point_t> points;
+    // Pools in mapping order, PM locations are offsets in them
+    vector<std::pair<addr_t, size_t> > pre_pools;
+    vector<std::pair<addr_t, size_t> > post_pools;
+    // Read sites of each PM line in post-failure executions
+    unordered_map<uint64_t, unordered_set<addr_t> > read_sites;
+    // Covered by the tested failure points
+    unordered_set<uint64_t> covered_stacks;
+    unordered_set<uint64_t> covered_write_sets;
+    unordered_set<addr_t> covered_write_ips;
+    unordered_set<uint64_t> covered_pairs;
 };
 
 // Get existing envs
@@ -0,0 +1,31 @@
+#ifndef XFDETECTOR_COW_H
+#define XFDETECTOR_COW_H
+
+/*
+ * Copy-free post-failure images (libxfdetector_cow).
+ *
+ * The detector preloads libxfdetector_cow into post-failure executions and
+ * passes them the pre-failure image itself instead of a copy. The library
+ * maps the image MAP_PRIVATE, so recovery writes, flushes and msync()
+ * only touch private copy-on-write pages and never reach the file.
+ *
+ * A crash image is passed as a patch file of reverted cache lines, which
+ * are written into every private mapping of the image.
+ */
+
+#include <stdint.h>
+
+// Path of the image to map privately
+#define XFD_COW_IMAGE_ENV "XFD_COW_IMAGE"
+// Optional path of the patch file
+#define XFD_COW_PATCH_ENV "XFD_COW_PATCH"
+
+#define XFD_COW_LINE_SIZE 64
+
+// Patch file record
+struct xfd_cow_line {
+    uint64_t offset; // in the image
+    char data[XFD_COW_LINE_SIZE];
+};
+
+#endif // XFDETECTOR_COW_H
@@ -12,29 +12,112 @@
 #define PRE_FAILURE 1 
 #define POST_FAILURE 2
 
-/* User interface functions */
+// Set by the detector in the environment of the traced program
+#define XFDETECTOR_ATTACHED_ENV "XFD_ATTACHED"
 
-// Select Region of Interest (RoI) for pm-race detection
+/*
+ * User interface functions
+ *
+ * The annotations are inline wrappers. Production builds define
+ * XFDETECTOR_DISABLE and the annotations compile to nothing. Otherwise each
+ * annotation is a single branch on xfdetector_attached, which is resolved
+ * once when the program is loaded, and only calls into
+ * libxfdetector_interface when the program runs under the detector.
+ */
+
+// Resolved at load time from the environment
+extern int xfdetector_attached;
+extern int xfdetector_stage;
+
+void _XFDetector_RoIBegin(int condition, int stage);
+void _XFDetector_RoIEnd(int condition, int stage);
+void _XFDetector_addFailurePoint(int condition);
+void _XFDetector_skipFailureBegin(int condition);
+void _XFDetector_skipFailureEnd(int condition);
+void _XFDetector_complete(int condition, int stage);
+void _XFDetector_addCommitVar(const void*, unsigned);
+void _skipDetectionBegin(void);
+void _skipDetectionEnd(void);
+
+/*
+ * Out-of-line annotations of the same names, kept in the library for
+ * programs built against older versions of this header. They always call
+ * into the library, as before.
+ */
+#ifdef XFDETECTOR_COMPAT_SYMBOLS
 void XFDetector_RoIBegin(int condition, int stage);
 void XFDetector_RoIEnd(int condition, int stage);
+void XFDetector_addFailurePoint(int condition);
+void XFDetector_skipFailureBegin(int condition);
+void XFDetector_skipFailureEnd(int condition);
+void XFDetector_complete(int condition, int stage);
+void XFDetector_addCommitVar(const void*, unsigned);
+void skipDetectionBegin(int condition, int stage);
+void skipDetectionEnd(int condition, int stage);
+#else
+
+#ifndef XFDETECTOR_DISABLE
+#define XFDETECTOR_ATTACHED() __builtin_expect(xfdetector_attached, 0)
+#else
+// Keeps the arguments referenced, the call is removed even without optimization
+#define XFDETECTOR_ATTACHED() 0
+#endif
+#define XFDETECTOR_CALL(call) do { if (XFDETECTOR_ATTACHED()) call; } while (0)
+
+// Select Region of Interest (RoI) for pm-race detection
+static inline void XFDetector_RoIBegin(int condition, int stage)
+{
+    XFDETECTOR_CALL(_XFDetector_RoIBegin(condition, stage));
+}
+
+static inline void XFDetector_RoIEnd(int condition, int stage)
+{
+    XFDETECTOR_CALL(_XFDetector_RoIEnd(condition, stage));
+}
 
 // Insert additional failure points
-void XFDetector_addFailurePoint(int condition);
+static inline void XFDetector_addFailurePoint(int condition)
+{
+    XFDETECTOR_CALL(_XFDetector_addFailurePoint(condition));
+}
 
 // Skip all the added and auto-generated failure points to speedup testing
-void XFDetector_skipFailureBegin(int condition);
-void XFDetector_skipFailureEnd(int condition);
+static inline void XFDetector_skipFailureBegin(int condition)
+{
+    XFDETECTOR_CALL(_XFDetector_skipFailureBegin(condition));
+}
+
+static inline void XFDetector_skipFailureEnd(int condition)
+{
+    XFDETECTOR_CALL(_XFDetector_skipFailureEnd(condition));
+}
 
 // End of all testing
-void XFDetector_complete(int condition, int stage);
+static inline void XFDetector_complete(int condition, int stage)
+{
+    XFDETECTOR_CALL(_XFDetector_complete(condition, stage));
+}
 // Updates within the atomic region are regarded either persist or not persist to PM
 // XFDetector checks if the update exceeds the writeback granularity (one cache line)
 // #define XFDetector_AtomicUpdate(code) __atomic_update_begin(); code; _atomic_update_end();
 
 // Register a variable that commits updates
-void XFDetector_addCommitVar(const void*, unsigned);
+static inline void XFDetector_addCommitVar(const void* variable, unsigned size)
+{
+    XFDETECTOR_CALL(_XFDetector_addCommitVar(variable, size));
+}
 
-void skipDetectionBegin(int condition, int stage);
-void skipDetectionEnd(int condition, int stage);
+// Skip detection in the given stages
+static inline void skipDetectionBegin(int condition, int stage)
+{
+    XFDETECTOR_CALL(if (condition && (xfdetector_stage & stage)) _skipDetectionBegin());
+}
+
+static inline void skipDetectionEnd(int condition, int stage)
+{
+    XFDETECTOR_CALL(if (condition && (xfdetector_stage & stage)) _skipDetectionEnd());
+}
+
+#endif // XFDETECTOR_COMPAT_SYMBOLS
 
 #endif // PMRACE_INTERFACE
\ No newline at end of file
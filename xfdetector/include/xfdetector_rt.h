@@ -0,0 +1,68 @@
+#ifndef XFDETECTOR_RT_H
+#define XFDETECTOR_RT_H
+
+/*
+ * Hooks of the compiler-instrumentation runtime (libxfdetector_rt).
+ *
+ * Workloads compiled with -fsanitize=thread have their loads and stores
+ * reported to the runtime through the __tsan_* callbacks. The hooks below
+ * replace the routines that the pintool instruments by name. Libraries built
+ * with -DXFDETECTOR_RT call them through weak references, so they still link
+ * and run without the runtime.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Callers only keep weak references to the hooks. The runtime itself
+ * defines XFDETECTOR_RT_IMPL.
+ */
+#if defined(XFDETECTOR_RT) && !defined(XFDETECTOR_RT_IMPL)
+#define XFD_RT_API __attribute__((weak))
+#else
+#define XFD_RT_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// pmem_map_file()/pmem_unmap()
+XFD_RT_API void xfd_rt_map(const void* addr, size_t size);
+XFD_RT_API void xfd_rt_unmap(const void* addr, size_t size);
+
+// Writeback and ordering (flush_*_nolog, predrain_memory_barrier)
+XFD_RT_API void xfd_rt_flush(const void* addr, size_t size);
+XFD_RT_API void xfd_rt_fence(void);
+
+// pm_trace_* annotations in libpmemobj
+XFD_RT_API void xfd_rt_pm_addr_add(uint64_t addr, uint64_t size);
+XFD_RT_API void xfd_rt_pm_addr_remove(uint64_t addr, uint64_t size);
+XFD_RT_API void xfd_rt_tx_begin(void);
+XFD_RT_API void xfd_rt_tx_end(void);
+XFD_RT_API void xfd_rt_tx_addr_add(uint64_t addr, uint64_t size);
+
+// XFDetector_* annotations (xfdetector_interface.c)
+XFD_RT_API void xfd_rt_roi_begin(int stage);
+XFD_RT_API void xfd_rt_roi_end(int stage);
+XFD_RT_API void xfd_rt_failure_point(void);
+XFD_RT_API void xfd_rt_skip_failure(int skip);
+XFD_RT_API void xfd_rt_testing_complete(int stage);
+XFD_RT_API void xfd_rt_add_commit_var(const void* addr, unsigned size);
+XFD_RT_API void xfd_rt_skip_detection(int skip);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * XFD_RT_CALL -- call a runtime hook if the runtime is linked in
+ */
+#if defined(XFDETECTOR_RT) && !defined(XFDETECTOR_RT_IMPL)
+#define XFD_RT_CALL(func, ...) do { if (func) func(__VA_ARGS__); } while (0)
+#else
+#define XFD_RT_CALL(func, ...) do {} while (0)
+#endif
+
+#endif // XFDETECTOR_RT_H
@@ -36,6 +36,9 @@ bool read_enable = false;
 // Auto inject failure points
 bool failure_enable = false;
 
+// Inject failure points at ordering points, selected by the sampler
+FailureSampler failure_sampler;
+
 // List of failure points
 bool failure_list_enable = false;
 unordered_map<int, int> failure_map;
@@ -43,6 +46,9 @@ unordered_map<int, int> failure_map;
 // Initialize to -1
 int cur_failure_id = -1;
 
+// Failure points up to this ID were completed by a previous (checkpointed) run
+int resume_failure_id = -1;
+
 // Send trace to FIFO
 bool fifo_enable = false;
 
@@ -64,6 +70,8 @@ bool skip_failure = false;
 typedef interval_set<addr_t> interval_set_addr;
 typedef interval_set_addr::interval_type ival;
 interval_set_addr pm_addr_set;
+// Mapped PM ranges, used to filter traced accesses
+PMRangeTable pm_range_table;
 
 #ifdef SKIP_FUNC_OP
 
@@ -113,6 +121,15 @@ KNOB<string> KnobEnableFIFO(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<string> KnobSetExecID(KNOB_MODE_WRITEONCE, "pintool",
     "i", "", "set execution id");
 
+KNOB<string> KnobResumeFailureID(KNOB_MODE_WRITEONCE, "pintool",
+    "s", "", "skip failure points up to (and including) this id");
+
+KNOB<string> KnobCoalesceWrites(KNOB_MODE_WRITEONCE, "pintool",
+    "c", "", "coalesce adjacent PM stores into one trace entry");
+
+KNOB<string> KnobAutoFailure(KNOB_MODE_WRITEONCE, "pintool",
+    "a", "", "inject failure points at ordering points (stride:sample:seed:per_stack)");
+
 /* ===================================================================== */
 // Utilities
 /* ===================================================================== */
@@ -141,6 +158,16 @@ void ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 flags, VOID *v)
     thread_counter.decrement(tid);
 }
 
+void Fini(INT32 code, VOID *v)
+{
+    trace_fifo.pinfifo_flush();
+    // The annotations are no-ops unless the program runs under the detector
+    if (!roi_tracker.roi_entered) {
+        cerr << "Warning: the program never entered the RoI, "
+            "set " XFD_ATTACHED_ENV "=1 when running it outside of xfdetector" << endl;
+    }
+}
+
 void waitOnSignal(const char* signal)
 {
     char buf[MAX_SIGNAL_LEN];
@@ -234,8 +261,17 @@ void RoIHandler(char* func_name, uint64_t tid)
     }
 }
 
+// Call stack ID of a failure point
+uint64_t getStackID(const CONTEXT* ctxt)
+{
+    void* frames[16];
+    PIN_LockClient();
+    int count = PIN_Backtrace(ctxt, frames, sizeof(frames)/sizeof(frames[0]));
+    PIN_UnlockClient();
+    return FailureSampler::stack_id(frames, count);
+}
 
-void addFailurePoint(void* writeIP, char* func_name, uint64_t tid)
+void addFailurePoint(const CONTEXT* ctxt, void* writeIP, char* func_name, uint64_t tid)
 {
     // Increment failure point ID even outside the RoI
     cur_failure_id++;
@@ -245,8 +281,10 @@ void addFailurePoint(void* writeIP, char* func_name, uint64_t tid)
     if (!roi_tracker.isInRoI(tid)) return;
 
     // Only add fialure point if specified in failure list
-    if (failure_list_enable 
-            && failure_map.find(cur_failure_id) == failure_map.end()) {
+    // and not already completed before the last checkpoint
+    if ((failure_list_enable 
+            && failure_map.find(cur_failure_id) == failure_map.end())
+            || cur_failure_id <= resume_failure_id) {
         return;
     }
     // cerr << "PIN Failure Point ID " << cur_failure_id << " Enabled" << endl;
@@ -274,6 +312,8 @@ void addFailurePoint(void* writeIP, char* func_name, uint64_t tid)
     trace_entry.tid = tid;
     trace_entry.operation = TRACE_END;
     trace_entry.instr_ptr = (addr_t)writeIP;
+    trace_entry.failure_id = cur_failure_id;
+    trace_entry.src_addr = getStackID(ctxt);
     trace_fifo.pinfifo_write(&trace_entry);
 
     // Wait until receives resumption singal
@@ -286,6 +326,24 @@ void addFailurePoint(void* writeIP, char* func_name, uint64_t tid)
 
 
 
+// Failure point before an ordering point, if selected by the sampler
+void addOrderingFailurePoint(const CONTEXT* ctxt, void* writeIP, uint64_t tid)
+{
+    // Only ordering points of the RoI thread are counted, so that the
+    // IDs do not depend on how other threads interleave with it
+    if (!roi_tracker.isInRoI(tid)) return;
+
+    uint64_t stack_id = 0;
+    if (failure_sampler.needs_stack()) stack_id = getStackID(ctxt);
+
+    if (failure_sampler.select(stack_id)) {
+        addFailurePoint(ctxt, writeIP, (char*)"", tid);
+    } else {
+        // Keep the IDs of later failure points the same
+        cur_failure_id++;
+    }
+}
+
 // Failure point injection
 void FailurePointInst(RTN rtn, void* v) 
 {
@@ -299,6 +357,7 @@ void FailurePointInst(RTN rtn, void* v)
         RTN_InsertCall(
             rtn, IPOINT_BEFORE,
             (AFUNPTR)addFailurePoint,
+            IARG_CONST_CONTEXT,
             IARG_RETURN_IP,
             IARG_ADDRINT, 
             RTN_Name(rtn).c_str(),
@@ -312,12 +371,24 @@ void FailurePointInst(RTN rtn, void* v)
         //     RTN_Name(rtn).c_str(),
         //     IARG_THREAD_ID,
         //     IARG_END);
+    } else if (failure_sampler.enabled() &&
+               ordering_point_funcs.find(func_name) != ordering_point_funcs.end()) {
+        // Before the ordering point is traced
+        RTN_InsertCall(
+            rtn, IPOINT_BEFORE,
+            (AFUNPTR)addOrderingFailurePoint,
+            IARG_CALL_ORDER, CALL_ORDER_FIRST,
+            IARG_CONST_CONTEXT,
+            IARG_RETURN_IP,
+            IARG_THREAD_ID,
+            IARG_END);
     } else if (func_name == "_skip_failure_point_begin" ||
                func_name == "_skip_failure_point_end") {
         // Skip injection of failure points on demand
         RTN_InsertCall(
             rtn, IPOINT_AFTER,
             (AFUNPTR)addFailurePoint,
+            IARG_CONST_CONTEXT,
             IARG_RETURN_IP,
             IARG_ADDRINT, 
             RTN_Name(rtn).c_str(),
@@ -407,6 +478,9 @@ int main(int argc, char *argv[])
     string failureOption = KnobEnableFailure.Value();
     string failureListFileName = KnobFailureListFile.Value();
     string fifoOption = KnobEnableFIFO.Value();
+    string resumeOption = KnobResumeFailureID.Value();
+    string coalesceOption = KnobCoalesceWrites.Value();
+    string autoFailureOption = KnobAutoFailure.Value();
     execIDStr = KnobSetExecID.Value();
 
     if (!fileName.empty()) { out = new std::ofstream(fileName.c_str());}
@@ -419,6 +493,15 @@ int main(int argc, char *argv[])
     
     if (!fifoOption.empty()) {fifo_enable = true;}
 
+    if (!resumeOption.empty()) {resume_failure_id = atoi(resumeOption.c_str());}
+
+    if (!coalesceOption.empty()) {trace_fifo.coalescer.enabled = true;}
+
+    if (!autoFailureOption.empty() && !failure_sampler.parse(autoFailureOption.c_str())) {
+        cerr << "Invalid auto failure injection option: " << autoFailureOption << endl;
+        return Usage();
+    }
+
     // if (!execIDStr.empty()) {execIDStr = string(".") + execIDStr;}
 
     if (read_enable && !failure_enable) {
@@ -427,8 +510,10 @@ int main(int argc, char *argv[])
         stage = PRE_FAILURE;
     }
 
-    trace_fifo.init(stage);
-    signal_fifo.init();
+    // Without the FIFO and failure points the tool runs without the
+    // detector, e.g., to measure the cost of the instrumentation alone
+    if (fifo_enable) trace_fifo.init(stage);
+    if (failure_enable) signal_fifo.init();
 
     if (failure_enable && failure_list_enable) {
         parseFailureList(failureListFileName);
@@ -463,6 +548,9 @@ int main(int argc, char *argv[])
     PIN_AddThreadStartFunction(ThreadStart, 0);
     PIN_AddThreadFiniFunction(ThreadFini, 0);
 
+    // Send the last coalesced store
+    PIN_AddFiniFunction(Fini, 0);
+
     // Pint tool description
     cerr <<  "===============================================" << endl;
     cerr <<  "This application is instrumented by XFDetectorPinTool" << endl;
@@ -487,6 +575,21 @@ int main(int argc, char *argv[])
     {
         cerr << "Trace FIFO enabled" << endl;
     }
+    // Coalescing option
+    if (!KnobCoalesceWrites.Value().empty())
+    {
+        cerr << "PM store coalescing enabled" << endl;
+    }
+    // Ordering point option
+    if (failure_sampler.enabled() && failure_enable)
+    {
+        cerr << "Failure injection at ordering points enabled (" << autoFailureOption << ")" << endl;
+    }
+    // Resume option
+    if (resume_failure_id >= 0)
+    {
+        cerr << "Resuming after failure point " << resume_failure_id << endl;
+    }
 
     cerr <<  "===============================================" << endl;
 
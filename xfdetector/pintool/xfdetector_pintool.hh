@@ -2,6 +2,7 @@
 #define PMRACE_PINTOOL_HH
 
 #include "../include/trace.hh"
+#include "../include/pmdk_funcs.hh"
 #include "pin.H"
 // #include "atomic.hpp"
 
@@ -97,6 +98,8 @@ std::pair<string, pm_func_t> pm_function_entries[] = {
 
 std::unordered_map<string, bool> failure_point_funcs;
 
+std::unordered_map<string, bool> pmdk_internal_funcs;
+
 char failure_point_funcs_array[][100] = {
     /*
     "pmem_memmove_persist",
@@ -123,6 +126,16 @@ char failure_point_funcs_array[][100] = {
     "pmfuzz_inject_failure"
 };
 
+// Ordering points that get failure points with auto injection (-a)
+std::unordered_map<string, bool> ordering_point_funcs;
+
+char ordering_point_funcs_array[][100] = {
+    "predrain_memory_barrier",
+    "pm_trace_tx_addr_add",
+    // TX commit
+    "pm_trace_tx_end"
+};
+
 // PIN tool does not support static initialization
 // Needs to manually call this function in PIN tool 
 void pm_func_init() 
@@ -134,16 +147,27 @@ void pm_func_init()
         // TODO: Using 1 as the value in map for now
         failure_point_funcs[string(failure_point_funcs_array[i])] = 1;
     }
+    for (unsigned i = 0; i < sizeof(ordering_point_funcs_array)/sizeof(ordering_point_funcs_array[0]); ++i) {
+        ordering_point_funcs[string(ordering_point_funcs_array[i])] = 1;
+    }
+    for (unsigned i = 0; i < NUM_PMDK_INTERNAL_FUNCS; ++i) {
+        pmdk_internal_funcs[string(pmdk_internal_func_names[i])] = 1;
+    }
 }
 
 class PINFifo {
 public:
     int pinfifo_write(trace_entry_t*);
+    void pinfifo_flush();
     void pinfifo_close();
     void init(int);
     PINFifo();
     ~PINFifo();
+    // Merges adjacent stores, disabled by default
+    StoreCoalescer coalescer;
 private:
+    // Packs entries for the FIFO, protected by fifo_lock
+    TraceEncoder encoder;
     string pin_fifo_str;
     int pinfifo_open(const char*);
     // int pmfifo_read(trace_entry_t*);
@@ -167,23 +191,53 @@ int PINFifo::pinfifo_open(const char* fifo_name)
 
 void PINFifo::pinfifo_close() 
 {
+    pinfifo_flush();
     close(fifo_fd);
 }
 
+void PINFifo::pinfifo_flush()
+{
+    if (!fifo_enable) return;
+    trace_entry_t out[1];
+    uint8_t buf[TRACE_CODEC_MAX_SIZE];
+    size_t size = 0;
+    int write_rtn = 0;
+    PIN_MutexLock(&fifo_lock);
+    unsigned count = coalescer.flush(out);
+    if (count) {
+        size = encoder.encode(out, count, buf);
+        write_rtn = write(fifo_fd, buf, size);
+    }
+    PIN_MutexUnlock(&fifo_lock);
+    if ((unsigned)write_rtn < size) {
+        cout << "cannot write FIFO" << endl;
+        exit(0);
+    }
+}
+
 int PINFifo::pinfifo_write(trace_entry_t* trace) 
 {
     // Send trace entry to FIFO only when FIFO is enabled
     if (fifo_enable) {
         //cout << "Trace written" << endl;
-        int write_rtn;
+        int write_rtn = 0;
+        // A closed store run goes out with the entry that closed it.
+        // Two entries are well below PIPE_BUF, the write stays atomic.
+        trace_entry_t out[2];
+        uint8_t buf[2 * TRACE_CODEC_MAX_SIZE];
+        size_t size = 0;
         PIN_MutexLock(&fifo_lock);
-        write_rtn = write(fifo_fd, trace, sizeof(trace_entry_t));
+        unsigned count = coalescer.push(trace, out);
+        if (count) {
+            size = encoder.encode(out, count, buf);
+            write_rtn = write(fifo_fd, buf, size);
+        }
         PIN_MutexUnlock(&fifo_lock);
-        if((unsigned)write_rtn<sizeof(trace_entry_t)){
+        if((unsigned)write_rtn<size){
             cout << "cannot write FIFO" << endl;
             exit(0);
         }
-        return write_rtn;
+        return sizeof(trace_entry_t);
     } else {
         // Write zero byte when FIFO is disabled
         return 0;
@@ -204,6 +258,8 @@ void PINFifo::init(int stage)
 
 PINFifo::PINFifo()
 {
+    // Not opened when the FIFO is disabled
+    fifo_fd = -1;
     PIN_MutexInit(&fifo_lock);
 }
 
@@ -278,6 +334,7 @@ void SignalFifo::signalfifo_close()
 
 SignalFifo::SignalFifo()
 {
+    fifo_fd = -1;
     PIN_MutexInit(&fifo_lock);
     // if (pinfifo_create() < 0) {
     //     ERR("PINFifo create failed.");
@@ -338,6 +395,8 @@ public:
     // Tracing controlled by passing RoI functions
     // bool trace_enable = false;
     uint64_t roi_tid;
+    // Any thread has entered the RoI
+    bool roi_entered = false;
 
 private:
     // Only track one thread for testing
@@ -352,6 +411,7 @@ bool RoITracker::trySetRoIThread(uint64_t tid)
     if (!roi_tid_set) {
         roi_tid_set = true;
         roi_tid = tid;
+        roi_entered = true;
         // trace_enable = true;
         PIN_MutexUnlock(&roi_lock);
         return true;
@@ -181,6 +181,7 @@ void recordPmemRetAllocation(char* rtnName, void* return_ip, uint64_t tid, ADDRI
     pm_alloc_size_ptr = NULL;
     // Update interval set
     pm_addr_set.insert(ival::closed(addr, (uint64_t)interval_size+((uint64_t)addr)-1));
+    pm_range_table.add(addr, interval_size);
    
     PinDEBUG(*out << "FunctRet: " << rtnName 
                 << " tid: " << tid 
@@ -213,6 +214,7 @@ void recordPmemDeallocation(char* rtnName, void* return_ip, uint64_t tid, ADDRIN
 #endif
 
     pm_addr_set.erase(ival::closed(addr, size+((uint64_t)addr)-1));
+    pm_range_table.remove(addr, size);
     PinDEBUG(*out << "Funct: " << rtnName 
              << " tid: " << tid << " addr: " << (void*)addr 
              << " size: " << size << endl);
@@ -31,6 +31,9 @@ void recordPmemAllocationTX(char* rtnName, void* return_ip, uint64_t tid, ADDRIN
 #endif
 
     pm_addr_set.insert(ival::closed(addr, size+((uint64_t)addr)-1));
+    // Shared with the TX annotations, only pool mappings are PM ranges
+    if (pm_functions[string(rtnName)].enum_name == PM_TRACE_PM_ADDR_ADD)
+        pm_range_table.add(addr, size);
     PinDEBUG(*out << "Funct: " << rtnName 
              << " tid: " << tid << " addr: " << (void*)addr 
              << " size: " << size << endl);
@@ -244,56 +247,8 @@ void PMDKInternalFunct(RTN rtn, void* v)
 
     string func_name = RTN_Name(rtn);
     // These are PMDK's internal function which can be assumed to be safe?
-	// From tx.c
-    if (func_name == "pmemobj_tx_begin" || 
-        func_name == "pmemobj_tx_stage" ||
-        func_name == "pmemobj_tx_process" ||
-        func_name == "pmemobj_tx_lock" || 
-        func_name == "pmemobj_tx_abort" ||
-        func_name == "pmemobj_tx_commit" ||
-        func_name == "pmemobj_tx_end" || 
-        //func_name == "pmemobj_tx_add_common" ||
-        func_name == "pmemobj_tx_alloc" ||
-        func_name == "pmemobj_tx_add_range_direct" || 
-        func_name == "pmemobj_tx_xadd_range_direct" ||
-        func_name == "pmemobj_tx_add_range" ||
-        func_name == "pmemobj_tx_xadd_range" ||
-        func_name == "pmemobj_tx_alloc" ||
-        func_name == "pmemobj_tx_zalloc" ||
-        func_name == "pmemobj_tx_xalloc" ||
-        func_name == "pmemobj_tx_realloc" ||
-        func_name == "pmemobj_tx_zrealloc" ||
-        func_name == "pmemobj_tx_strdup" ||
-        func_name == "pmemobj_tx_wcsdup" ||
-        func_name == "pmemobj_tx_free" ||
-        func_name == "pmemobj_tx_publish" ||
-	// From obj.c
-        func_name == "pmemobj_create" ||
-        func_name == "pmemobj_open" ||
-        func_name == "pmemobj_close" ||
-        func_name == "pmemobj_check" ||
-        func_name == "pmemobj_alloc" ||
-        func_name == "pmemobj_xalloc" ||
-        func_name == "pmemobj_zalloc" ||
-        func_name == "pmemobj_realloc" ||
-        func_name == "pmemobj_zrealloc" ||
-        func_name == "pmemobj_strdup" ||
-        func_name == "pmemobj_wcsdup" ||
-        func_name == "pmemobj_free" ||
-        func_name == "pmemobj_root_construct" ||
-        func_name == "pmemobj_root" ||
-        func_name == "pmemobj_reserve" ||
-        func_name == "pmemobj_xreserve" ||
-        func_name == "pmemobj_publish" ||
-        func_name == "pmemobj_cancel" ||
-        func_name == "pmemobj_list_insert" ||
-        func_name == "pmemobj_list_insert_new" ||
-        func_name == "pmemobj_list_remove" ||
-        func_name == "pmemobj_list_move" ||
-        func_name == "pmemobj_ctl_set" ||
-        func_name == "pmemobj_ctl_exec"
-        // TODO, add pmemobj version of pmem functions
-        ) {
+    // See pmdk_internal_func_names in pmdk_funcs.hh
+    if (pmdk_internal_funcs.find(func_name) != pmdk_internal_funcs.end()) {
         // Start or stop tracing after RoI functions
         RTN_InsertCall(
             rtn, IPOINT_BEFORE,
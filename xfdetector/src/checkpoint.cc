@@ -0,0 +1,120 @@
+#include "xfdetector.hh"
+#include <sys/time.h>
+
+#define CHECKPOINT_MAGIC "XFDETECTOR_CHECKPOINT"
+#define CHECKPOINT_VERSION 1
+
+static void save_bugs(FILE* file, const char* kind, vector<Bug_t>& bugs)
+{
+    for (auto &bug : bugs) {
+        fprintf(file, "%s %d %d %lx %lx %lx %lx %s\n", kind,
+            (int)bug.op.operation, bug.op.tid,
+            bug.op.src_addr, bug.op.dst_addr,
+            bug.op.size, bug.op.instr_ptr, bug.description);
+    }
+}
+
+static bool load_bug(string line, Bug_t* bug)
+{
+    int operation;
+    int desc_pos = 0;
+    if (sscanf(line.c_str(), "%*s %d %d %lx %lx %lx %lx %n", &operation,
+            &bug->op.tid, &bug->op.src_addr, &bug->op.dst_addr,
+            &bug->op.size, &bug->op.instr_ptr, &desc_pos) < 6 || !desc_pos) {
+        return false;
+    }
+    bug->op.operation = (pm_op_t)operation;
+    strncpy(bug->description, line.c_str() + desc_pos, sizeof(bug->description)-1);
+    bug->description[sizeof(bug->description)-1] = '\0';
+    return true;
+}
+
+bool CampaignCheckpoint::load(string file_name)
+{
+    checkpoint_file = file_name;
+    last_save_time = time(NULL);
+
+    std::ifstream ifs(checkpoint_file.c_str());
+    if (!ifs.is_open()) return false;
+
+    string key;
+    int version;
+    if (!(ifs >> key >> version) || key != CHECKPOINT_MAGIC
+            || version != CHECKPOINT_VERSION) {
+        ERR("Invalid checkpoint file: " + checkpoint_file);
+    }
+
+    string line;
+    while (getline(ifs, line)) {
+        std::istringstream iss(line);
+        if (!(iss >> key)) continue;
+
+        if (key == "COMPLETE") {
+            iss >> campaign_complete;
+        } else if (key == "LAST_FAILURE_ID") {
+            iss >> last_failure_id;
+        } else if (key == "FAILURE_POINTS_TESTED") {
+            iss >> failure_points_tested;
+        } else if (key == "POST_FAILURE_TIME_MS") {
+            iss >> post_failure_time;
+        } else if (key == "TOTAL_TIME_MS") {
+            iss >> total_time;
+        } else if (key == "WARN" || key == "ERROR") {
+            Bug_t bug;
+            if (!load_bug(line, &bug)) {
+                ERR("Invalid report in checkpoint file: " + line);
+            }
+            if (key == "WARN") warn_vec.push_back(bug);
+            else error_vec.push_back(bug);
+        }
+    }
+
+    ifs.close();
+    return true;
+}
+
+void CampaignCheckpoint::save(bool complete)
+{
+    if (!enabled()) return;
+
+    // Write to a temporary file and rename, so an interrupted save
+    // never leaves a truncated checkpoint behind.
+    string tmp_file = checkpoint_file + ".tmp";
+    FILE* file = fopen(tmp_file.c_str(), "w");
+    if (!file) ERR("Cannot open checkpoint file: " + tmp_file);
+
+    fprintf(file, "%s %d\n", CHECKPOINT_MAGIC, CHECKPOINT_VERSION);
+    fprintf(file, "COMPLETE %d\n", complete);
+    fprintf(file, "LAST_FAILURE_ID %d\n", last_failure_id);
+    fprintf(file, "FAILURE_POINTS_TESTED %u\n", failure_points_tested);
+    fprintf(file, "POST_FAILURE_TIME_MS %lld\n", post_failure_time);
+    fprintf(file, "TOTAL_TIME_MS %lld\n", total_time);
+    save_bugs(file, "WARN", warn_vec);
+    save_bugs(file, "ERROR", error_vec);
+
+    if (fflush(file) || fsync(fileno(file)) < 0)
+        ERR("Cannot write checkpoint file: " + tmp_file);
+    fclose(file);
+
+    if (rename(tmp_file.c_str(), checkpoint_file.c_str()) < 0)
+        ERR("Cannot rename checkpoint file: " + tmp_file);
+
+    campaign_complete = complete;
+    unsaved_failure_points = 0;
+    last_save_time = time(NULL);
+}
+
+void CampaignCheckpoint::complete_failure_point(int failure_id, long long post_time)
+{
+    XFD_ASSERT(failure_id > last_failure_id && "Failure point IDs must increase");
+
+    last_failure_id = failure_id;
+    failure_points_tested++;
+    post_failure_time += post_time;
+    unsaved_failure_points++;
+
+    if (unsaved_failure_points >= CHECKPOINT_INTERVAL
+            || time(NULL) - last_save_time >= CHECKPOINT_PERIOD) {
+        save(false);
+    }
+}
@@ -0,0 +1,230 @@
+#include "xfdetector.hh"
+
+void CrashImageGen::init(crash_image_config_t _config, string _pm_image_name)
+{
+    config = _config;
+    pm_image_name = _pm_image_name;
+    if (!enabled()) return;
+
+    // Lines never persisted during pre-failure execution revert to
+    // their contents before the execution
+    if (access(pm_image_name.c_str(), F_OK) == 0) {
+        base_image_name = pm_image_name + "_xfdetector_base";
+        string copy_command = "cp --reflink=auto " + pm_image_name + " " + base_image_name;
+        if (system(copy_command.c_str()) != 0)
+            ERR("Cannot copy image: " + pm_image_name);
+        base_fd = open(base_image_name.c_str(), O_RDONLY);
+        if (base_fd < 0) ERR("Cannot open image: " + base_image_name);
+    }
+}
+
+CrashImageGen::~CrashImageGen()
+{
+    if (base_fd >= 0) close(base_fd);
+    if (!base_image_name.empty())
+        remove(base_image_name.c_str());
+}
+
+void CrashImageGen::restart()
+{
+    image_base = 0;
+    image_size = 0;
+    dirty_lines.clear();
+    stale_lines.clear();
+    persisted_lines.clear();
+    images.clear();
+}
+
+void CrashImageGen::set_image_base(addr_t addr)
+{
+    // Only the first mapping is the PM image
+    if (!image_base) image_base = addr;
+}
+
+void CrashImageGen::touch(addr_t addr, size_t size, bool non_temporal)
+{
+    XFD_ASSERT(addr && size);
+    addr_t line = addr & ~((addr_t)CACHE_LINE_SIZE - 1);
+    for (; line < addr + size; line += CACHE_LINE_SIZE) {
+        dirty_lines.insert(line);
+        // Bypasses the cache, as if written and flushed
+        if (non_temporal) stale_lines.insert(line);
+    }
+}
+
+void CrashImageGen::flush(addr_t addr, size_t size)
+{
+    // The flushed contents may reach PM before the next failure point,
+    // where the line is snapshotted again if it is persisted by then.
+    // The pre-failure execution runs ahead of the trace, so the
+    // contents cannot be read here.
+    addr_t line = addr & ~((addr_t)CACHE_LINE_SIZE - 1);
+    for (; line < addr + size; line += CACHE_LINE_SIZE) {
+        if (dirty_lines.count(line)) stale_lines.insert(line);
+    }
+}
+
+bool CrashImageGen::line_offset(addr_t line, off_t* offset)
+{
+    // Images mapped without pmem_map_file() are expected at PM_ADDR_BASE
+    addr_t base = image_base ? image_base : PM_ADDR_BASE;
+    if (line < base || line - base + CACHE_LINE_SIZE > (addr_t)image_size)
+        return false;
+    *offset = line - base;
+    return true;
+}
+
+void CrashImageGen::snapshot_line(int fd, addr_t line)
+{
+    off_t offset;
+    if (!line_offset(line, &offset)) return;
+
+    char buf[CACHE_LINE_SIZE];
+    if (pread(fd, buf, CACHE_LINE_SIZE, offset) != CACHE_LINE_SIZE)
+        ERR("Cannot read image: " + pm_image_name);
+
+    persisted_lines[line] = string(buf, CACHE_LINE_SIZE);
+}
+
+void CrashImageGen::read_base_line(addr_t line, char* buf)
+{
+    auto it = persisted_lines.find(line);
+    if (it != persisted_lines.end()) {
+        memcpy(buf, it->second.data(), CACHE_LINE_SIZE);
+        return;
+    }
+
+    // Never persisted, use the contents before pre-failure execution
+    memset(buf, 0, CACHE_LINE_SIZE);
+    off_t offset;
+    if (base_fd < 0 || !line_offset(line, &offset)) return;
+    if (pread(base_fd, buf, CACHE_LINE_SIZE, offset) < 0)
+        ERR("Cannot read image: " + base_image_name);
+}
+
+void CrashImageGen::generate(ShadowPM* shadow_mem, int failure_id)
+{
+    images.clear();
+
+    struct stat st;
+    image_size = stat(pm_image_name.c_str(), &st) ? 0 : st.st_size;
+
+    // Snapshot the lines that are persisted at this failure point.
+    // Lines that are still pending keep their previous snapshot.
+    int fd = -1;
+    for (auto it = dirty_lines.begin(); it != dirty_lines.end(); ) {
+        if (shadow_mem->is_persisted(*it, CACHE_LINE_SIZE)) {
+            if (fd < 0) {
+                fd = open(pm_image_name.c_str(), O_RDONLY);
+                if (fd < 0) ERR("Cannot open image: " + pm_image_name);
+            }
+            snapshot_line(fd, *it);
+            stale_lines.erase(*it);
+            it = dirty_lines.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (fd >= 0) close(fd);
+
+    // Stale lines may have persisted contents newer than their snapshot,
+    // reverting them could create a state the program never reaches
+    std::set<addr_t> unpersisted;
+    shadow_mem->get_unpersisted_lines(unpersisted);
+    vector<addr_t> lines;
+    for (auto line : unpersisted) {
+        off_t offset;
+        if (line_offset(line, &offset) && !stale_lines.count(line))
+            lines.push_back(line);
+    }
+    if (lines.empty()) return;
+
+    if (config.mode == CRASH_IMAGE_ONE) {
+        for (unsigned i = 0; i < lines.size() && images.size() < config.limit; ++i) {
+            crash_image_t image;
+            image.lines.push_back(lines[i]);
+            images.push_back(image);
+        }
+    } else if (config.mode == CRASH_IMAGE_RANDOM) {
+        // Same images for the same failure point across runs
+        std::mt19937 rng(config.seed + failure_id);
+        std::set<vector<addr_t> > generated;
+        // Give up on duplicates when there are few lines to choose from
+        for (unsigned tries = 0; images.size() < config.limit
+                && tries < 4 * config.limit; ++tries) {
+            crash_image_t image;
+            for (auto line : lines) {
+                if (rng() & 1) image.lines.push_back(line);
+            }
+            if (image.lines.empty() || !generated.insert(image.lines).second)
+                continue;
+            images.push_back(image);
+        }
+    } else if (config.mode == CRASH_IMAGE_BOUNDED) {
+        // Enumerate subsets by increasing size
+        unsigned max_size = std::min((size_t)config.subset_size, lines.size());
+        for (unsigned size = 1; size <= max_size && images.size() < config.limit; ++size) {
+            vector<unsigned> idx(size);
+            for (unsigned i = 0; i < size; ++i) idx[i] = i;
+            while (images.size() < config.limit) {
+                crash_image_t image;
+                for (auto i : idx) image.lines.push_back(lines[i]);
+                images.push_back(image);
+                // Next combination of size lines
+                int pos = size - 1;
+                while (pos >= 0 && idx[pos] == lines.size() - size + pos) pos--;
+                if (pos < 0) break;
+                idx[pos]++;
+                for (unsigned i = pos + 1; i < size; ++i) idx[i] = idx[i-1] + 1;
+            }
+        }
+    }
+}
+
+void CrashImageGen::apply(unsigned idx, string image_copy_name)
+{
+    XFD_ASSERT(idx < images.size());
+
+    int fd = open(image_copy_name.c_str(), O_WRONLY);
+    if (fd < 0) ERR("Cannot open image: " + image_copy_name);
+    for (auto line : images[idx].lines) {
+        char buf[CACHE_LINE_SIZE];
+        off_t offset;
+        if (!line_offset(line, &offset)) continue;
+        read_base_line(line, buf);
+        if (pwrite(fd, buf, CACHE_LINE_SIZE, offset) != CACHE_LINE_SIZE)
+            ERR("Cannot write image: " + image_copy_name);
+    }
+    close(fd);
+}
+
+void CrashImageGen::write_patch(unsigned idx, string patch_name)
+{
+    XFD_ASSERT(idx < images.size());
+    static_assert(XFD_COW_LINE_SIZE == CACHE_LINE_SIZE, "Patch line size mismatch");
+
+    FILE* file = fopen(patch_name.c_str(), "w");
+    if (!file) ERR("Cannot open patch: " + patch_name);
+    for (auto line : images[idx].lines) {
+        struct xfd_cow_line patch_line;
+        off_t offset;
+        if (!line_offset(line, &offset)) continue;
+        patch_line.offset = offset;
+        read_base_line(line, patch_line.data);
+        if (fwrite(&patch_line, sizeof(patch_line), 1, file) != 1)
+            ERR("Cannot write patch: " + patch_name);
+    }
+    fclose(file);
+}
+
+string CrashImageGen::describe(unsigned idx)
+{
+    XFD_ASSERT(idx < images.size());
+
+    std::ostringstream oss;
+    oss << "Crash image " << idx+1 << "/" << images.size() << ", reverted lines:";
+    for (auto line : images[idx].lines) {
+        oss << " " << (void*)line;
+    }
+    return oss.str();
+}
@@ -1,5 +1,6 @@
 #include "xfdetector.hh"
 #include <sys/time.h>
+#include <sys/personality.h>
 
 #include <regex>
 
@@ -24,17 +25,55 @@ void ExeCtrl::init(int _exec_id, std::vector<string> args)
     // Set execution id
     exec_id = _exec_id;
 
+    // Parse commands according to config file    
+    parse_exec_command(args);
+
     // Add execution id to the pintool options
     if (exec_id >= 0) {
         pin_pre_failure_option += PIN_SET_EXECID(exec_id);
         pin_post_failure_option += PIN_SET_EXECID(exec_id);
     }
     if (!failure_point_file.empty()) {
-        pin_pre_failure_option += PIN_SET_FAILURE_FILE(failure_point_file);
+        pin_pre_failure_option += " " + PIN_SET_FAILURE_FILE(failure_point_file);
+    }
+    if (failure_sample_config.enabled) {
+        pin_pre_failure_option += PIN_AUTO_FAILURE(failure_sample_config.to_spec());
     }
+    if (coalesce_stores) {
+        pin_pre_failure_option = PIN_COALESCE_WRITES + pin_pre_failure_option;
+        pin_post_failure_option = PIN_COALESCE_WRITES + pin_post_failure_option;
+    }
+    if (cow_image) {
+        // Built next to the detector, in build/lib
+        char exe_path[PATH_MAX];
+        ssize_t len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+        if (len < 0) ERR("Cannot find the detector executable.");
+        string app_dir(exe_path, len);
+        app_dir = app_dir.substr(0, app_dir.rfind('/'));
+        cow_library = app_dir.substr(0, app_dir.rfind('/')) + "/lib/libxfdetector_cow.so";
+        if (access(cow_library.c_str(), R_OK) < 0)
+            ERR("Cannot find " + cow_library);
+    }
+}
 
-    // Parse commands according to config file    
-    parse_exec_command(args);
+void ExeCtrl::set_failure_point_file(string file)
+{
+    // The pintool option is added once with the first path. The path stays
+    // the same, only the contents of the file change between runs.
+    XFD_ASSERT(failure_point_file.empty() || failure_point_file == file);
+    if (failure_point_file.empty()) {
+        pin_pre_failure_option += " " + PIN_SET_FAILURE_FILE(file);
+    }
+    failure_point_file = file;
+}
+
+void ExeCtrl::set_resume_failure_id(int failure_id)
+{
+    // Failure points up to failure_id are skipped by the pintool
+    resume_failure_id = failure_id;
+    if (failure_id >= 0) {
+        pin_pre_failure_option += PIN_SET_RESUME_ID(failure_id);
+    }
 }
 
 char *ExeCtrl::change_env(char *kv) {
@@ -47,6 +86,65 @@ char *ExeCtrl::change_env(char *kv) {
     return result;
 }
 
+int ExeCtrl::add_frontend_env(char** env, int idx, int stage)
+{
+    // Annotations are no-ops unless the program runs under the detector
+    env[idx++] = alloc_print("%s=1", XFD_ATTACHED_ENV);
+    if (!cc_frontend) return idx;
+
+    // libxfdetector_rt takes the pintool options from the environment
+    env[idx++] = alloc_print("%s=1", XFD_RT_TRACE_ENV);
+    if (exec_id >= 0)
+        env[idx++] = alloc_print("%s=%d", XFD_RT_EXEC_ID_ENV, exec_id);
+    if (coalesce_stores)
+        env[idx++] = alloc_print("%s=1", XFD_RT_COALESCE_ENV);
+    if (stage == PRE_FAILURE) {
+        if (!failure_point_file.empty())
+            env[idx++] = alloc_print("%s=%s", XFD_RT_FAILURE_LIST_ENV,
+                                        failure_point_file.c_str());
+        if (resume_failure_id >= 0)
+            env[idx++] = alloc_print("%s=%d", XFD_RT_RESUME_ID_ENV,
+                                        resume_failure_id);
+        if (failure_sample_config.enabled)
+            env[idx++] = alloc_print("%s=%s", XFD_RT_AUTO_FAILURE_ENV,
+                                        failure_sample_config.to_spec().c_str());
+    }
+    return idx;
+}
+
+int ExeCtrl::add_cow_env(char** env, int idx, string patch_name)
+{
+    env[idx++] = alloc_print("%s=%s", XFD_COW_IMAGE_ENV, pm_image_name.c_str());
+    if (!patch_name.empty())
+        env[idx++] = alloc_print("%s=%s", XFD_COW_PATCH_ENV, patch_name.c_str());
+
+    // Load before the other preloaded libraries
+    for (int i = 0; i < idx; ++i) {
+        if (!strncmp(env[i], "LD_PRELOAD=", strlen("LD_PRELOAD="))) {
+            env[i] = alloc_print("LD_PRELOAD=%s:%s", cow_library.c_str(),
+                                    env[i] + strlen("LD_PRELOAD="));
+            return idx;
+        }
+    }
+    env[idx++] = alloc_print("LD_PRELOAD=%s", cow_library.c_str());
+    return idx;
+}
+
+void ExeCtrl::disable_aslr()
+{
+    // Incremental mode maps post-failure IPs with the layout of the
+    // pre-failure process, both need to load code at the same addresses.
+    // Scheduling compares call stacks and IPs across runs.
+    if (incremental_file.empty() && !budget) return;
+    if (personality(personality(0xffffffff) | ADDR_NO_RANDOMIZE) < 0)
+        ERR("Cannot disable ASLR.");
+}
+
+pid_t ExeCtrl::get_pre_failure_pid()
+{
+    return pre_failure_pid;
+}
+
 void ExeCtrl::execute_pre_failure()
 {
     char** pre_failure_command = genPinCommand(PRE_FAILURE, pm_image_name);
@@ -63,7 +161,9 @@ void ExeCtrl::execute_pre_failure()
         for(char **current = environ; *current; current++) {
             env[idx++] = change_env(*current);
         }
+        idx = add_frontend_env(env, idx, PRE_FAILURE);
         env[idx++] = NULL;
+        disable_aslr();
         // env[0] = alloc_print("PMEM_MMAP_HINT=%llx", PM_ADDR_BASE);
         // env[1] = NULL;
 
@@ -86,13 +186,27 @@ void ExeCtrl::execute_pre_failure()
     }
 }
 
-string ExeCtrl::execute_post_failure()
+string ExeCtrl::execute_post_failure(CrashImageGen* crash_images, unsigned image_idx)
 {   
-    string image_copy_name = copy_pm_image();
+    string image_name = pm_image_name;
+    string tmp_name;
+    if (cow_image) {
+        // libxfdetector_cow maps the image privately, crash images only
+        // need the reverted lines
+        if (crash_images) {
+            tmp_name = pm_image_name + "_xfdetector_patch";
+            crash_images->write_patch(image_idx, tmp_name);
+        }
+    } else {
+        image_name = tmp_name = copy_pm_image();
+        if (crash_images) {
+            crash_images->apply(image_idx, image_name);
+        }
+    }
 
     // Execute recovery code on the PM image copy
     // string image_copy_name = copy_name_queue.front();
-    char** post_failure_command = genPinCommand(POST_FAILURE, image_copy_name); // + string(" 2>> post.out");
+    char** post_failure_command = genPinCommand(POST_FAILURE, image_name); // + string(" 2>> post.out");
 
     int cpid = fork();
     if (cpid < 0) {
@@ -107,7 +221,12 @@ string ExeCtrl::execute_post_failure()
             env[idx++] = change_env(*current);
         }
         env[idx++] = alloc_print("POST_FAILURE=1");
+        idx = add_frontend_env(env, idx, POST_FAILURE);
+        if (cow_image) {
+            idx = add_cow_env(env, idx, tmp_name);
+        }
         env[idx++] = NULL;
+        disable_aslr();
         // env[0] = alloc_print("POST_FAILURE=1");
         // env[1] = alloc_print("PMEM_MMAP_HINT=%llx", PM_ADDR_BASE);
         // env[2] = NULL;
@@ -128,7 +247,7 @@ string ExeCtrl::execute_post_failure()
         }
         free(post_failure_command);
         post_failure_pid = cpid;
-        return image_copy_name;
+        return tmp_name;
     }
 }
 
@@ -138,7 +257,8 @@ string ExeCtrl::copy_pm_image()
     srand(time(NULL));
     string copy_name = pm_image_name + "_xfdetector_" + std::to_string(rand());
     
-    string copy_command = "cp " + pm_image_name + " " + copy_name;
+    // Shares unmodified blocks with the original on CoW file systems
+    string copy_command = "cp --reflink=auto " + pm_image_name + " " + copy_name;
     
     if (system(copy_command.c_str()) < 0)
         ERR("Cannot copy image: " + pm_image_name);
@@ -199,6 +319,152 @@ void ExeCtrl::parse_exec_command(std::vector<string> args)
                 failure_point_file = string(arg.begin()+option.size(), arg.end());
             }
 
+            option = "--checkpoint=";
+            if (arg.substr(0, option.size()) == option) {
+                checkpoint_file = string(arg.begin()+option.size(), arg.end());
+            }
+
+            option = "--frontend=";
+            if (arg.substr(0, option.size()) == option) {
+                string frontend = string(arg.begin()+option.size(), arg.end());
+                if (frontend == "cc") {
+                    cc_frontend = true;
+                } else if (frontend != "pin") {
+                    err_and_exit("Unknown frontend: " + frontend);
+                }
+            }
+
+            option = "--crash-images=";
+            if (arg.substr(0, option.size()) == option) {
+                string mode = string(arg.begin()+option.size(), arg.end());
+                if (mode == "one") {
+                    crash_image_config.mode = CRASH_IMAGE_ONE;
+                } else if (mode == "random") {
+                    crash_image_config.mode = CRASH_IMAGE_RANDOM;
+                } else if (mode == "bounded") {
+                    crash_image_config.mode = CRASH_IMAGE_BOUNDED;
+                } else {
+                    err_and_exit("Unknown crash image mode: " + mode);
+                }
+            }
+
+            option = "--auto-failure-points=";
+            if (arg.substr(0, option.size()) == option) {
+                string value = string(arg.begin()+option.size(), arg.end());
+                if (value == "on") {
+                    failure_sample_config.enabled = true;
+                } else if (value != "off") {
+                    err_and_exit("Unknown auto failure point option: " + value);
+                }
+            }
+
+            option = "--failure-point-stride=";
+            if (arg.substr(0, option.size()) == option) {
+                failure_sample_config.stride = atoi(arg.c_str()+option.size());
+                if (!failure_sample_config.stride) {
+                    err_and_exit("Failure point stride must be positive.");
+                }
+            }
+
+            option = "--failure-point-sample=";
+            if (arg.substr(0, option.size()) == option) {
+                failure_sample_config.sample = atof(arg.c_str()+option.size());
+                if (failure_sample_config.sample <= 0 || failure_sample_config.sample > 1) {
+                    err_and_exit("Failure point sample must be in (0, 1].");
+                }
+            }
+
+            option = "--failure-point-seed=";
+            if (arg.substr(0, option.size()) == option) {
+                failure_sample_config.seed = atoi(arg.c_str()+option.size());
+            }
+
+            option = "--failure-points-per-stack=";
+            if (arg.substr(0, option.size()) == option) {
+                failure_sample_config.per_stack = atoi(arg.c_str()+option.size());
+            }
+
+            option = "--post-failure-stop=";
+            if (arg.substr(0, option.size()) == option) {
+                string policy = string(arg.begin()+option.size(), arg.end());
+                if (policy == "never") {
+                    post_stop_policy = POST_STOP_NEVER;
+                } else if (policy == "new") {
+                    post_stop_policy = POST_STOP_NEW;
+                } else if (policy == "known") {
+                    post_stop_policy = POST_STOP_KNOWN;
+                } else {
+                    err_and_exit("Unknown post-failure stop policy: " + policy);
+                }
+            }
+
+            option = "--crash-image-limit=";
+            if (arg.substr(0, option.size()) == option) {
+                crash_image_config.limit = atoi(arg.c_str()+option.size());
+            }
+
+            option = "--crash-image-seed=";
+            if (arg.substr(0, option.size()) == option) {
+                crash_image_config.seed = atoi(arg.c_str()+option.size());
+            }
+
+            option = "--crash-image-subset=";
+            if (arg.substr(0, option.size()) == option) {
+                crash_image_config.subset_size = atoi(arg.c_str()+option.size());
+            }
+
+            option = "--post-workers=";
+            if (arg.substr(0, option.size()) == option) {
+                int workers = atoi(arg.c_str()+option.size());
+                if (workers < 1) {
+                    err_and_exit("Invalid number of post-failure workers: " + arg);
+                }
+                post_workers = workers;
+            }
+
+            option = "--coalesce-stores=";
+            if (arg.substr(0, option.size()) == option) {
+                string value = string(arg.begin()+option.size(), arg.end());
+                if (value == "on") {
+                    coalesce_stores = true;
+                } else if (value != "off") {
+                    err_and_exit("Unknown store coalescing option: " + value);
+                }
+            }
+
+            option = "--cow-image=";
+            if (arg.substr(0, option.size()) == option) {
+                string value = string(arg.begin()+option.size(), arg.end());
+                if (value == "on") {
+                    cow_image = true;
+                } else if (value != "off") {
+                    err_and_exit("Unknown copy-on-write image option: " + value);
+                }
+            }
+
+            option = "--incremental=";
+            if (arg.substr(0, option.size()) == option) {
+                incremental_file = string(arg.begin()+option.size(), arg.end());
+            }
+
+            option = "--budget=";
+            if (arg.substr(0, option.size()) == option) {
+                int seconds = atoi(arg.c_str()+option.size());
+                if (seconds < 1) {
+                    err_and_exit("Invalid time budget: " + arg);
+                }
+                budget = seconds;
+            }
+
+            option = "--schedule-batch=";
+            if (arg.substr(0, option.size()) == option) {
+                int points = atoi(arg.c_str()+option.size());
+                if (points < 1) {
+                    err_and_exit("Invalid schedule batch size: " + arg);
+                }
+                schedule_batch = points;
+            }
+
             option = "--";
             if (arg == option) {
                 if (arg_iter+1 >= args.size()) {
@@ -213,6 +479,18 @@ void ExeCtrl::parse_exec_command(std::vector<string> args)
         arg_iter++;
     }
 
+    // Scheduling picks failure points and skips none on its own
+    if (budget && (!failure_point_file.empty() || !checkpoint_file.empty()
+                    || !incremental_file.empty())) {
+        err_and_exit("--budget cannot be used with --failure-points, --checkpoint or --incremental.");
+    }
+
+    // The runtime does not stop other threads at failure points, they would
+    // keep writing the image under the pages not copied into the mapping yet
+    if (cow_image && cc_frontend) {
+        err_and_exit("--cow-image cannot be used with --frontend=cc.");
+    }
+
     for (auto cmd_param : target_cmd) {
         if (cmd_param.find(POOL_IMAGE_IDENTIFIER) != string::npos) {
             pm_image_name = std::regex_replace(
@@ -227,6 +505,42 @@ void ExeCtrl::parse_exec_command(std::vector<string> args)
     for (auto cmd_param : target_cmd) std::cout << cmd_param << " ";
     std::cout << std::endl;
     std::cout << "Failure points file: " << failure_point_file << std::endl;
+    std::cout << "    Checkpoint file: " << checkpoint_file << std::endl;
+    if (!incremental_file.empty()) {
+        std::cout << "   Incremental file: " << incremental_file << std::endl;
+    }
+    std::cout << "           Frontend: " << (cc_frontend ? "cc" : "pin") << std::endl;
+    if (crash_image_config.mode != CRASH_IMAGE_NONE) {
+        const char* mode_name[] = {"none", "one", "random", "bounded"};
+        std::cout << "       Crash images: " << mode_name[crash_image_config.mode]
+            << " (limit " << crash_image_config.limit << ")" << std::endl;
+    }
+    if (post_workers > 1) {
+        std::cout << "       Post workers: " << post_workers << std::endl;
+    }
+    if (coalesce_stores) {
+        std::cout << "    Coalesce stores: on" << std::endl;
+    }
+    if (cow_image) {
+        std::cout << "          CoW image: on" << std::endl;
+    }
+    if (failure_sample_config.enabled) {
+        std::cout << "Auto failure points: stride " << failure_sample_config.stride
+            << ", sample " << failure_sample_config.sample
+            << " (seed " << failure_sample_config.seed << ")";
+        if (failure_sample_config.per_stack) {
+            std::cout << ", " << failure_sample_config.per_stack << " per call stack";
+        }
+        std::cout << std::endl;
+    }
+    if (post_stop_policy != POST_STOP_NEVER) {
+        std::cout << "  Post-failure stop: "
+            << (post_stop_policy == POST_STOP_NEW ? "new" : "known") << std::endl;
+    }
+    if (budget) {
+        std::cout << "             Budget: " << budget << "s, "
+            << schedule_batch << " failure points per run" << std::endl;
+    }
     std::cout << "      pm_image_name: " << pm_image_name << std::endl;
     std::cout << std::endl;
 
@@ -255,6 +569,14 @@ void ExeCtrl::term_pre_failure()
         ERR("Cannot kill process: " + std::to_string(pre_failure_pid));
 }
 
+void ExeCtrl::finish_pre_failure()
+{
+    // It may have exited already
+    kill(pre_failure_pid, 9);
+    if (waitpid(pre_failure_pid, NULL, 0) == -1)
+        perror("waitpid failed");
+}
+
 void ExeCtrl::term_post_failure()
 {
     if (kill(post_failure_pid, 9) < 0)
@@ -268,6 +590,16 @@ void ExeCtrl::term_post_failure()
 
 char** ExeCtrl::genPinCommand(int stage, string pm_image_name)
 {
+    // The target traces itself, run it directly
+    if (cc_frontend) {
+        if (stage == PRE_FAILURE) {
+            return str2cmd(pre_failure_exec_command);
+        } else if (stage == POST_FAILURE) {
+            return str2cmd(rename_pool_img(pm_image_name));
+        }
+        return (char**)NULL;
+    }
+
     const char *pin_root = std::getenv("PIN_ROOT");
     if (strcmp(pin_root, "") != 0) {
         if (stage == PRE_FAILURE) {
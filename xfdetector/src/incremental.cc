@@ -0,0 +1,460 @@
+#include "xfdetector.hh"
+#include <elf.h>
+
+#define INCREMENTAL_MAGIC "XFDETECTOR_INCREMENTAL"
+#define INCREMENTAL_VERSION 1
+
+/* ================================================================== */
+// ELF code of the traced program
+/* ================================================================== */
+
+bool ElfImage::load(string path)
+{
+    std::ifstream ifs(path.c_str(), std::ios::binary);
+    if (!ifs.is_open()) return false;
+    data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+
+    if (data.size() < sizeof(Elf64_Ehdr)) return false;
+    Elf64_Ehdr* ehdr = (Elf64_Ehdr*)data.data();
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) || ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+        return false;
+    if (ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf64_Phdr) > data.size()
+            || ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr) > data.size())
+        return false;
+
+    Elf64_Phdr* phdrs = (Elf64_Phdr*)(data.data() + ehdr->e_phoff);
+    for (unsigned i = 0; i < ehdr->e_phnum; ++i) {
+        if (phdrs[i].p_type != PT_LOAD) continue;
+        segments.push_back(std::make_pair((off_t)phdrs[i].p_offset, (addr_t)phdrs[i].p_vaddr));
+        segment_sizes.push_back(phdrs[i].p_filesz);
+    }
+
+    // Prefer the full symbol table, stripped files only have dynamic symbols
+    Elf64_Shdr* shdrs = (Elf64_Shdr*)(data.data() + ehdr->e_shoff);
+    Elf64_Shdr* symtab = NULL;
+    for (unsigned i = 0; i < ehdr->e_shnum; ++i) {
+        if (shdrs[i].sh_type == SHT_SYMTAB) symtab = &shdrs[i];
+        else if (shdrs[i].sh_type == SHT_DYNSYM && !symtab) symtab = &shdrs[i];
+    }
+    if (!symtab || symtab->sh_link >= ehdr->e_shnum) return true;
+    Elf64_Shdr* strtab = &shdrs[symtab->sh_link];
+    if (symtab->sh_offset + symtab->sh_size > data.size()
+            || strtab->sh_offset + strtab->sh_size > data.size())
+        return false;
+
+    Elf64_Sym* syms = (Elf64_Sym*)(data.data() + symtab->sh_offset);
+    for (unsigned i = 0; i < symtab->sh_size / sizeof(Elf64_Sym); ++i) {
+        unsigned type = ELF64_ST_TYPE(syms[i].st_info);
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) || !syms[i].st_size
+                || syms[i].st_shndx == SHN_UNDEF || syms[i].st_name >= strtab->sh_size)
+            continue;
+        elf_func_t func;
+        func.start = syms[i].st_value;
+        func.size = syms[i].st_size;
+        func.name = string(data.data() + strtab->sh_offset + syms[i].st_name);
+        funcs.push_back(func);
+    }
+
+    // Aliases keep the first name in order, so that the choice is the
+    // same across builds
+    std::sort(funcs.begin(), funcs.end(), [](const elf_func_t& a, const elf_func_t& b) {
+        return a.start != b.start ? a.start < b.start : a.name < b.name;
+    });
+    funcs.erase(std::unique(funcs.begin(), funcs.end(),
+        [](const elf_func_t& a, const elf_func_t& b) {return a.start == b.start;}), funcs.end());
+
+    // Static functions may share a name, number them in address order
+    for (unsigned i = 0; i < funcs.size(); ++i) {
+        string name = funcs[i].name;
+        for (unsigned dup = 1; func_names.count(name); ++dup) {
+            name = funcs[i].name + "#" + std::to_string(dup);
+        }
+        funcs[i].name = name;
+        func_names[name] = i;
+    }
+    return true;
+}
+
+bool ElfImage::vaddr_to_offset(addr_t vaddr, off_t* offset)
+{
+    for (unsigned i = 0; i < segments.size(); ++i) {
+        if (vaddr >= segments[i].second && vaddr - segments[i].second < segment_sizes[i]) {
+            *offset = segments[i].first + (vaddr - segments[i].second);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ElfImage::offset_to_vaddr(off_t offset, addr_t* vaddr)
+{
+    for (unsigned i = 0; i < segments.size(); ++i) {
+        if (offset >= segments[i].first && (size_t)(offset - segments[i].first) < segment_sizes[i]) {
+            *vaddr = segments[i].second + (offset - segments[i].first);
+            return true;
+        }
+    }
+    return false;
+}
+
+const elf_func_t* ElfImage::find_by_offset(off_t offset)
+{
+    addr_t vaddr;
+    if (!offset_to_vaddr(offset, &vaddr)) return NULL;
+    auto it = std::upper_bound(funcs.begin(), funcs.end(), vaddr,
+        [](addr_t val, const elf_func_t& func) {return val < func.start;});
+    if (it == funcs.begin()) return NULL;
+    --it;
+    return (vaddr - it->start < it->size) ? &(*it) : NULL;
+}
+
+const elf_func_t* ElfImage::find_by_name(const string& name)
+{
+    auto it = func_names.find(name);
+    return it == func_names.end() ? NULL : &funcs[it->second];
+}
+
+static inline uint64_t fnv_mix(uint64_t hash, uint8_t byte)
+{
+    return (hash ^ byte) * 0x100000001b3ULL;
+}
+
+uint64_t ElfImage::hash(const elf_func_t* func)
+{
+    off_t offset;
+    if (!vaddr_to_offset(func->start, &offset) || offset + func->size > data.size())
+        return 0;
+    const uint8_t* code = (const uint8_t*)data.data() + offset;
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < func->size; ++i) {
+        // call/jmp rel32 to the start of a function
+        if ((code[i] == 0xe8 || code[i] == 0xe9) && i + 5 <= func->size) {
+            int32_t rel;
+            memcpy(&rel, code + i + 1, sizeof(rel));
+            addr_t target = func->start + i + 5 + rel;
+            auto it = std::lower_bound(funcs.begin(), funcs.end(), target,
+                [](const elf_func_t& f, addr_t val) {return f.start < val;});
+            if (it != funcs.end() && it->start == target) {
+                hash = fnv_mix(hash, code[i]);
+                for (char c : it->name) hash = fnv_mix(hash, c);
+                i += 4;
+                continue;
+            }
+        }
+        hash = fnv_mix(hash, code[i]);
+    }
+    return hash;
+}
+
+/* ================================================================== */
+// Results of the last campaign
+/* ================================================================== */
+
+ssize_t IncrementalDB::capture_report(void* cookie, const char* buf, size_t size)
+{
+    IncrementalDB* db = (IncrementalDB*)cookie;
+    db->cur_report.append(buf, size);
+    return fwrite(buf, 1, size, stderr);
+}
+
+IncrementalDB::~IncrementalDB()
+{
+    if (report_file) fclose(report_file);
+    for (auto &image : images) delete image.second;
+}
+
+bool IncrementalDB::load(string file_name, string _config)
+{
+    db_file = file_name;
+    config = _config;
+
+    // Reports go to stderr as usual, and are kept with the failure point
+    cookie_io_functions_t io = {NULL, capture_report, NULL, NULL};
+    report_file = fopencookie(this, "w", io);
+    if (!report_file) ERR("Cannot open report buffer");
+    setvbuf(report_file, NULL, _IONBF, 0);
+
+    std::ifstream ifs(db_file.c_str(), std::ios::binary);
+    if (!ifs.is_open()) return false;
+
+    string key;
+    int version;
+    if (!(ifs >> key >> version) || key != INCREMENTAL_MAGIC
+            || version != INCREMENTAL_VERSION) {
+        ERR("Invalid incremental file: " + db_file);
+    }
+
+    string line;
+    while (getline(ifs, line)) {
+        std::istringstream iss(line);
+        if (!(iss >> key)) continue;
+
+        if (key == "CONFIG") {
+            string old_config;
+            getline(iss >> std::ws, old_config);
+            if (old_config != config) {
+                cout << "Incremental file " << db_file
+                    << " was recorded with another command, testing all failure points" << endl;
+                old_funcs.clear();
+                old_points.clear();
+                return false;
+            }
+        } else if (key == "FUNC") {
+            inc_func_t func;
+            iss >> std::hex >> func.hash >> std::dec >> func.name;
+            getline(iss >> std::ws, func.module);
+            old_funcs.push_back(func);
+        } else if (key == "FP") {
+            int id;
+            unsigned count;
+            inc_failure_point_t point;
+            iss >> id >> point.unknown >> point.site >> count;
+            point.pre_funcs.resize(count);
+            for (auto &idx : point.pre_funcs) iss >> idx;
+            iss >> count;
+            point.post_funcs.resize(count);
+            for (auto &idx : point.post_funcs) iss >> idx;
+            if (!iss) ERR("Invalid failure point in incremental file: " + line);
+            old_points[id] = point;
+        } else if (key == "REPORT") {
+            int id;
+            size_t size;
+            iss >> id >> size;
+            string report(size, '\0');
+            if (!iss || !ifs.read(&report[0], size))
+                ERR("Invalid report in incremental file: " + db_file);
+            old_points[id].report = report;
+        }
+    }
+
+    for (auto &point : old_points) {
+        bool valid = point.second.site < (int)old_funcs.size();
+        for (auto idx : point.second.pre_funcs) valid &= idx < old_funcs.size();
+        for (auto idx : point.second.post_funcs) valid &= idx < old_funcs.size();
+        if (!valid) ERR("Invalid function in incremental file: " + db_file);
+    }
+    return true;
+}
+
+void IncrementalDB::save()
+{
+    string tmp_file = db_file + ".tmp";
+    FILE* file = fopen(tmp_file.c_str(), "w");
+    if (!file) ERR("Cannot open incremental file: " + tmp_file);
+
+    fprintf(file, "%s %d\n", INCREMENTAL_MAGIC, INCREMENTAL_VERSION);
+    fprintf(file, "CONFIG %s\n", config.c_str());
+    for (auto &func : funcs) {
+        fprintf(file, "FUNC %lx %s %s\n", func.hash, func.name.c_str(), func.module.c_str());
+    }
+    unsigned reused = 0;
+    for (auto &it : points) {
+        inc_failure_point_t& point = it.second;
+        fprintf(file, "FP %d %d %d %zu", it.first, point.unknown, point.site,
+                point.pre_funcs.size());
+        for (auto idx : point.pre_funcs) fprintf(file, " %u", idx);
+        fprintf(file, " %zu", point.post_funcs.size());
+        for (auto idx : point.post_funcs) fprintf(file, " %u", idx);
+        fprintf(file, "\n");
+        fprintf(file, "REPORT %d %zu\n", it.first, point.report.size());
+        fwrite(point.report.data(), 1, point.report.size(), file);
+        fprintf(file, "\n");
+        reused += point.reused;
+    }
+
+    if (fflush(file) || fsync(fileno(file)) < 0)
+        ERR("Cannot write incremental file: " + tmp_file);
+    fclose(file);
+    if (rename(tmp_file.c_str(), db_file.c_str()) < 0)
+        ERR("Cannot rename incremental file: " + tmp_file);
+
+    cout << "Incremental: " << points.size() - reused << " failure points tested, "
+        << reused << " reused from the last campaign" << endl;
+}
+
+void IncrementalDB::record_pre(trace_entry_t* cur_trace)
+{
+    if (cur_trace->operation == TRACE_END) {
+        failure_ip = cur_trace->instr_ptr;
+    } else if (cur_trace->instr_ptr) {
+        pre_ips.insert(cur_trace->instr_ptr);
+    }
+}
+
+void IncrementalDB::record_post(trace_entry_t* batch, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        if (batch[i].instr_ptr) post_ips.insert(batch[i].instr_ptr);
+    }
+}
+
+bool IncrementalDB::find_in_maps(addr_t ip)
+{
+    for (auto &range : maps) {
+        if (ip >= range.start && ip < range.end) return true;
+    }
+    return false;
+}
+
+void IncrementalDB::read_maps(pid_t pid)
+{
+    // The traced program may be a child of the process started by the
+    // detector (e.g., under Pin), look for the one running the failure point
+    vector<pid_t> candidates(1, pid);
+    for (unsigned i = 0; i < candidates.size(); ++i) {
+        maps.clear();
+        std::ifstream ifs(("/proc/" + std::to_string(candidates[i]) + "/maps").c_str());
+        string line;
+        while (getline(ifs, line)) {
+            module_range_t range;
+            char perms[8];
+            int path_pos = 0;
+            if (sscanf(line.c_str(), "%lx-%lx %7s %lx %*s %*s %n", &range.start,
+                    &range.end, perms, &range.offset, &path_pos) < 4 || !path_pos)
+                continue;
+            range.path = line.substr(path_pos);
+            if (perms[2] != 'x' || range.path.empty() || range.path[0] != '/')
+                continue;
+            maps.push_back(range);
+        }
+        if (find_in_maps(failure_ip)) return;
+
+        std::ifstream children(("/proc/" + std::to_string(candidates[i]) + "/task/"
+                                + std::to_string(candidates[i]) + "/children").c_str());
+        pid_t child;
+        while (children >> child) candidates.push_back(child);
+    }
+    maps.clear();
+}
+
+int IncrementalDB::add_func(const string& module, const string& name)
+{
+    string key = module + ":" + name;
+    auto it = func_index.find(key);
+    if (it != func_index.end()) return it->second;
+
+    inc_func_t func;
+    bool found;
+    func.module = module;
+    func.name = name;
+    func.hash = current_hash(module, name, &found);
+    func_index[key] = funcs.size();
+    funcs.push_back(func);
+    return funcs.size() - 1;
+}
+
+uint64_t IncrementalDB::current_hash(const string& module, const string& name, bool* found)
+{
+    auto it = images.find(module);
+    if (it == images.end()) {
+        ElfImage* image = new ElfImage;
+        if (!image->load(module)) {
+            delete image;
+            image = NULL;
+        }
+        it = images.insert(std::make_pair(module, image)).first;
+    }
+    const elf_func_t* func = it->second ? it->second->find_by_name(name) : NULL;
+    *found = (func != NULL);
+    return func ? it->second->hash(func) : 0;
+}
+
+bool IncrementalDB::unchanged(const inc_func_t& old_func)
+{
+    bool found;
+    uint64_t hash = current_hash(old_func.module, old_func.name, &found);
+    return found && hash == old_func.hash;
+}
+
+int IncrementalDB::resolve(addr_t ip)
+{
+    for (auto &range : maps) {
+        if (ip < range.start || ip >= range.end) continue;
+        bool found;
+        current_hash(range.path, "", &found);
+        ElfImage* image = images[range.path];
+        if (!image) return -1;
+        const elf_func_t* func = image->find_by_offset(ip - range.start + range.offset);
+        return func ? add_func(range.path, func->name) : -1;
+    }
+    return -1;
+}
+
+void IncrementalDB::resolve_set(const unordered_set<addr_t>& ips, vector<unsigned>* out)
+{
+    std::set<unsigned> result;
+    for (auto ip : ips) {
+        int idx = resolve(ip);
+        if (idx < 0) cur_point.unknown = true;
+        else result.insert(idx);
+    }
+    out->assign(result.begin(), result.end());
+}
+
+// Functions of a failure point, to compare them across campaigns
+static std::set<string> func_keys(const vector<inc_func_t>& table, const vector<unsigned>& idx)
+{
+    std::set<string> keys;
+    for (auto i : idx) keys.insert(table[i].module + ":" + table[i].name);
+    return keys;
+}
+
+bool IncrementalDB::reuse_failure_point(int failure_id, pid_t pid)
+{
+    // Map this part of the trace to functions while the process is stopped
+    read_maps(pid);
+    cur_point = inc_failure_point_t();
+    cur_report.clear();
+    cur_point.site = resolve(failure_ip);
+    if (cur_point.site < 0) cur_point.unknown = true;
+    resolve_set(pre_ips, &cur_point.pre_funcs);
+    pre_ips.clear();
+    post_ips.clear();
+
+    if (diverged) return false;
+    auto it = old_points.find(failure_id);
+    if (it == old_points.end() || it->second.unknown || cur_point.unknown) {
+        diverged = true;
+        return false;
+    }
+    inc_failure_point_t& old_point = it->second;
+
+    // The trace up to here has to run the same code as last time
+    bool same = func_keys(old_funcs, vector<unsigned>(1, old_point.site))
+                    == func_keys(funcs, vector<unsigned>(1, cur_point.site))
+                && func_keys(old_funcs, old_point.pre_funcs)
+                    == func_keys(funcs, cur_point.pre_funcs);
+    for (auto idx : old_point.pre_funcs) {
+        same = same && unchanged(old_funcs[idx]);
+    }
+    if (!same) {
+        diverged = true;
+        return false;
+    }
+
+    for (auto idx : old_point.post_funcs) {
+        if (!unchanged(old_funcs[idx])) return false;
+    }
+
+    cerr << "Failure point " << failure_id
+        << " unchanged since the last campaign, reusing its results" << endl;
+    fwrite(old_point.report.data(), 1, old_point.report.size(), stderr);
+    for (auto idx : old_point.post_funcs) {
+        cur_point.post_funcs.push_back(add_func(old_funcs[idx].module, old_funcs[idx].name));
+    }
+    cur_point.report = old_point.report;
+    cur_point.reused = true;
+    points[failure_id] = cur_point;
+    return true;
+}
+
+void IncrementalDB::complete_failure_point(int failure_id)
+{
+    // Post-failure executions run without ASLR, like the pre-failure one
+    resolve_set(post_ips, &cur_point.post_funcs);
+    post_ips.clear();
+    cur_point.report = cur_report;
+    cur_report.clear();
+    points[failure_id] = cur_point;
+}
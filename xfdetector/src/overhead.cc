@@ -0,0 +1,320 @@
+#include "common.hh"
+#include <limits.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <iomanip>
+#include <sstream>
+
+// Replaced in the target command of each run
+#define WORKLOAD_IDENTIFIER "__WORKLOAD__"
+#define POOL_IMAGE_IDENTIFIER "__POOL_IMAGE__"
+#define OPS_IDENTIFIER "__OPS__"
+
+#define DEFAULT_WORKLOADS "ctree,btree,rbtree,hashmap_tx,hashmap_atomic"
+#define DEFAULT_MODES "native,pin,detector"
+
+const string OVERHEAD_HELP_STR = "HELP\n"
+    "\n"
+    "  USAGE\n"
+    "    xfdetector_overhead pintool_path pm_image_name [--ops=N] [--workloads=list] -- target_cmd\n"
+    "\n"
+    "  REQUIRED ARGUMENTS\n"
+    "               pintool_path     Path to the pintool\n"
+    "              pm_image_name     PM image of the runs, removed before each of them\n"
+    "                 target_cmd     Command to run a workload. __WORKLOAD__, __POOL_IMAGE__ and __OPS__\n"
+    "                                are replaced with the workload, the image and the number of operations.\n"
+    "\n"
+    "  OPTIONAL ARGUMENTS\n"
+    "                     --ops=     Number of operations of each run (default 100).\n"
+    "               --workloads=     Comma-separated workloads (default " DEFAULT_WORKLOADS ").\n"
+    "                   --modes=     Comma-separated modes (default " DEFAULT_MODES "): native runs the\n"
+    "                                target alone, pin under the pintool with the options of xfdetector\n"
+    "                                but without the trace FIFO and failure points, and detector under\n"
+    "                                xfdetector.\n"
+    "                 --repeats=     Runs of each workload in each mode, results are averaged (default 1).\n"
+    "        --detector-options=     Space-separated options passed to xfdetector.\n";
+
+struct overhead_run_t {
+    double wall = 0; // s
+    double cpu = 0; // s, of all processes of the run
+    string output;
+};
+
+struct overhead_result_t {
+    double wall = 0; // s
+    double cpu = 0; // s
+    uint64_t trace_entries = 0;
+    uint64_t failure_points = 0;
+    double detector_cpu = 0; // s
+};
+
+static void err_and_exit(string msg)
+{
+    cout << "ERROR: " << msg << endl;
+    cout << endl << OVERHEAD_HELP_STR << endl;
+    exit(1);
+}
+
+static vector<string> split(const string& str, char sep)
+{
+    vector<string> parts;
+    std::istringstream stream(str);
+    string part;
+    while (std::getline(stream, part, sep)) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+static string replace_all(string str, const string& from, const string& to)
+{
+    for (size_t pos = str.find(from); pos != string::npos; pos = str.find(from, pos + to.size())) {
+        str.replace(pos, from.size(), to);
+    }
+    return str;
+}
+
+static double tv_secs(const struct timeval& tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Runs a command to completion and returns its output. The CPU time includes
+// all of its descendants, also the ones that outlive their parent. The
+// variables of env, as NAME=VALUE, are added to the environment of the command.
+static overhead_run_t run_command(const vector<string>& cmd, const vector<string>& env)
+{
+    overhead_run_t run;
+    int out_pipe[2];
+    if (pipe(out_pipe) < 0) ERR("Cannot create pipe.");
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    int cpid = fork();
+    if (cpid < 0) ERR("Fork failed.");
+    if (!cpid) {
+        // Child
+        vector<char*> argv;
+        for (auto& arg : cmd) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(NULL);
+        for (auto& var : env) putenv(const_cast<char*>(var.c_str()));
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        if (null_fd >= 0) dup2(null_fd, STDERR_FILENO);
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        execvp(argv[0], argv.data());
+        ERR("Execution of " + cmd[0] + " failed.");
+    }
+
+    // Parent
+    close(out_pipe[1]);
+    char buf[4096];
+    ssize_t len;
+    while ((len = read(out_pipe[0], buf, sizeof(buf))) > 0) {
+        run.output.append(buf, len);
+    }
+    close(out_pipe[0]);
+
+    int status = 0;
+    bool failed = false;
+    pid_t pid;
+    struct rusage usage;
+    while ((pid = wait4(-1, &status, 0, &usage)) > 0) {
+        run.cpu += tv_secs(usage.ru_utime) + tv_secs(usage.ru_stime);
+        if (pid == cpid) failed = !WIFEXITED(status) || WEXITSTATUS(status);
+    }
+    gettimeofday(&end, NULL);
+    run.wall = tv_secs(end) - tv_secs(start);
+
+    // Targets may exit with an error on purpose once testing is complete
+    if (failed) cerr << "Warning: " << cmd[0] << " did not exit cleanly" << endl;
+    return run;
+}
+
+// Value following a label in the output of xfdetector, 0 if missing
+static uint64_t parse_value(const string& output, const string& label)
+{
+    size_t pos = output.rfind(label);
+    if (pos == string::npos) return 0;
+    return strtoull(output.c_str() + pos + label.size(), NULL, 10);
+}
+
+static string detector_path()
+{
+    // Built next to this executable, in build/app
+    char exe_path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+    if (len < 0) ERR("Cannot find the overhead executable.");
+    string app_dir(exe_path, len);
+    string path = app_dir.substr(0, app_dir.rfind('/')) + "/xfdetector";
+    if (access(path.c_str(), X_OK) < 0) ERR("Cannot find " + path);
+    return path;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<string> args(argv, argv+argc);
+    string pintool_path;
+    string pm_image_name;
+    unsigned ops = 100;
+    unsigned repeats = 1;
+    vector<string> workloads = split(DEFAULT_WORKLOADS, ',');
+    vector<string> modes = split(DEFAULT_MODES, ',');
+    vector<string> detector_options;
+    vector<string> target_cmd;
+
+    if (args.size() < 4) err_and_exit("Required arguments missing.");
+    for (size_t i = 1; i < args.size(); ++i) {
+        string& arg = args[i];
+        string option;
+        if (i == 1) {
+            pintool_path = arg;
+            continue;
+        } else if (i == 2) {
+            pm_image_name = arg;
+            continue;
+        }
+
+        option = "--ops=";
+        if (arg.substr(0, option.size()) == option) {
+            int value = atoi(arg.c_str()+option.size());
+            if (value < 1) err_and_exit("Invalid number of operations: " + arg);
+            ops = value;
+            continue;
+        }
+
+        option = "--repeats=";
+        if (arg.substr(0, option.size()) == option) {
+            int value = atoi(arg.c_str()+option.size());
+            if (value < 1) err_and_exit("Invalid number of repeats: " + arg);
+            repeats = value;
+            continue;
+        }
+
+        option = "--workloads=";
+        if (arg.substr(0, option.size()) == option) {
+            workloads = split(arg.substr(option.size()), ',');
+            continue;
+        }
+
+        option = "--modes=";
+        if (arg.substr(0, option.size()) == option) {
+            modes = split(arg.substr(option.size()), ',');
+            for (auto& mode : modes) {
+                if (mode != "native" && mode != "pin" && mode != "detector")
+                    err_and_exit("Unknown mode: " + mode);
+            }
+            continue;
+        }
+
+        option = "--detector-options=";
+        if (arg.substr(0, option.size()) == option) {
+            detector_options = split(arg.substr(option.size()), ' ');
+            continue;
+        }
+
+        if (arg == "--") {
+            target_cmd = std::vector<string>(args.begin()+i+1, args.end());
+            break;
+        }
+        err_and_exit("Unknown argument: " + arg);
+    }
+    if (target_cmd.empty()) err_and_exit("No command target supplied.");
+
+    // Pintool options xfdetector would pass, without -t and -f
+    bool coalesce_stores = false;
+    for (auto& option : detector_options) {
+        if (option == "--coalesce-stores=on") coalesce_stores = true;
+        else if (option == "--coalesce-stores=off") coalesce_stores = false;
+    }
+    string pin_options = PIN_TRACK_READ;
+    if (coalesce_stores) pin_options = PIN_COALESCE_WRITES + pin_options;
+    if (workloads.empty() || modes.empty()) err_and_exit("Nothing to run.");
+
+    const char* pin_root = getenv("PIN_ROOT");
+    string detector;
+    for (auto& mode : modes) {
+        if (mode == "pin" && (!pin_root || !strcmp(pin_root, "")))
+            err_and_exit("Environment variable PIN_ROOT not set.");
+        if (mode == "detector" && detector.empty()) detector = detector_path();
+    }
+
+    // Orphaned processes of a run, e.g., a pre-failure execution that
+    // outlives the detector, are reparented here so that their CPU time
+    // is accounted for
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) ERR("Cannot become a subreaper.");
+
+    cout << std::left << std::setw(16) << "workload" << std::setw(10) << "mode"
+        << std::right << std::setw(10) << "time[s]" << std::setw(12) << "ops/s"
+        << std::setw(10) << "slowdown" << std::setw(12) << "trace/op"
+        << std::setw(14) << "detector-cpu" << std::setw(10) << "fp/s" << endl;
+
+    for (auto& workload : workloads) {
+        double native_ops_per_sec = 0;
+        for (auto& mode : modes) {
+            vector<string> cmd;
+            vector<string> env;
+            if (mode == "pin") {
+                // Instrumentation without the trace FIFO and failure points,
+                // the annotations of the target are enabled as in the detector
+                cmd = {string(pin_root) + "/pin", "-t", pintool_path};
+                for (auto& option : split(pin_options, ' ')) cmd.push_back(option);
+                cmd.push_back("--");
+                env.push_back(string(XFD_ATTACHED_ENV) + "=1");
+            } else if (mode == "detector") {
+                cmd = {detector, pintool_path, pm_image_name};
+                cmd.insert(cmd.end(), detector_options.begin(), detector_options.end());
+                cmd.push_back("--");
+            }
+            for (auto& param : target_cmd) {
+                string arg = replace_all(param, WORKLOAD_IDENTIFIER, workload);
+                arg = replace_all(arg, OPS_IDENTIFIER, std::to_string(ops));
+                // xfdetector replaces the image name itself
+                if (mode != "detector")
+                    arg = replace_all(arg, POOL_IMAGE_IDENTIFIER, pm_image_name);
+                cmd.push_back(arg);
+            }
+
+            overhead_result_t result;
+            for (unsigned r = 0; r < repeats; ++r) {
+                remove(pm_image_name.c_str());
+                overhead_run_t run = run_command(cmd, env);
+                result.wall += run.wall / repeats;
+                result.cpu += run.cpu / repeats;
+                if (mode == "detector") {
+                    result.trace_entries += parse_value(run.output, "Trace entries: ") / repeats;
+                    result.failure_points += parse_value(run.output, "Failure points tested: ") / repeats;
+                    result.detector_cpu += parse_value(run.output, "Detector CPU time: ") / 1000.0 / repeats;
+                }
+            }
+            remove(pm_image_name.c_str());
+
+            double ops_per_sec = ops / result.wall;
+            if (mode == "native") native_ops_per_sec = ops_per_sec;
+
+            cout << std::left << std::setw(16) << workload << std::setw(10) << mode
+                << std::right << std::fixed << std::setprecision(3)
+                << std::setw(10) << result.wall
+                << std::setprecision(1) << std::setw(12) << ops_per_sec;
+            if (native_ops_per_sec > 0) {
+                cout << std::setw(9) << native_ops_per_sec / ops_per_sec << "x";
+            } else {
+                cout << std::setw(10) << "-";
+            }
+            if (mode == "detector") {
+                cout << std::setw(12) << (double)result.trace_entries / ops
+                    << std::setw(13) << (result.cpu > 0 ? 100 * result.detector_cpu / result.cpu : 0) << "%"
+                    << std::setw(10) << result.failure_points / result.wall;
+            } else {
+                cout << std::setw(12) << "-" << std::setw(14) << "-" << std::setw(10) << "-";
+            }
+            cout << endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "xfdetector.hh"
+
+PostFailureChecker::PostFailureChecker(unsigned _num_workers)
+{
+    XFD_ASSERT(_num_workers > 0);
+    num_workers = _num_workers;
+    workers = new worker_t[num_workers];
+    for (unsigned i = 0; i < num_workers; ++i) {
+        workers[i].report_file = open_memstream(&workers[i].report_buf,
+                                                &workers[i].report_size);
+        workers[i].null_file = fopen("/dev/null", "w");
+        if (!workers[i].report_file || !workers[i].null_file)
+            ERR("Cannot open report buffer of post-failure worker");
+        workers[i].thread = std::thread(&PostFailureChecker::run_worker, this, i);
+    }
+}
+
+PostFailureChecker::~PostFailureChecker()
+{
+    run_cmd(WORKER_STOP);
+    for (unsigned i = 0; i < num_workers; ++i) {
+        workers[i].thread.join();
+        delete workers[i].shadow_mem;
+        fclose(workers[i].report_file);
+        free(workers[i].report_buf);
+        fclose(workers[i].null_file);
+    }
+    delete[] workers;
+}
+
+void PostFailureChecker::run_cmd(worker_cmd_t _cmd)
+{
+    std::unique_lock<std::mutex> lock(cmd_lock);
+    cmd = _cmd;
+    cmd_generation++;
+    workers_done = 0;
+    cmd_ready.notify_all();
+    if (_cmd == WORKER_STOP) return;
+    cmd_done.wait(lock, [this]() {return workers_done == num_workers;});
+}
+
+void PostFailureChecker::run_worker(unsigned id)
+{
+    unsigned generation = 0;
+    while (true) {
+        worker_cmd_t cur_cmd;
+        {
+            std::unique_lock<std::mutex> lock(cmd_lock);
+            cmd_ready.wait(lock, [&]() {return cmd_generation != generation;});
+            generation = cmd_generation;
+            cur_cmd = cmd;
+        }
+
+        if (cur_cmd == WORKER_STOP) return;
+        if (cur_cmd == WORKER_BEGIN) {
+            // Copy the snapshot in parallel
+            delete workers[id].shadow_mem;
+            workers[id].shadow_mem = new ShadowPM(*snapshot);
+            workers[id].detector = XFDetectorDetector();
+        } else if (cur_cmd == WORKER_CHECK) {
+            check_batch(id);
+        }
+
+        std::lock_guard<std::mutex> lock(cmd_lock);
+        if (++workers_done == num_workers) cmd_done.notify_one();
+    }
+}
+
+void PostFailureChecker::begin(ShadowPM* _snapshot)
+{
+    snapshot = _snapshot;
+    batch_seq = 0;
+    run_cmd(WORKER_BEGIN);
+}
+
+void PostFailureChecker::check_batch(unsigned id)
+{
+    worker_t* worker = &workers[id];
+    ShadowPM* shadow_mem = worker->shadow_mem;
+
+    for (unsigned i = 0; i < batch_count; ++i) {
+        // Addresses are rebased in place, work on a copy
+        trace_entry_t cur_trace = batch[i];
+
+        // A read belongs to the worker owning its first cache line. Other
+        // operations update every copy, only the first worker reports them.
+        bool report;
+        if (cur_trace.operation == READ && !cur_trace.func_ret) {
+            if ((cur_trace.src_addr / CACHE_LINE_SIZE) % num_workers != id) continue;
+            report = true;
+        } else {
+            report = (id == 0);
+        }
+
+        if (report) {
+            shadow_mem->report_file = worker->report_file;
+            shadow_mem->warn_list = &worker->warns;
+            shadow_mem->error_list = &worker->errors;
+            shadow_mem->finding_list = &worker->findings;
+        } else {
+            shadow_mem->report_file = worker->null_file;
+            shadow_mem->warn_list = &worker->discarded;
+            shadow_mem->error_list = &worker->discarded;
+            shadow_mem->finding_list = &worker->discarded_findings;
+        }
+
+        long start = report ? ftell(worker->report_file) : 0;
+        worker->detector.update_pm_status(POST_FAILURE, shadow_mem, &cur_trace);
+        if (report) {
+            long end = ftell(worker->report_file);
+            if (end != start) {
+                report_t record = {batch_seq + i, id, start, end};
+                worker->reports.push_back(record);
+            }
+        }
+    }
+    worker->discarded.clear();
+    worker->discarded_findings.clear();
+}
+
+void PostFailureChecker::check(trace_entry_t* _batch, unsigned count)
+{
+    if (!count) return;
+    batch = _batch;
+    batch_count = count;
+    run_cmd(WORKER_CHECK);
+    print_reports();
+    batch_seq += count;
+}
+
+void PostFailureChecker::print_reports()
+{
+    vector<report_t> reports;
+    for (unsigned i = 0; i < num_workers; ++i) {
+        fflush(workers[i].report_file);
+        reports.insert(reports.end(), workers[i].reports.begin(), workers[i].reports.end());
+    }
+    std::sort(reports.begin(), reports.end(),
+        [](const report_t& a, const report_t& b) {return a.seq < b.seq;});
+
+    for (auto &report : reports) {
+        fwrite(workers[report.worker].report_buf + report.start, 1,
+                report.end - report.start, report_out);
+    }
+
+    for (unsigned i = 0; i < num_workers; ++i) {
+        worker_t* worker = &workers[i];
+        warn_vec.insert(warn_vec.end(), worker->warns.begin(), worker->warns.end());
+        error_vec.insert(error_vec.end(), worker->errors.begin(), worker->errors.end());
+        finding_vec.insert(finding_vec.end(), worker->findings.begin(), worker->findings.end());
+        worker->warns.clear();
+        worker->errors.clear();
+        worker->findings.clear();
+        worker->reports.clear();
+        fseek(worker->report_file, 0, SEEK_SET);
+    }
+}
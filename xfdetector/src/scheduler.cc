@@ -0,0 +1,262 @@
+#include "xfdetector.hh"
+
+// Score of a failure point for each kind of coverage it adds
+#define SCORE_NEW_STACK 8
+#define SCORE_NEW_WRITE_SET 4
+#define SCORE_NEW_WRITE_IP 2
+#define SCORE_NEW_READ_PAIR 1
+
+// No pool contains the address
+#define NO_LOCATION ((uint64_t)-1)
+
+#define FNV_BASIS 0xcbf29ce484222325ULL
+
+// FNV-1a
+static uint64_t hash_mix(uint64_t hash, uint64_t val)
+{
+    for (unsigned i = 0; i < sizeof(val); ++i) {
+        hash = (hash ^ ((val >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Recovery read site and a write to the data it reads
+static uint64_t read_pair(addr_t read_ip, addr_t write_ip)
+{
+    return hash_mix(hash_mix(FNV_BASIS, read_ip), write_ip);
+}
+
+void FailureScheduler::init(unsigned _budget, unsigned _batch, string _pm_image_name)
+{
+    budget = _budget;
+    batch = _batch;
+    pm_image_name = _pm_image_name;
+    if (!enabled()) return;
+    start_time = time(NULL);
+    list_file = pm_image_name + "_xfdetector_failure_list";
+
+    // Each run starts from the image before the first one
+    if (access(pm_image_name.c_str(), F_OK) == 0) {
+        base_image_name = pm_image_name + "_xfdetector_schedule";
+        string copy_command = "cp --reflink=auto " + pm_image_name + " " + base_image_name;
+        if (system(copy_command.c_str()) != 0)
+            ERR("Cannot copy image: " + pm_image_name);
+    }
+}
+
+FailureScheduler::~FailureScheduler()
+{
+    if (!base_image_name.empty())
+        remove(base_image_name.c_str());
+    if (!list_file.empty())
+        remove(list_file.c_str());
+}
+
+void FailureScheduler::restore_image()
+{
+    if (base_image_name.empty()) {
+        remove(pm_image_name.c_str());
+        return;
+    }
+    string copy_command = "cp --reflink=auto " + base_image_name + " " + pm_image_name;
+    if (system(copy_command.c_str()) != 0)
+        ERR("Cannot restore image: " + pm_image_name);
+}
+
+bool FailureScheduler::out_of_budget()
+{
+    return time(NULL) - start_time >= (time_t)budget;
+}
+
+unsigned FailureScheduler::score(const sched_failure_point_t& point,
+                                    const unordered_set<uint64_t>& batch_keys,
+                                    const unordered_set<addr_t>& batch_write_ips)
+{
+    unsigned score = 0;
+    if (!covered_stacks.count(point.stack) && !batch_keys.count(point.stack))
+        score += SCORE_NEW_STACK;
+    if (!covered_write_sets.count(point.write_set) && !batch_keys.count(point.write_set))
+        score += SCORE_NEW_WRITE_SET;
+    for (addr_t ip : point.write_ips) {
+        if (!covered_write_ips.count(ip) && !batch_write_ips.count(ip))
+            score += SCORE_NEW_WRITE_IP;
+    }
+    // Read pairs are only known once a failure point is tested
+    for (auto &write : point.writes) {
+        auto sites = read_sites.find(write.first);
+        if (sites == read_sites.end()) continue;
+        for (addr_t read_ip : sites->second) {
+            if (!covered_pairs.count(read_pair(read_ip, write.second)))
+                score += SCORE_NEW_READ_PAIR;
+        }
+    }
+    return score;
+}
+
+bool FailureScheduler::begin_round()
+{
+    if (out_of_budget()) return false;
+
+    // Collect the failure points in the first run
+    if (!round) {
+        round = 1;
+        cout << "Scheduling failure points within " << budget << "s" << endl;
+        return true;
+    }
+
+    // Failure points selected for the last run but never reached are
+    // dropped, the program does not reach them deterministically
+    for (auto &it : points) {
+        if (it.second.tested) continue;
+        if (round_points.count(it.first)) {
+            it.second.tested = true;
+            unreached++;
+        }
+    }
+
+    // Greedily pick the best-scoring failure points, ties in program order
+    round_points.clear();
+    unordered_set<uint64_t> batch_keys;
+    unordered_set<addr_t> batch_write_ips;
+    unsigned best_score = 0;
+    while (round_points.size() < batch) {
+        sched_failure_point_t* best = NULL;
+        unsigned best_point_score = 0;
+        for (auto &it : points) {
+            if (it.second.tested || round_points.count(it.first)) continue;
+            unsigned point_score = score(it.second, batch_keys, batch_write_ips);
+            if (!best || point_score > best_point_score) {
+                best = &it.second;
+                best_point_score = point_score;
+            }
+        }
+        if (!best) break;
+        if (round_points.empty()) best_score = best_point_score;
+        round_points.insert(best->id);
+        batch_keys.insert(best->stack);
+        batch_keys.insert(best->write_set);
+        batch_write_ips.insert(best->write_ips.begin(), best->write_ips.end());
+    }
+    if (round_points.empty()) return false;
+
+    FILE* file = fopen(list_file.c_str(), "w");
+    if (!file) ERR("Cannot write failure list: " + list_file);
+    for (int id : round_points) {
+        fprintf(file, "%d\n", id);
+    }
+    fclose(file);
+
+    restore_image();
+    pre_pools.clear();
+    round++;
+    round_size = round_points.size();
+    round_tested = 0;
+    last_round = true;
+    for (auto &it : points) {
+        if (!it.second.tested && !round_points.count(it.first)) last_round = false;
+    }
+    cout << "Scheduled run " << round << ": testing " << round_size
+        << " failure points (best score " << best_score << ")" << endl;
+    return true;
+}
+
+uint64_t FailureScheduler::location(const vector<std::pair<addr_t, size_t> >& pools,
+                                    addr_t addr)
+{
+    // Pool index and offset, the same across runs
+    for (unsigned i = 0; i < pools.size(); ++i) {
+        if (addr >= pools[i].first && addr - pools[i].first < pools[i].second)
+            return ((uint64_t)i << 48) | (addr - pools[i].first);
+    }
+    return NO_LOCATION;
+}
+
+static bool is_pool_mapping(trace_entry_t* trace)
+{
+    return (trace->operation == PMEM_MAP_FILE && trace->func_ret)
+        || (trace->operation == PM_TRACE_PM_ADDR_ADD && !trace->func_ret);
+}
+
+void FailureScheduler::record_pre(trace_entry_t* trace)
+{
+    if (is_pool_mapping(trace) && trace->dst_addr && trace->size)
+        pre_pools.push_back(std::make_pair(trace->dst_addr, trace->size));
+}
+
+void FailureScheduler::begin_post()
+{
+    post_pools.clear();
+}
+
+void FailureScheduler::record_post(trace_entry_t* traces, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        trace_entry_t* trace = &traces[i];
+        if (is_pool_mapping(trace) && trace->dst_addr && trace->size) {
+            post_pools.push_back(std::make_pair(trace->dst_addr, trace->size));
+        } else if (trace->operation == READ && !trace->func_ret && trace->size) {
+            addr_t line = trace->src_addr & ~((addr_t)CACHE_LINE_SIZE - 1);
+            for (; line < trace->src_addr + trace->size; line += CACHE_LINE_SIZE) {
+                uint64_t loc = location(post_pools, line);
+                if (loc != NO_LOCATION) read_sites[loc].insert(trace->instr_ptr);
+            }
+        }
+    }
+}
+
+void FailureScheduler::add_failure_point(int id, uint64_t stack, ShadowPM* shadow_mem)
+{
+    // The state of a failure point is the same in every run
+    if (points.count(id)) return;
+
+    sched_failure_point_t& point = points[id];
+    point.id = id;
+    point.stack = stack;
+
+    vector<std::pair<addr_t, addr_t> > writes;
+    shadow_mem->get_unpersisted_writes(writes);
+    std::set<addr_t> write_ips;
+    for (auto &write : writes) {
+        uint64_t loc = location(pre_pools, write.first);
+        if (loc != NO_LOCATION) point.writes.push_back(std::make_pair(loc, write.second));
+        write_ips.insert(write.second);
+    }
+    point.write_ips.assign(write_ips.begin(), write_ips.end());
+    point.write_set = FNV_BASIS;
+    for (addr_t ip : point.write_ips) {
+        point.write_set = hash_mix(point.write_set, ip);
+    }
+}
+
+void FailureScheduler::complete_failure_point(int id)
+{
+    auto it = points.find(id);
+    if (it == points.end() || it->second.tested) return;
+    sched_failure_point_t& point = it->second;
+    point.tested = true;
+    if (round_points.count(id)) round_tested++;
+
+    covered_stacks.insert(point.stack);
+    covered_write_sets.insert(point.write_set);
+    covered_write_ips.insert(point.write_ips.begin(), point.write_ips.end());
+    for (auto &write : point.writes) {
+        auto sites = read_sites.find(write.first);
+        if (sites == read_sites.end()) continue;
+        for (addr_t read_ip : sites->second) {
+            covered_pairs.insert(read_pair(read_ip, write.second));
+        }
+    }
+}
+
+void FailureScheduler::print_summary()
+{
+    unsigned tested = 0;
+    for (auto &it : points) {
+        if (it.second.tested) tested++;
+    }
+    cout << "Scheduled " << tested - unreached << " of " << points.size()
+        << " failure points in " << round << " runs, " << covered_stacks.size()
+        << " call stacks and " << covered_write_ips.size() << " write IPs covered";
+    if (unreached) cout << " (" << unreached << " not reached)";
+    cout << endl;
+}
@@ -1,6 +1,10 @@
 #include "xfdetector.hh"
 #include <sys/time.h>
 
+vector<Bug_t> warn_vec;
+vector<Bug_t> error_vec;
+vector<uint64_t> finding_vec;
+
 ShadowPM::ShadowPM()
 {
     memset(pre_InternalFunctLevel, 0, sizeof(pre_InternalFunctLevel));
@@ -11,12 +15,15 @@ ShadowPM::ShadowPM()
 ShadowPM::ShadowPM(const ShadowPM& in)
 {
     //cerr << pm_modify_timestamps << endl;
+    pm_ranges = in.pm_ranges;
+    pre_pools = in.pre_pools;
     pm_status = in.pm_status;
     pm_modify_timestamps = in.pm_modify_timestamps;
     global_timestamp = in.global_timestamp;
     commit_var_set_addr = in.commit_var_set_addr;
     write_addr_IP_mapping = in.write_addr_IP_mapping;
     commit_timestamp = in.commit_timestamp;
+    failure_stack = in.failure_stack;
     // Init levels to 0
     memset(tx_level, 0, sizeof(tx_level));
     memset(pre_InternalFunctLevel, 0, sizeof(pre_InternalFunctLevel));
@@ -26,7 +33,7 @@ ShadowPM::ShadowPM(const ShadowPM& in)
         tx_added_addr[i] = in.tx_added_addr[i];
         // tx_alloc_addr[i] = in.tx_alloc_addr[i];
         tx_added_addr_IP_mapping[i] = in.tx_added_addr_IP_mapping[i];
-        tx_alloc_addr_IP_mapping[i] = in.tx_added_addr_IP_mapping[i];
+        tx_alloc_addr_IP_mapping[i] = in.tx_alloc_addr_IP_mapping[i];
         tx_non_added_write_addr[i] = in.tx_non_added_write_addr[i];
     }
 }
@@ -42,12 +49,16 @@ void ShadowPM::add_pm_addr(trace_entry_t* op_ptr, addr_t addr, size_t size)
 
     // Add address to PM locations
     MAP_UPDATE(pm_status, addr, size, CLEAN);
+    pm_ranges.add(addr, size);
+    pre_pools.push_back(std::make_pair(addr, size));
 }
 
 void ShadowPM::add_pm_addr_post(trace_entry_t* op_ptr, addr_t addr, size_t size)
 {
     XFD_ASSERT(size && addr);
-    // Do nothing
+    // Shadow state stays in pre-failure addresses, only record the
+    // mapping to translate post-failure accesses
+    post_pools.push_back(std::make_pair(addr, size));
     // Check if part of the address has already been allocated
     /*
     if (MAP_INTERSECT(pm_status, addr, size))
@@ -68,6 +79,7 @@ void ShadowPM::remove_pm_addr(trace_entry_t* op_ptr, addr_t addr, size_t size)
 
     // Remove address from PM locations
     MAP_REMOVE(pm_status, addr, size);
+    pm_ranges.remove(addr, size);
 }
 
 void ShadowPM::writeback_addr(trace_entry_t* op_ptr, addr_t addr, size_t size)
@@ -170,7 +182,53 @@ bool ShadowPM::is_pm_addr(trace_entry_t* op_ptr, addr_t addr, size_t size)
 {
     // XFD_ASSERT(size && addr);
     // return IN_MAP(pm_status, addr, size);
-    return (addr + size < PM_ADDR_SIZE + PM_ADDR_BASE) && (addr >= PM_ADDR_BASE);
+    return pm_ranges.contains(addr, size);
+}
+
+addr_t ShadowPM::rebase_post_addr(addr_t addr)
+{
+    for (unsigned i = 0; i < post_pools.size() && i < pre_pools.size(); ++i) {
+        if (addr - post_pools[i].first < post_pools[i].second)
+            return addr - post_pools[i].first + pre_pools[i].first;
+    }
+    return addr;
+}
+
+bool ShadowPM::is_persisted(addr_t addr, size_t size)
+{
+    for (auto &it: MAP_LOOKUP(pm_status, addr, size)) {
+        if (it.second == MODIFIED || it.second == WRITEBACK_PENDING) return false;
+    }
+
+    return true;
+}
+
+void ShadowPM::get_unpersisted_lines(std::set<addr_t>& lines)
+{
+    for (auto &it : pm_status) {
+        if (it.second != MODIFIED && it.second != WRITEBACK_PENDING) continue;
+        addr_t line = it.first.lower() & ~((addr_t)CACHE_LINE_SIZE - 1);
+        for (; line <= it.first.upper(); line += CACHE_LINE_SIZE) {
+            lines.insert(line);
+        }
+    }
+}
+
+void ShadowPM::get_unpersisted_writes(vector<std::pair<addr_t, addr_t> >& writes)
+{
+    std::set<std::pair<addr_t, addr_t> > found;
+    for (auto &it : pm_status) {
+        if (it.second != MODIFIED && it.second != WRITEBACK_PENDING) continue;
+        addr_t addr = it.first.lower();
+        size_t size = it.first.upper() - addr + 1;
+        for (auto &write : MAP_LOOKUP(write_addr_IP_mapping, addr, size)) {
+            addr_t line = write.first.lower() & ~((addr_t)CACHE_LINE_SIZE - 1);
+            for (; line <= write.first.upper(); line += CACHE_LINE_SIZE) {
+                found.insert(std::make_pair(line, write.second));
+            }
+        }
+    }
+    writes.insert(writes.end(), found.begin(), found.end());
 }
 
 void ShadowPM::reset_internal_funct_level(int tid){
@@ -205,10 +263,10 @@ void ShadowPM::decrement_tx_level(int tid, int stage){
         // Need to iterate all members of tx_added_addr[tid]
         DEBUG(cout << "Draining writes" << endl);
         for (auto &i : tx_added_addr[tid]) {
+            size_t size = i.upper - i.lower + 1;
+            addr_t addr = i.lower;
             // Performance bug detection
             if (stage == PRE_FAILURE) {
-                size_t size = i.upper() - i.lower() + 1;
-                addr_t addr = i.lower();
                 bool bug_flag = true;
                 for (auto &k : MAP_LOOKUP(pm_status, addr, size)) {
                     if (k.second != CONSISTENT && k.second != CLEAN) {
@@ -219,33 +277,30 @@ void ShadowPM::decrement_tx_level(int tid, int stage){
                 if (bug_flag) {
                     cerr << "\033[1;33mPerformance Bug:\033[0m\nUnnecessary TX_ADD, added but never modified" << endl;
                     cerr << "Added addr = " << (void*)addr << " size = " << size << endl;
-                    for (auto &j : MAP_LOOKUP(tx_added_addr_IP_mapping[tid], addr, size)) {
-                        addr_t instr_ptr = j.second;
+                    addr_t instr_ptr;
+                    if (tx_added_addr_IP_mapping[tid].lookup_first(addr, size, &instr_ptr)) {
                         cerr << "Previously added by IP (TX_ADD) = " << (void*)instr_ptr << endl;
                         print_IP_linenumber_mapping(instr_ptr, PRE_FAILURE);
-                        break;
                     }
-                    for (auto &j : MAP_LOOKUP(tx_alloc_addr_IP_mapping[tid], addr, size)) {
-                        addr_t instr_ptr = j.second;
+                    if (tx_alloc_addr_IP_mapping[tid].lookup_first(addr, size, &instr_ptr)) {
                         cerr << "Previously added by IP (TX_ALLOC) = " << (void*)instr_ptr << endl;
                         print_IP_linenumber_mapping(instr_ptr, PRE_FAILURE);
-                        break;
                     }
                 }
             }
-            DEBUG(cout << std::hex << i << endl;);
-            MAP_UPDATE_INTERVAL(pm_status, i, CONSISTENT);
+            DEBUG(cout << std::hex << addr << " " << size << endl;);
+            MAP_UPDATE(pm_status, addr, size, CONSISTENT);
         }
 
         // Non-ADDed address is updated to shadow PM during the write.
         // Should not need to do anything here.
 
-        // clear staged changes
-        SET_CLEAR(tx_added_addr[tid]);
+        // clear staged changes, the storage is kept for the next transaction
+        tx_added_addr[tid].clear();
         // SET_CLEAR(tx_alloc_addr[tid]);
-        MAP_CLEAR(tx_added_addr_IP_mapping[tid]);
-        MAP_CLEAR(tx_alloc_addr_IP_mapping[tid]);
-        SET_CLEAR(tx_non_added_write_addr[tid]);
+        tx_added_addr_IP_mapping[tid].clear();
+        tx_alloc_addr_IP_mapping[tid].clear();
+        tx_non_added_write_addr[tid].clear();
         // increment timestamp
         // increment_global_time();
     }
@@ -256,11 +311,11 @@ bool ShadowPM::is_in_tx(int tid){
 
 bool ShadowPM::is_added_addr(trace_entry_t* op_ptr, addr_t addr, size_t size){
     int tid = op_ptr->tid;
-    return SET_LOOKUP(tx_added_addr[tid], addr, size);
+    return tx_added_addr[tid].contains(addr, size);
 }
 bool ShadowPM::is_non_added_write_addr(trace_entry_t* op_ptr, addr_t addr, size_t size){
     int tid = op_ptr->tid;
-    return SET_LOOKUP(tx_non_added_write_addr[tid], addr, size);
+    return tx_non_added_write_addr[tid].contains(addr, size);
 }
 
 bool ShadowPM::print_IP_linenumber_mapping(addr_t ip, int stage)
@@ -283,7 +338,7 @@ bool ShadowPM::print_IP_linenumber_mapping(addr_t ip, int stage)
         if (start == 0 && stoull(line.substr(start+3, 14), NULL, 16) == ip) {
             // Found
             found = true;
-            fprintf(stderr, "Position in backtrace File: %d (later=recent)\n", bt_pos);
+            fprintf(report_file, "Position in backtrace File: %d (later=recent)\n", bt_pos);
             // Maximum backtracing
             int count = 0;
             while (count < MAX_BACKTRACE) {
@@ -293,7 +348,7 @@ bool ShadowPM::print_IP_linenumber_mapping(addr_t ip, int stage)
                     line.find(":") == string::npos) {
                     break;
                 }
-                fprintf(stderr, "[#%d]\t%s\n", count, line.c_str());
+                fprintf(report_file, "[#%d]\t%s\n", count, line.c_str());
                 count++;
             }
             break;
@@ -313,8 +368,8 @@ void ShadowPM::add_tx_add_addr(trace_entry_t* op_ptr, addr_t addr, size_t size,
     int tid = op_ptr->tid;
     if(is_non_added_write_addr(op_ptr, addr, size)){
         // if (stage == PRE_FAILURE) {
-            cerr << "\033[0;31mConsistency Bug:\033[0m\nTX_ADD after modification" << endl;
-            cerr << "Write IP: " << (void*)op_ptr->instr_ptr << " Write Addr: " << (void*)addr << endl;
+            fprintf(report_file, "\033[0;31mConsistency Bug:\033[0m\nTX_ADD after modification\n");
+            fprintf(report_file, "Write IP: %p Write Addr: %p\n", (void*)op_ptr->instr_ptr, (void*)addr);
             print_IP_linenumber_mapping(op_ptr->instr_ptr, PRE_FAILURE);
         // }
     }
@@ -325,17 +380,14 @@ void ShadowPM::add_tx_add_addr(trace_entry_t* op_ptr, addr_t addr, size_t size,
             cerr << "TX_ADD IP = " << (void*)op_ptr->instr_ptr << endl;
             cerr << "Added addr = " << (void*)addr << " size = " << size << endl;
             print_IP_linenumber_mapping(op_ptr->instr_ptr, PRE_FAILURE);
-            for (auto &j : MAP_LOOKUP(tx_added_addr_IP_mapping[tid], addr, size)) {
-                addr_t instr_ptr = j.second;
+            addr_t instr_ptr;
+            if (tx_added_addr_IP_mapping[tid].lookup_first(addr, size, &instr_ptr)) {
                 cerr << "Added by IP (TX_ADD) = " << (void*)instr_ptr << endl;
                 print_IP_linenumber_mapping(instr_ptr, PRE_FAILURE);
-                break;
             }
-            for (auto &j : MAP_LOOKUP(tx_alloc_addr_IP_mapping[tid], addr, size)) {
-                addr_t instr_ptr = j.second;
+            if (tx_alloc_addr_IP_mapping[tid].lookup_first(addr, size, &instr_ptr)) {
                 cerr << "Added by IP (TX_ALLOC) = " << (void*)instr_ptr << endl;
                 print_IP_linenumber_mapping(instr_ptr, PRE_FAILURE);
-                break;
             }
         }
     }
@@ -343,11 +395,11 @@ void ShadowPM::add_tx_add_addr(trace_entry_t* op_ptr, addr_t addr, size_t size,
     DEBUG(cerr << "inserting tid: " << tid << " addr: " << addr << " size: " << size <<  endl;);
 
     assert(addr != 0 && size != 0 && "TX_ADD-ed address/size should not be zero");
-    SET_INSERT(tx_added_addr[tid], addr, size);
+    tx_added_addr[tid].add(addr, size);
     if (!alloc) {
-        MAP_UPDATE(tx_added_addr_IP_mapping[tid], addr, size, op_ptr->instr_ptr);
+        tx_added_addr_IP_mapping[tid].update(addr, size, op_ptr->instr_ptr);
     } else {
-        MAP_UPDATE(tx_alloc_addr_IP_mapping[tid], addr, size, op_ptr->instr_ptr);
+        tx_alloc_addr_IP_mapping[tid].update(addr, size, op_ptr->instr_ptr);
     }
     // cerr << "TX_ADD IP : " << op_ptr->instr_ptr << " " << op_ptr->func_ret << endl;
     //cout << "inserted" << endl;
@@ -356,11 +408,11 @@ void ShadowPM::add_tx_add_addr(trace_entry_t* op_ptr, addr_t addr, size_t size,
 void ShadowPM::add_non_tx_add_addr(trace_entry_t* op_ptr, addr_t addr, size_t size)
 {
     int tid = op_ptr->tid;
-    SET_INSERT(tx_non_added_write_addr[tid], addr, size);
+    tx_non_added_write_addr[tid].add(addr, size);
     //cerr << "Added non tx add address" << endl;
 }
 
-interval_set_addr ShadowPM::get_tx_added_addr(int tid)
+const TxRangeSet& ShadowPM::get_tx_added_addr(int tid)
 {
     return tx_added_addr[tid];
 }
@@ -426,6 +478,23 @@ bool ShadowPM::print_look_up_write_addr_IP_mapping(trace_entry_t* op_ptr, addr_t
     return isWriteAddrFound;
 }
 
+uint64_t ShadowPM::finding_key(addr_t addr, size_t size, int reason)
+{
+    // FNV-1a over the fields
+    uint64_t key = 0xcbf29ce484222325ULL;
+    auto mix = [&key](uint64_t val) {
+        for (unsigned i = 0; i < sizeof(val); ++i) {
+            key = (key ^ ((val >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+        }
+    };
+    for (auto &it : MAP_LOOKUP(write_addr_IP_mapping, addr, size)) {
+        mix(it.second);
+    }
+    mix(failure_stack);
+    mix(reason);
+    return key;
+}
+
 bool ShadowPM::lookup_checked_addr(addr_t addr, size_t size)
 {
     XFD_ASSERT(addr && size);
@@ -464,11 +533,11 @@ bool ShadowPM::printInconsistentReadDebug(trace_entry_t* cur_trace){
     addr_t dst_addr = cur_trace->dst_addr;
     size_t size = cur_trace->size;
     addr_t instr_ptr = cur_trace->instr_ptr;
-    bool isAddrFound = this->print_look_up_write_addr_IP_mapping(cur_trace, src_addr, size, stderr);
+    bool isAddrFound = this->print_look_up_write_addr_IP_mapping(cur_trace, src_addr, size, report_file);
     if(isAddrFound){
         // Suppress non-user code report
-        cerr << "Addr: " << (void*)cur_trace->src_addr << ", Size: " << size << endl;
-        cerr << "Read IP: " << (void*)instr_ptr << endl;;
+        fprintf(report_file, "Addr: %p, Size: %lu\n", (void*)cur_trace->src_addr, size);
+        fprintf(report_file, "Read IP: %p\n", (void*)instr_ptr);
         print_IP_linenumber_mapping(instr_ptr, POST_FAILURE);
     }
     return isAddrFound;
@@ -0,0 +1,184 @@
+#include "xfdetector.hh"
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+
+#define TRACE_QUEUE_SPINS 64
+
+// Spin briefly while the other side catches up, then sleep until notified.
+// The flags are only touched on the slow path, and the timed wait bounds a
+// missed notification.
+bool TraceQueue::wait(std::atomic<bool>* waiting, std::condition_variable* cond,
+                        unsigned* spins, const std::function<bool()>& ready)
+{
+    if (++(*spins) < TRACE_QUEUE_SPINS) {
+        __builtin_ia32_pause();
+        return ready();
+    }
+    std::unique_lock<std::mutex> lock(wait_lock);
+    waiting->store(true);
+    if (!ready()) {
+        cond->wait_for(lock, std::chrono::milliseconds(1));
+    }
+    waiting->store(false);
+    return ready();
+}
+
+void TraceQueue::notify(std::atomic<bool>* waiting, std::condition_variable* cond)
+{
+    if (waiting->load()) {
+        std::lock_guard<std::mutex> lock(wait_lock);
+        cond->notify_one();
+    }
+}
+
+TraceQueue::TraceQueue() : tail(0), head(0), eof(false), stopping(false)
+{
+    for (unsigned i = 0; i < TRACE_QUEUE_DEPTH; ++i) {
+        batches[i].data = (char*) malloc(TRACE_BATCH_SIZE);
+        batches[i].size = 0;
+    }
+}
+
+TraceQueue::~TraceQueue()
+{
+    stop();
+    for (unsigned i = 0; i < TRACE_QUEUE_DEPTH; ++i) {
+        free(batches[i].data);
+    }
+}
+
+void TraceQueue::start(int _fd, bool _threaded)
+{
+    XFD_ASSERT(!ingest_thread.joinable() && "Trace queue already started");
+    fd = _fd;
+    threaded = _threaded;
+    tail = 0;
+    head = 0;
+    holding = false;
+    eof = false;
+    stopping = false;
+    if (threaded) {
+        ingest_thread = std::thread(&TraceQueue::ingest, this);
+    }
+}
+
+void TraceQueue::stop()
+{
+    if (!ingest_thread.joinable()) return;
+    stopping.store(true);
+    ingest_thread.join();
+}
+
+void TraceQueue::ingest()
+{
+    // The FIFO is opened before the writer starts, and reads return 0
+    // until it opens the FIFO. Only report EOF once a writer was seen.
+    bool writer_seen = false;
+
+    while (true) {
+        // Wait for a free batch, the pintool blocks on the FIFO meanwhile
+        unsigned cur = tail.load();
+        unsigned spins = 0;
+        auto has_free = [&]() {return cur - head.load() != TRACE_QUEUE_DEPTH;};
+        while (!has_free()) {
+            if (stopping.load()) return;
+            wait(&producer_waiting, &not_full, &spins, has_free);
+        }
+
+        trace_batch_t* batch = &batches[cur % TRACE_QUEUE_DEPTH];
+        char* buf = batch->data;
+        size_t filled = 0;
+
+        while (filled < TRACE_BATCH_SIZE) {
+            // Publish as soon as the FIFO is drained, so that a failure
+            // point is never held back waiting for more trace
+            int pending = 0;
+            if (ioctl(fd, FIONREAD, &pending) < 0) pending = 0;
+            if (pending) writer_seen = true;
+            if (!pending) {
+                if (filled) break;
+                // Wait for the writer, waking up to check for stop requests
+                struct pollfd pfd = {fd, POLLIN, 0};
+                int ret = poll(&pfd, 1, TRACE_QUEUE_POLL_MS);
+                if (ret < 0 && errno != EINTR) ERR("Trace FIFO poll failed.");
+                if (ret <= 0) {
+                    if (stopping.load()) return;
+                    continue;
+                }
+                // Hangups are only reported after a writer opened the FIFO
+                if (pfd.revents & (POLLIN | POLLHUP)) writer_seen = true;
+            }
+
+            ssize_t read_size = read(fd, buf + filled, TRACE_BATCH_SIZE - filled);
+            if (read_size > 0) {
+                filled += read_size;
+                writer_seen = true;
+                eof.store(false);
+            } else if (read_size == 0) {
+                // No writer, publish what is left before reporting it
+                if (filled) break;
+                if (writer_seen) {
+                    eof.store(true);
+                    notify(&consumer_waiting, &not_empty);
+                }
+                if (stopping.load()) return;
+                usleep(1000);
+            } else if (errno != EINTR) {
+                ERR("Trace FIFO read failed.");
+            }
+        }
+
+        // Entries split across batches are put together by the decoder
+        batch->size = filled;
+        tail.store(cur + 1);
+        notify(&consumer_waiting, &not_empty);
+    }
+}
+
+int TraceQueue::pop(char** buf, int wait_ms)
+{
+    XFD_ASSERT(!holding && "Previous trace batch not released");
+
+    if (!threaded) {
+        // Read in place, as there is no spare CPU to read ahead. Reads
+        // return at once until the writer opens the FIFO, wait in poll().
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, wait_ms) <= 0) return 0;
+        int read_size = read(fd, batches[0].data, PIN_FIFO_BUF_SIZE);
+        *buf = batches[0].data;
+        return read_size;
+    }
+
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    unsigned cur = head.load();
+    unsigned spins = 0;
+    // EOF is only set after all batches before it are published
+    auto has_batch = [&]() {return tail.load() != cur || eof.load();};
+    while (tail.load() == cur) {
+        if (eof.load() && tail.load() == cur) {
+            return 0;
+        }
+        if (wait_ms >= 0) {
+            gettimeofday(&now, NULL);
+            if ((now.tv_sec - start.tv_sec) * 1000
+                    + (now.tv_usec - start.tv_usec) / 1000 >= wait_ms) {
+                return 0;
+            }
+        }
+        wait(&consumer_waiting, &not_empty, &spins, has_batch);
+    }
+
+    holding = true;
+    *buf = batches[cur % TRACE_QUEUE_DEPTH].data;
+    return batches[cur % TRACE_QUEUE_DEPTH].size;
+}
+
+void TraceQueue::release()
+{
+    if (!holding) return;
+    holding = false;
+    head.store(head.load() + 1);
+    notify(&producer_waiting, &not_full);
+}
@@ -1,6 +1,9 @@
 #include "xfdetector.hh"
+#include <sys/resource.h>
 #include <sys/time.h>
 
+int exec_id = -1;
+
 void XFDetectorFIFO::fifo_create(int exec_id)
 {
     if (exec_id >= 0) {
@@ -32,14 +35,31 @@ void XFDetectorFIFO::fifo_create(int exec_id)
     }
 }
 
+// Trace FIFOs are opened before the writer starts, without waiting for it.
+// The writers open them O_RDWR and do not wait either, so a short program
+// could otherwise exit before the FIFO is opened and take its trace along.
+static int trace_fifo_open(const char* fifo_str)
+{
+    int fd = open(fifo_str, O_RDONLY | O_NONBLOCK);
+    if (fd >= 0 && fcntl(fd, F_SETFL, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
 void XFDetectorFIFO::fifo_open(const char* name)
 {
     if (!strcmp(name, PRE_FAILURE_FIFO)) {
-        pre_fifo_fd = open(pre_failure_fifo_str, O_RDONLY);
+        pre_fifo_fd = trace_fifo_open(pre_failure_fifo_str);
         if (pre_fifo_fd < 0) ERR("Pre-failure FIFO open failed.");
+        pre_decoder.reset();
+        pre_queue.start(pre_fifo_fd, pipelined);
     } else if (!strcmp(name, POST_FAILURE_FIFO)) {
-        post_fifo_fd = open(post_failure_fifo_str, O_RDONLY);
+        post_fifo_fd = trace_fifo_open(post_failure_fifo_str);
         if (post_fifo_fd < 0) ERR("Post-failure FIFO open failed.");
+        post_decoder.reset();
+        post_queue.start(post_fifo_fd, pipelined);
     } else if (!strcmp(name, SIGNAL_FIFO)) {
         signal_fifo_fd = open(signal_fifo_str, O_RDWR);
         if (signal_fifo_fd < 0) ERR("Signal FIFO open failed.");
@@ -51,8 +71,10 @@ void XFDetectorFIFO::fifo_open(const char* name)
 void XFDetectorFIFO::fifo_close(const char* name)
 {
     if (!strcmp(name, PRE_FAILURE_FIFO)) {
+        pre_queue.stop();
         close(pre_fifo_fd);
     } else if (!strcmp(name, POST_FAILURE_FIFO)) {
+        post_queue.stop();
         close(post_fifo_fd);
     } else if (!strcmp(name, SIGNAL_FIFO)) {
         close(signal_fifo_fd);
@@ -61,14 +83,34 @@ void XFDetectorFIFO::fifo_close(const char* name)
     }
 }
 
+int XFDetectorFIFO::read_traces(TraceQueue* queue, TraceDecoder* decoder,
+                                vector<trace_entry_t>* traces, int wait_ms)
+{
+    char* buf;
+    traces->clear();
+    int read_size = queue->pop(&buf, wait_ms);
+    if (read_size > 0) {
+        decoder->decode((uint8_t*)buf, read_size, traces);
+    }
+    // The packed batch is no longer needed once unpacked
+    queue->release();
+    return traces->size() * sizeof(trace_entry_t);
+}
+
 int XFDetectorFIFO::pre_fifo_read()
 {
-    return read(pre_fifo_fd, pre_fifo_buf, PIN_FIFO_BUF_SIZE);
+    // The pre-failure program may wait for input for a long time
+    int read_size = read_traces(&pre_queue, &pre_decoder, &pre_traces, -1);
+    pre_trace_count += pre_traces.size();
+    return read_size;
 }
 
 int XFDetectorFIFO::post_fifo_read()
 {
-    return read(post_fifo_fd, post_fifo_buf, PIN_FIFO_BUF_SIZE);
+    // Return periodically to check the post-failure timeout
+    int read_size = read_traces(&post_queue, &post_decoder, &post_traces, TRACE_QUEUE_POLL_MS);
+    post_trace_count += post_traces.size();
+    return read_size;
 }
 
 int XFDetectorFIFO::signal_send(char* message, unsigned len)
@@ -91,12 +133,17 @@ void XFDetectorFIFO::pin_continue_send()
     }        //MAP_UPDATE_INTERVAL(pm_status, tx_added_addr[tid], CONSISTENT);
 }
 
+uint64_t XFDetectorFIFO::trace_count(int stage)
+{
+    return stage == PRE_FAILURE ? pre_trace_count : post_trace_count;
+}
+
 trace_entry_t* XFDetectorFIFO::get_trace(int stage, unsigned index)
 {
     if (stage == PRE_FAILURE) {
-        return pre_fifo_buf + index;
+        return pre_traces.data() + index;
     } else if (stage == POST_FAILURE) {
-        return post_fifo_buf + index;
+        return post_traces.data() + index;
     }
     // Should never reach here
     return NULL;
@@ -107,9 +154,11 @@ XFDetectorFIFO::XFDetectorFIFO(int exec_id)
     // Initialize FIFOs
     fifo_create(exec_id);
 
+    // Reading ahead only pays off with a CPU to spare besides the traced
+    // program and the analysis
+    pipelined = sysconf(_SC_NPROCESSORS_ONLN) > 2;
+
     // Allocate FIFO buffers
-    pre_fifo_buf = (trace_entry_t*) malloc(PIN_FIFO_BUF_SIZE);
-    post_fifo_buf = (trace_entry_t*) malloc(PIN_FIFO_BUF_SIZE);
     signal_buf = (char*) malloc(MAX_SIGNAL_LEN);
 }
 
@@ -119,8 +168,6 @@ XFDetectorFIFO::~XFDetectorFIFO()
     fifo_close(PRE_FAILURE_FIFO);
     fifo_close(POST_FAILURE_FIFO);
     // Deallocate FIFO buffers
-    free(pre_fifo_buf);
-    free(post_fifo_buf);
     free(signal_buf);
     // Remove fifo files
     remove(pre_failure_fifo_str);
@@ -143,6 +190,14 @@ void XFDetectorDetector::locate_bug(trace_entry_t* bug_trace, string executable)
 
 void XFDetectorDetector::update_pm_status(int stage, ShadowPM* shadow_mem, trace_entry_t* cur_trace)
 {
+    // Post-failure execution may map the pools at other addresses
+    if (stage == POST_FAILURE && !cur_trace->func_ret
+            && cur_trace->operation != PM_TRACE_PM_ADDR_ADD) {
+        if (cur_trace->src_addr)
+            cur_trace->src_addr = shadow_mem->rebase_post_addr(cur_trace->src_addr);
+        if (cur_trace->dst_addr)
+            cur_trace->dst_addr = shadow_mem->rebase_post_addr(cur_trace->dst_addr);
+    }
     pm_op_t operation = cur_trace->operation;
     bool func_ret = cur_trace->func_ret;
     int tid = cur_trace->tid;
@@ -181,8 +236,13 @@ void XFDetectorDetector::update_pm_status(int stage, ShadowPM* shadow_mem, trace
         switch (cur_trace->operation) {
             case TRACE_END:
                 // shadow_mem->reset_internal_funct_level(tid);
-                fprintf(stderr, "Failure point IP: %p\n", (void*)instr_ptr);
-                if (stage == PRE_FAILURE) pre_failure_point_complete = COMPLETE;
+                fprintf(shadow_mem->report_file, "Failure point IP: %p\n", (void*)instr_ptr);
+                if (stage == PRE_FAILURE) {
+                    pre_failure_point_complete = COMPLETE;
+                    failure_id = cur_trace->failure_id;
+                    failure_stack = cur_trace->src_addr;
+                    shadow_mem->failure_stack = failure_stack;
+                }
                 // else if (stage == POST_FAILURE) post_failure_point_complete = COMPLETE;
                 break;
             case TRACE_BEGIN:
@@ -237,15 +297,21 @@ void XFDetectorDetector::update_pm_status(int stage, ShadowPM* shadow_mem, trace
                                     bool addrFound = shadow_mem->printInconsistentReadDebug(cur_trace);
                                     // Skip writes from internal functions
                                     if (addrFound) {
+                                        int reason;
                                         if (!shadow_mem->is_writtenback(cur_trace, src_addr, size)) {
-                                            cerr << "Not persisted before failure" << endl;
+                                            fprintf(shadow_mem->report_file, "Not persisted before failure\n");
+                                            reason = 0;
                                         } else if (!shadow_mem->is_recent_commit_update(cur_trace, src_addr, size)) {
-                                            cerr << "Not persisted before commit var" << endl;
+                                            fprintf(shadow_mem->report_file, "Not persisted before commit var\n");
                                             //XFD_ASSERT(shadow_mem->commit_var_set_addr.size()==0 && "No commit variable registered");
+                                            reason = 1;
                                         }
                                         else {
-                                            cerr << "Other" << endl;
+                                            fprintf(shadow_mem->report_file, "Other\n");
+                                            reason = 2;
                                         }
+                                        shadow_mem->finding_list->push_back(
+                                            shadow_mem->finding_key(src_addr, size, reason));
                                     }
                                 }
                             }
@@ -423,7 +489,118 @@ void XFDetectorDetector::print_pm_trace(int stage, trace_entry_t* cur_trace)
 ShadowPM shadow_mem;
 XFDetectorDetector race_detector;
 ExeCtrl execution_controller;
+CampaignCheckpoint checkpoint;
+CrashImageGen crash_images;
+IncrementalDB incremental;
+FailureScheduler scheduler;
 XFDetectorFIFO *fifo;
+PostFailureChecker *post_checker = NULL;
+
+// Dedup keys of the findings of all post-failure executions so far
+static unordered_set<uint64_t> known_findings;
+
+// Add the findings since *checked to the known ones, and check whether the
+// post-failure execution can stop early. *found_new is set once the
+// execution finds a new bug.
+static bool post_stop_reached(size_t* checked, bool* found_new)
+{
+    bool found = false;
+    for (; *checked < finding_vec.size(); ++(*checked)) {
+        found = true;
+        if (known_findings.insert(finding_vec[*checked]).second) *found_new = true;
+    }
+    switch (execution_controller.get_post_stop_policy()) {
+        case POST_STOP_NEW:
+            return *found_new;
+        case POST_STOP_KNOWN:
+            return found && !*found_new;
+        default:
+            return false;
+    }
+}
+
+// Run post-failure execution on the image of the current failure point,
+// or on one of its crash images. Returns the execution time in us.
+static long long run_post_failure(CrashImageGen* images, unsigned image_idx, bool* timeout)
+{
+    // Parallel checking copies the shadow PM for each worker instead
+    ShadowPM* post_shadow_mem = NULL;
+    if (post_checker) {
+        post_checker->begin(&shadow_mem);
+        if (incremental.enabled()) post_checker->report_out = incremental.get_report_file();
+    } else {
+        post_shadow_mem = new ShadowPM(shadow_mem);
+        if (incremental.enabled()) post_shadow_mem->report_file = incremental.get_report_file();
+    }
+    // Execute post-failure program
+    struct timeval post_start;
+    struct timeval post_end;
+    gettimeofday(&post_start, NULL);
+    fifo->fifo_open(POST_FAILURE_FIFO);
+    if (scheduler.enabled()) scheduler.begin_post();
+    string image_copy_name = execution_controller.execute_post_failure(images, image_idx);
+
+    cerr << "--------Switching to post failure--------" << endl;
+    if (images) cerr << images->describe(image_idx) << endl;
+    
+    *timeout = false;
+    size_t checked_findings = finding_vec.size();
+    bool found_new = false;
+    while (race_detector.post_testing_complete != COMPLETE) {
+        int read_size = fifo->post_fifo_read();
+        if (incremental.enabled()) {
+            incremental.record_post(fifo->get_trace(POST_FAILURE, 0),
+                                    read_size / sizeof(trace_entry_t));
+        }
+        if (scheduler.enabled()) {
+            scheduler.record_post(fifo->get_trace(POST_FAILURE, 0),
+                                    read_size / sizeof(trace_entry_t));
+        }
+        if (post_checker) {
+            post_checker->check(fifo->get_trace(POST_FAILURE, 0),
+                                read_size / sizeof(trace_entry_t));
+            if (post_checker->testing_complete())
+                race_detector.post_testing_complete = COMPLETE;
+        } else {
+            for (unsigned i = 0; i < read_size / sizeof(trace_entry_t); ++i) {
+                trace_entry_t* cur_trace = fifo->get_trace(POST_FAILURE, i);
+
+                race_detector.update_pm_status(POST_FAILURE, post_shadow_mem, cur_trace);
+            }
+        }
+        if (post_stop_reached(&checked_findings, &found_new)) {
+            execution_controller.term_post_failure();
+            // Not an error of the post-failure execution
+            *timeout = true;
+            cerr << "Stopping post failure"
+                << (found_new ? " at a new bug" : ", all bugs are known") << endl;
+            break;
+        }
+        gettimeofday(&post_end, NULL);
+        // Kill post-failure process when timeout
+        // Timeout disabled if threshold < 0
+        if (POST_FAILURE_EXEC_TIMEOUT > 0 
+                && post_end.tv_sec - post_start.tv_sec > POST_FAILURE_EXEC_TIMEOUT) {
+            execution_controller.term_post_failure();
+            *timeout = true;
+            cerr << "Timeout: killing post failure pid " << post_failure_pid << endl;
+            break;
+        }
+    }
+    gettimeofday(&post_end, NULL);
+    long long post_time = ((post_end.tv_sec*1000000L)+post_end.tv_usec) 
+                            - ((post_start.tv_sec*1000000L)+post_start.tv_usec);
+    cout << "Post-failure time: " << post_time/1000 << "ms" << endl;
+    // Remove copied image
+    if (!image_copy_name.empty()) remove(image_copy_name.c_str());
+    // Close post-failure FIFO
+    fifo->fifo_close(POST_FAILURE_FIFO);
+    // Reset complete flag
+    race_detector.post_testing_complete = INCOMPLETE;
+    delete post_shadow_mem;
+
+    return post_time;
+}
 
 int main(int argc, char* argv[])
 {
@@ -440,114 +617,221 @@ int main(int argc, char* argv[])
         execution_controller.init(-1, args);
     }
     
-    fifo = new XFDetectorFIFO(atoi(argv[2]));
+    // Restore progress of an interrupted campaign
+    if (!execution_controller.get_checkpoint_file().empty()) {
+        if (checkpoint.load(execution_controller.get_checkpoint_file())) {
+            if (checkpoint.campaign_complete) {
+                cout << "Campaign in " << execution_controller.get_checkpoint_file()
+                    << " has already completed" << endl;
+                return 0;
+            }
+            cout << "Resuming after failure point " << checkpoint.last_failure_id
+                << " (" << checkpoint.failure_points_tested << " tested, "
+                << error_vec.size() << " errors, " << warn_vec.size()
+                << " warnings)" << endl;
+            execution_controller.set_resume_failure_id(checkpoint.last_failure_id);
+        }
+    }
+    long long prev_total_time = checkpoint.total_time;
+
+    // Reuse results of the last campaign for unchanged failure points
+    if (!execution_controller.get_incremental_file().empty()) {
+        crash_image_config_t crash_config = execution_controller.get_crash_image_config();
+        std::ostringstream config;
+        config << execution_controller.get_target_command() << " crash-images "
+            << crash_config.mode << " " << crash_config.limit << " "
+            << crash_config.seed << " " << crash_config.subset_size;
+        if (execution_controller.get_failure_sample_config().enabled) {
+            config << " failure-points "
+                << execution_controller.get_failure_sample_config().to_spec();
+        }
+        if (incremental.load(execution_controller.get_incremental_file(), config.str())) {
+            cout << "Comparing with the last campaign in "
+                << execution_controller.get_incremental_file() << endl;
+        }
+    }
 
-    // Set testing_complete flag as incomplete
-    race_detector.pre_testing_complete = INCOMPLETE;
+    fifo = new XFDetectorFIFO(atoi(argv[2]));
+    if (execution_controller.get_post_workers() > 1)
+        post_checker = new PostFailureChecker(execution_controller.get_post_workers());
 
-    // Execute pre-failure (with pintool)
-    execution_controller.execute_pre_failure();
+    // Snapshot the image before pre-failure execution modifies it
+    crash_images.init(execution_controller.get_crash_image_config(),
+                        execution_controller.get_pm_image_name());
+    scheduler.init(execution_controller.get_budget(),
+                    execution_controller.get_schedule_batch(),
+                    execution_controller.get_pm_image_name());
 
-    fifo->fifo_open(PRE_FAILURE_FIFO);
     fifo->fifo_open(SIGNAL_FIFO);
 
     struct timeval total_start;
     struct timeval total_end;
     gettimeofday(&total_start, NULL);
+    unsigned failure_points_tested = 0;
+
+    // Scheduled failure points are tested over several runs of the
+    // pre-failure program, each starting from the original image
+    for (unsigned run = 0; scheduler.enabled() ? scheduler.begin_round() : !run; ++run) {
+        if (run) {
+            shadow_mem = ShadowPM();
+            crash_images.restart();
+            fifo->fifo_close(PRE_FAILURE_FIFO);
+        }
+        if (scheduler.enabled() && !scheduler.profiling())
+            execution_controller.set_failure_point_file(scheduler.get_failure_list());
+
+        // Set testing_complete flag as incomplete
+        race_detector.pre_testing_complete = INCOMPLETE;
+
+        fifo->fifo_open(PRE_FAILURE_FIFO);
+
+        // Execute pre-failure (with pintool)
+        execution_controller.execute_pre_failure();
 
-    // For each failure point in the RoI
-    while (race_detector.pre_testing_complete != COMPLETE) {
-        cerr << "--------Switching to Pre failure--------" << endl;
+        // For each failure point in the RoI
+        while (race_detector.pre_testing_complete != COMPLETE) {
+            cerr << "--------Switching to Pre failure--------" << endl;
 
-        // Reset failure_point_complete flag to incomplete
-        race_detector.pre_failure_point_complete = INCOMPLETE;
+            // Reset failure_point_complete flag to incomplete
+            race_detector.pre_failure_point_complete = INCOMPLETE;
 
-        // Pre-failure FIFO timeout
-        struct timeval fifo_read_start;
-        struct timeval fifo_read_end;
-        gettimeofday(&fifo_read_start, NULL);
+            // Pre-failure FIFO timeout
+            struct timeval fifo_read_start;
+            struct timeval fifo_read_end;
+            gettimeofday(&fifo_read_start, NULL);
 
-        // For each operation before failure point
-        while (race_detector.pre_failure_point_complete != COMPLETE && 
-                race_detector.pre_testing_complete != COMPLETE) {
+            // For each operation before failure point
+            while (race_detector.pre_failure_point_complete != COMPLETE && 
+                    race_detector.pre_testing_complete != COMPLETE) {
 
-            int read_size = fifo->pre_fifo_read();
-            if (read_size != 0) {
-                // Reset time if read_size not zero
-                gettimeofday(&fifo_read_start, NULL);
+                int read_size = fifo->pre_fifo_read();
+                if (read_size != 0) {
+                    // Reset time if read_size not zero
+                    gettimeofday(&fifo_read_start, NULL);
+                }
+                // Check timeout
+                gettimeofday(&fifo_read_end, NULL);
+                if (PRE_FAILURE_FIFO_TIMEOUT > 0 && 
+                        fifo_read_end.tv_sec - fifo_read_start.tv_sec > PRE_FAILURE_FIFO_TIMEOUT) {
+                    ERR("Pre-failure FIFO timeout");
+                }
+
+                // Iterate through operations in FIFO buffer
+                for (unsigned i = 0; i < read_size / sizeof(trace_entry_t); ++i) {
+                    trace_entry_t* cur_trace = fifo->get_trace(PRE_FAILURE, i);
+                    race_detector.update_pm_status(PRE_FAILURE, &shadow_mem, cur_trace);
+                    if (incremental.enabled()) incremental.record_pre(cur_trace);
+                    if (scheduler.enabled()) scheduler.record_pre(cur_trace);
+                    if (crash_images.enabled()) {
+                        if (cur_trace->operation == WRITE) {
+                            crash_images.touch(cur_trace->dst_addr, cur_trace->size,
+                                                cur_trace->non_temporal);
+                        } else if (cur_trace->operation == CLWB) {
+                            crash_images.flush(cur_trace->src_addr, cur_trace->size);
+                        } else if ((cur_trace->operation == PMEM_MAP_FILE && cur_trace->func_ret)
+                                || cur_trace->operation == PM_TRACE_PM_ADDR_ADD) {
+                            crash_images.set_image_base(cur_trace->dst_addr);
+                        }
+                    }
+                    // race_detector.print_pm_trace(PRE_FAILURE, cur_trace);
+                }
             }
-            // Check timeout
-            gettimeofday(&fifo_read_end, NULL);
-            if (PRE_FAILURE_FIFO_TIMEOUT > 0 && 
-                    fifo_read_end.tv_sec - fifo_read_start.tv_sec > PRE_FAILURE_FIFO_TIMEOUT) {
-                ERR("Pre-failure FIFO timeout");
+            // The first scheduled run only collects the failure points
+            bool profiled = scheduler.enabled() && scheduler.profiling();
+            if (scheduler.enabled() && race_detector.pre_failure_point_complete == COMPLETE) {
+                scheduler.add_failure_point(race_detector.failure_id,
+                                            race_detector.failure_stack, &shadow_mem);
             }
 
-            // Iterate through operations in FIFO buffer
-            for (unsigned i = 0; i < read_size / sizeof(trace_entry_t); ++i) {
-                trace_entry_t* cur_trace = fifo->get_trace(PRE_FAILURE, i);
-                race_detector.update_pm_status(PRE_FAILURE, &shadow_mem, cur_trace);
-                // race_detector.print_pm_trace(PRE_FAILURE, cur_trace);
+            bool timeout = false;
+            long long post_time = 0;
+            bool reused = incremental.enabled()
+                && race_detector.pre_failure_point_complete == COMPLETE
+                && incremental.reuse_failure_point(race_detector.failure_id,
+                                                    execution_controller.get_pre_failure_pid());
+            if (!reused && !profiled) {
+                post_time = run_post_failure(NULL, 0, &timeout);
+
+                // Check the return status of post-failure process
+                if (execution_controller.post_failure_status() < 0 && !timeout) {
+                    cerr << "Kill pre failure due to post-failure error" << endl;
+                    execution_controller.term_pre_failure();
+                    checkpoint.save(false);
+                    return 1;
+                }
             }
-            // Clear pre-failure FIFO buffer
-            fifo->clear_pre_fifo_buf();
-        }
-        ShadowPM post_shadow_mem(shadow_mem);
-        // Execute post-failure program
-        struct timeval post_start;
-        struct timeval post_end;
-        gettimeofday(&post_start, NULL);
-        string image_copy_name = execution_controller.execute_post_failure();
-
-        cerr << "--------Switching to post failure--------" << endl;
-        
-        bool timeout = false;
-        fifo->fifo_open(POST_FAILURE_FIFO);
-        while (race_detector.post_testing_complete != COMPLETE) {
-            int read_size = fifo->post_fifo_read();
-            for (unsigned i = 0; i < read_size / sizeof(trace_entry_t); ++i) {
-                trace_entry_t* cur_trace = fifo->get_trace(POST_FAILURE, i);
 
-                race_detector.update_pm_status(POST_FAILURE, &post_shadow_mem, cur_trace);
+            // Test the crash images of this failure point. They are generated
+            // even if reused, as they track persistence since the last one.
+            if (crash_images.enabled() && !profiled
+                    && race_detector.pre_failure_point_complete == COMPLETE) {
+                crash_images.generate(&shadow_mem, race_detector.failure_id);
+                for (unsigned i = 0; !reused && i < crash_images.num_images(); ++i) {
+                    post_time += run_post_failure(&crash_images, i, &timeout);
+                    if (execution_controller.post_failure_status() < 0 && !timeout) {
+                        cerr << "Kill pre failure due to post-failure error" << endl;
+                        execution_controller.term_pre_failure();
+                        checkpoint.save(false);
+                        return 1;
+                    }
+                }
             }
-            fifo->clear_post_fifo_buf();
-            gettimeofday(&post_end, NULL);
-            // Kill post-failure process when timeout
-            // Timeout disabled if threshold < 0
-            if (POST_FAILURE_EXEC_TIMEOUT > 0 
-                    && post_end.tv_sec - post_start.tv_sec > POST_FAILURE_EXEC_TIMEOUT) {
-                execution_controller.term_post_failure();
-                timeout = true;
-                cerr << "Timeout: killing post failure pid " << post_failure_pid << endl;
-                break;
+
+            // Record progress before resuming the pre-failure execution
+            if (race_detector.pre_failure_point_complete == COMPLETE && !profiled) {
+                failure_points_tested++;
+                if (incremental.enabled() && !reused)
+                    incremental.complete_failure_point(race_detector.failure_id);
+                if (scheduler.enabled())
+                    scheduler.complete_failure_point(race_detector.failure_id);
+                gettimeofday(&total_end, NULL);
+                checkpoint.total_time = prev_total_time
+                    + (((total_end.tv_sec*1000000L)+total_end.tv_usec) 
+                        - ((total_start.tv_sec*1000000L)+total_start.tv_usec))/1000;
+                // Scheduled runs are not checkpointed, IDs start over in each
+                if (!scheduler.enabled())
+                    checkpoint.complete_failure_point(race_detector.failure_id, post_time/1000);
             }
+
+            // The rest of a scheduled run has nothing to test
+            if (scheduler.enabled() && (scheduler.round_complete() || scheduler.out_of_budget()))
+                break;
+
+            // Resume next failure point. Nothing waits at the end of testing,
+            // and the signal would resume the next run too early.
+            if (race_detector.pre_failure_point_complete == COMPLETE)
+                fifo->pin_continue_send();
         }
-        gettimeofday(&post_end, NULL);
-        long long post_time = ((post_end.tv_sec*1000000L)+post_end.tv_usec) 
-                                - ((post_start.tv_sec*1000000L)+post_start.tv_usec);
-        cout << "Post-failure time: " << post_time/1000 << "ms" << endl;
-        // Remove copied image
-        remove(image_copy_name.c_str());
-        // Close post-failure FIFO
-        fifo->fifo_close(POST_FAILURE_FIFO);
-        // Reset complete flag
-        race_detector.post_testing_complete = INCOMPLETE;
-        // Resume next failure point
-        fifo->pin_continue_send();
-
-        // Check the return status of post-failure process
-        if (execution_controller.post_failure_status() < 0 && !timeout) {
-            cerr << "Kill pre failure due to post-failure error" << endl;
-            execution_controller.term_pre_failure();
-            return 1;
-        }
+
+        if (scheduler.enabled()) execution_controller.finish_pre_failure();
     }
     gettimeofday(&total_end, NULL);
     int64_t total_time = ((total_end.tv_sec*1000000L)+total_end.tv_usec) 
                             - ((total_start.tv_sec*1000000L)+total_start.tv_usec);
     cout << "Total time: " << total_time/1000 << "ms" << endl;
 
+    // Cost of the analysis itself, the traced executions are not included
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    cout << "Trace entries: " << fifo->trace_count(PRE_FAILURE) << " pre-failure, "
+        << fifo->trace_count(POST_FAILURE) << " post-failure" << endl;
+    cout << "Failure points tested: " << failure_points_tested << endl;
+    cout << "Detector CPU time: "
+        << (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000L
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000
+        << "ms" << endl;
+
+    if (checkpoint.enabled()) {
+        checkpoint.total_time = prev_total_time + total_time/1000;
+        checkpoint.save(true);
+        cout << "Campaign total time: " << checkpoint.total_time << "ms, "
+            << checkpoint.failure_points_tested << " failure points tested" << endl;
+    }
+    if (incremental.enabled()) incremental.save();
+    if (scheduler.enabled()) scheduler.print_summary();
+
     // clean up
+    delete post_checker;
     delete fifo;
     remove((string("/tmp/backtrace_pre.") + std::to_string(exec_id)).c_str());
     remove((string("/tmp/backtrace_post.") + std::to_string(exec_id)).c_str());
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "xfdetector_cow.h"
+
+#ifndef MAP_SYNC
+#define MAP_SYNC 0x80000
+#endif
+
+static int image_set = 0;
+static dev_t image_dev;
+static ino_t image_ino;
+static const char* patch_file = NULL;
+
+static int (*real_open)(const char*, int, ...);
+static int (*real_open64)(const char*, int, ...);
+static int (*real_openat)(int, const char*, int, ...);
+static int (*real_openat64)(int, const char*, int, ...);
+static int (*real___open_2)(const char*, int);
+static int (*real___open64_2)(const char*, int);
+static int (*real___openat_2)(int, const char*, int);
+static int (*real___openat64_2)(int, const char*, int);
+static void* (*real_mmap)(void*, size_t, int, int, int, off_t);
+static void* (*real_mmap64)(void*, size_t, int, int, int, off64_t);
+static int (*real_flock)(int, int);
+
+#define REAL(func) \
+    (real_##func ? real_##func : (*(void**)&real_##func = dlsym(RTLD_NEXT, #func), real_##func))
+
+__attribute__((constructor))
+static void xfd_cow_init(void)
+{
+    const char* image = getenv(XFD_COW_IMAGE_ENV);
+    struct stat st;
+    if (!image) return;
+    if (stat(image, &st) < 0) {
+        fprintf(stderr, "libxfdetector_cow: cannot find image %s\n", image);
+        return;
+    }
+    image_dev = st.st_dev;
+    image_ino = st.st_ino;
+    image_set = 1;
+    patch_file = getenv(XFD_COW_PATCH_ENV);
+}
+
+static int is_image(const struct stat* st)
+{
+    return image_set && st->st_dev == image_dev && st->st_ino == image_ino;
+}
+
+static int is_image_path(int dirfd, const char* path)
+{
+    struct stat st;
+    return image_set && path && fstatat(dirfd, path, &st, 0) == 0 && is_image(&st);
+}
+
+static int is_image_fd(int fd)
+{
+    struct stat st;
+    return image_set && fd >= 0 && fstat(fd, &st) == 0 && is_image(&st);
+}
+
+/*
+ * The image is only ever opened read-only: a writable private mapping does
+ * not need a writable file, and write()/ftruncate() on it fail instead of
+ * modifying the pre-failure image.
+ */
+static int image_flags(int dirfd, const char* path, int flags)
+{
+    if (!is_image_path(dirfd, path)) return flags;
+    return (flags & ~(O_ACCMODE | O_CREAT | O_EXCL | O_TRUNC | O_APPEND)) | O_RDONLY;
+}
+
+#define OPEN_MODE(flags, mode) do { \
+        if ((flags) & (O_CREAT | O_TMPFILE)) { \
+            va_list ap; \
+            va_start(ap, flags); \
+            mode = va_arg(ap, int); \
+            va_end(ap); \
+        } \
+    } while (0)
+
+int open(const char* path, int flags, ...)
+{
+    int mode = 0;
+    OPEN_MODE(flags, mode);
+    return REAL(open)(path, image_flags(AT_FDCWD, path, flags), mode);
+}
+
+int open64(const char* path, int flags, ...)
+{
+    int mode = 0;
+    OPEN_MODE(flags, mode);
+    return REAL(open64)(path, image_flags(AT_FDCWD, path, flags), mode);
+}
+
+int openat(int dirfd, const char* path, int flags, ...)
+{
+    int mode = 0;
+    OPEN_MODE(flags, mode);
+    return REAL(openat)(dirfd, path, image_flags(dirfd, path, flags), mode);
+}
+
+int openat64(int dirfd, const char* path, int flags, ...)
+{
+    int mode = 0;
+    OPEN_MODE(flags, mode);
+    return REAL(openat64)(dirfd, path, image_flags(dirfd, path, flags), mode);
+}
+
+// Called instead of the above by code built with _FORTIFY_SOURCE, e.g., PMDK
+int __open_2(const char* path, int flags)
+{
+    return REAL(__open_2)(path, image_flags(AT_FDCWD, path, flags));
+}
+
+int __open64_2(const char* path, int flags)
+{
+    return REAL(__open64_2)(path, image_flags(AT_FDCWD, path, flags));
+}
+
+int __openat_2(int dirfd, const char* path, int flags)
+{
+    return REAL(__openat_2)(dirfd, path, image_flags(dirfd, path, flags));
+}
+
+int __openat64_2(int dirfd, const char* path, int flags)
+{
+    return REAL(__openat64_2)(dirfd, path, image_flags(dirfd, path, flags));
+}
+
+// Write the reverted lines of the crash image into a new mapping
+static void apply_patch(char* addr, size_t len, int prot, off_t offset)
+{
+    struct xfd_cow_line line;
+    int fd;
+
+    if (!patch_file) return;
+    fd = REAL(open)(patch_file, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "libxfdetector_cow: cannot open patch %s\n", patch_file);
+        abort();
+    }
+    if (!(prot & PROT_WRITE)) mprotect(addr, len, prot | PROT_WRITE);
+    while (read(fd, &line, sizeof(line)) == sizeof(line)) {
+        if (line.offset < (uint64_t)offset
+                || line.offset + XFD_COW_LINE_SIZE > (uint64_t)offset + len)
+            continue;
+        memcpy(addr + (line.offset - offset), line.data, XFD_COW_LINE_SIZE);
+    }
+    if (!(prot & PROT_WRITE)) mprotect(addr, len, prot);
+    close(fd);
+}
+
+// Shared mappings of the image, including MAP_SYNC ones, become private
+static int image_map_flags(int flags, int fd)
+{
+    if ((flags & MAP_TYPE) == MAP_PRIVATE || (flags & MAP_ANONYMOUS) || !is_image_fd(fd))
+        return flags;
+    return (flags & ~(MAP_TYPE | MAP_SYNC)) | MAP_PRIVATE;
+}
+
+void* mmap(void* addr, size_t len, int prot, int flags, int fd, off_t offset)
+{
+    int new_flags = image_map_flags(flags, fd);
+    void* ret = REAL(mmap)(addr, len, prot, new_flags, fd, offset);
+    if (new_flags != flags && ret != MAP_FAILED) apply_patch(ret, len, prot, offset);
+    return ret;
+}
+
+void* mmap64(void* addr, size_t len, int prot, int flags, int fd, off64_t offset)
+{
+    int new_flags = image_map_flags(flags, fd);
+    void* ret = REAL(mmap64)(addr, len, prot, new_flags, fd, offset);
+    if (new_flags != flags && ret != MAP_FAILED) apply_patch(ret, len, prot, offset);
+    return ret;
+}
+
+// The pre-failure process still holds the lock of the image
+int flock(int fd, int operation)
+{
+    if (is_image_fd(fd)) return 0;
+    return REAL(flock)(fd, operation);
+}
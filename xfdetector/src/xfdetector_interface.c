@@ -1,10 +1,12 @@
 #include <assert.h>
 
+#define XFDETECTOR_COMPAT_SYMBOLS
 #include "xfdetector_interface.h"
 #include <signal.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include "xfdetector_rt.h"
 
 /* PMFuzz header */
 #ifdef PMFUZZ
@@ -15,6 +17,20 @@ __thread int trace_status = NOT_TRACING;
 __thread int xfdetector_failure_skip_status = NOT_SKIP;
 __thread int has_completed = INCOMPLETE;
 
+int xfdetector_attached = 0;
+int xfdetector_stage = PRE_FAILURE;
+
+/*
+ * Resolve once whether the program runs under the detector, so that the
+ * annotations do not look up the environment on every call
+ */
+__attribute__((constructor))
+static void xfdetector_interface_init(void)
+{
+    xfdetector_attached = getenv(XFDETECTOR_ATTACHED_ENV) != NULL;
+    xfdetector_stage = getenv("POST_FAILURE") ? POST_FAILURE : PRE_FAILURE;
+}
+
 #ifdef PMRACE_STAT
 __thread unsigned additional_failure_point_count = 0;
 __thread unsigned atomic_op_count;
@@ -36,34 +52,40 @@ void _roi_pre_begin(void)
 {
     assert(trace_status == NOT_TRACING 
         && "Error: XFDetector has already started tracing, canont start RoI again");
+    XFD_RT_CALL(xfd_rt_roi_begin, PRE_FAILURE);
 }
 
 void _roi_pre_end(void)
 {
     assert(trace_status == TRACING 
         && "Error: XFDetector has not started tracing, cannot end RoI");
+    XFD_RT_CALL(xfd_rt_roi_end, PRE_FAILURE);
 }
 
 void _roi_post_begin(void)
 {
     assert(trace_status == NOT_TRACING 
         && "Error: XFDetector has already started tracing, canont start RoI again");
+    XFD_RT_CALL(xfd_rt_roi_begin, POST_FAILURE);
 }
 
 void _roi_post_end(void)
 {
     assert(trace_status == TRACING 
         && "Error: XFDetector has not started tracing, cannot end RoI");
+    XFD_RT_CALL(xfd_rt_roi_end, POST_FAILURE);
 }
 
 void _skip_failure_point_begin(void)
 {
     xfdetector_failure_skip_status = SKIP;
+    XFD_RT_CALL(xfd_rt_skip_failure, 1);
 }
 
 void _skip_failure_point_end(void)
 {
     xfdetector_failure_skip_status = NOT_SKIP;
+    XFD_RT_CALL(xfd_rt_skip_failure, 0);
 }
 
 void _add_failure_point(void)
@@ -71,28 +93,31 @@ void _add_failure_point(void)
 #ifdef PMRACE_STAT
     additional_failure_point_count++;
 #endif
+    XFD_RT_CALL(xfd_rt_failure_point);
 }
 
 void _testing_pre_complete(void)
 {
     // has_completed = COMPLETE;
     // assert(0 && "Post-failure execution complete");
+    XFD_RT_CALL(xfd_rt_testing_complete, PRE_FAILURE);
 }
 
 void _testing_post_complete(void)
 {
     // has_completed = COMPLETE;
     // assert(0 && "Post-failure execution complete");
+    XFD_RT_CALL(xfd_rt_testing_complete, POST_FAILURE);
 }
 
 void _skipDetectionBegin(void)
 {
-    return;
+    XFD_RT_CALL(xfd_rt_skip_detection, 1);
 }
 
 void _skipDetectionEnd(void)
 {
-    return;
+    XFD_RT_CALL(xfd_rt_skip_detection, 0);
 }
 
 // void _atomic_update_begin(void)
@@ -111,11 +136,11 @@ void _add_commit_var(const void* variable, unsigned size)
 {
     assert(variable && "Cannot register a NULL variable");
     assert(size <= 64U && "Cannot commit with a variable larger than one cache line");
-    // No need to do anything
+    XFD_RT_CALL(xfd_rt_add_commit_var, variable, size);
 }
 
 /* User interface functions */
-void XFDetector_RoIBegin(int condition, int stage)
+void _XFDetector_RoIBegin(int condition, int stage)
 {
     assert(has_completed == INCOMPLETE && "Error: Testing has completed already");
     if (condition) {
@@ -133,7 +158,7 @@ void XFDetector_RoIBegin(int condition, int stage)
     trace_status = TRACING;
 }
 
-void XFDetector_RoIEnd(int condition, int stage)
+void _XFDetector_RoIEnd(int condition, int stage)
 {
     assert(has_completed == INCOMPLETE && "Error: Testing has completed already");
     if (condition) {
@@ -151,7 +176,7 @@ void XFDetector_RoIEnd(int condition, int stage)
     trace_status = NOT_TRACING;
 }
 
-void XFDetector_addFailurePoint(int condition)
+void _XFDetector_addFailurePoint(int condition)
 {
     /* PMFuzz failure point annotation */
 #ifdef PMFUZZ
@@ -162,19 +187,19 @@ void XFDetector_addFailurePoint(int condition)
     if (condition) {_add_failure_point();}
 }
 
-void XFDetector_skipFailureBegin(int condition)
+void _XFDetector_skipFailureBegin(int condition)
 {
     assert(has_completed == INCOMPLETE && "Error: Testing has completed already");
     if (condition) {_skip_failure_point_begin();}
 }
 
-void XFDetector_skipFailureEnd(int condition) 
+void _XFDetector_skipFailureEnd(int condition) 
 {
     assert(has_completed == INCOMPLETE && "Error: Testing has completed already");
     if (condition) {_skip_failure_point_end();}
 }
 
-void XFDetector_complete(int condition, int stage) 
+void _XFDetector_complete(int condition, int stage) 
 {
     assert(has_completed == INCOMPLETE && "Error: Testing has completed already");
     if (condition) {
@@ -188,12 +213,7 @@ void XFDetector_complete(int condition, int stage)
         } else {
             assert(0 && "Invalid stage");
         }
-        // Get shell variable
-        int cur_stage = PRE_FAILURE;
-        if (getenv("POST_FAILURE")){
-            cur_stage = POST_FAILURE;
-        }
-        if (cur_stage & stage) {
+        if (xfdetector_stage & stage) {
             has_completed = COMPLETE;
             // kill(getpid(), 9);
             exit(0);
@@ -201,40 +221,53 @@ void XFDetector_complete(int condition, int stage)
     }
 }
 
-void XFDetector_addCommitVar(const void* variable, unsigned size)
+void _XFDetector_addCommitVar(const void* variable, unsigned size)
 {
     _add_commit_var(variable, size);
 }
 
+/* Exported for programs built against the out-of-line annotations */
+void XFDetector_RoIBegin(int condition, int stage)
+{
+    _XFDetector_RoIBegin(condition, stage);
+}
 
-void skipDetectionBegin(int condition, int stage){
-    if(!condition){
-        return;
-    }
-    //assert(((stage & POST_FAILURE)==1) && "Skip detection found in post failure");
-    int cur_stage = PRE_FAILURE;
-    if (getenv("POST_FAILURE")){
-        cur_stage = POST_FAILURE;
-    }
-    if(cur_stage & stage){
-        _skipDetectionBegin();
-    }
+void XFDetector_RoIEnd(int condition, int stage)
+{
+    _XFDetector_RoIEnd(condition, stage);
 }
 
-void skipDetectionEnd(int condition, int stage){
-        if(!condition){
-        return;
-    }
-    //assert(((stage & POST_FAILURE)==1) && "Skip detection found in post failure");
-    int cur_stage = PRE_FAILURE;
-    if (getenv("POST_FAILURE")){
-        cur_stage = POST_FAILURE;
-    }
-    if(cur_stage & stage){
-        _skipDetectionEnd();
-    }
+void XFDetector_addFailurePoint(int condition)
+{
+    _XFDetector_addFailurePoint(condition);
 }
 
+void XFDetector_skipFailureBegin(int condition)
+{
+    _XFDetector_skipFailureBegin(condition);
+}
 
+void XFDetector_skipFailureEnd(int condition)
+{
+    _XFDetector_skipFailureEnd(condition);
+}
 
+void XFDetector_complete(int condition, int stage)
+{
+    _XFDetector_complete(condition, stage);
+}
 
+void XFDetector_addCommitVar(const void* variable, unsigned size)
+{
+    _XFDetector_addCommitVar(variable, size);
+}
+
+void skipDetectionBegin(int condition, int stage)
+{
+    if (condition && (xfdetector_stage & stage)) _skipDetectionBegin();
+}
+
+void skipDetectionEnd(int condition, int stage)
+{
+    if (condition && (xfdetector_stage & stage)) _skipDetectionEnd();
+}
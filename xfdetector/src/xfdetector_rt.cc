@@ -0,0 +1,726 @@
+/*
+ * Compiler-instrumentation runtime of XFDetector.
+ *
+ * An alternative front end to the pintool. Workloads are compiled with
+ * -fsanitize=thread (and PMDK additionally with -finstrument-functions
+ * -DXFDETECTOR_RT) and linked against this library instead of libtsan.
+ * The runtime generates the same trace_entry_t stream as the pintool
+ * and talks to the detector through the same FIFOs.
+ */
+#define XFDETECTOR_RT_IMPL
+
+#include "trace.hh"
+#include "pmdk_funcs.hh"
+#include "xfdetector_rt.h"
+
+#include <atomic>
+#include <unordered_set>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+
+/* ================================================================== */
+// Runtime state
+/* ================================================================== */
+
+// Set once the trace FIFO is open
+static bool rt_enable = false;
+// PRE_FAILURE or POST_FAILURE
+static int rt_stage = PRE_FAILURE;
+// Read tracking, post-failure only
+static bool read_enable = false;
+// Failure injection, pre-failure only
+static bool failure_enable = false;
+
+static int trace_fifo_fd = -1;
+static int signal_fifo_fd = -1;
+static pthread_mutex_t fifo_lock = PTHREAD_MUTEX_INITIALIZER;
+// Merges adjacent stores and packs entries, protected by fifo_lock
+static StoreCoalescer coalescer;
+static TraceEncoder encoder;
+
+// Failure points, numbered the same way as in the pintool
+static int cur_failure_id = -1;
+static int resume_failure_id = -1;
+static bool failure_list_enable = false;
+static std::unordered_set<int> failure_set;
+static bool skip_failure = false;
+// Failure points at ordering points, RoI thread only
+static FailureSampler failure_sampler;
+
+// Mapped PM ranges, used to filter traced accesses
+PMRangeTable pm_range_table;
+
+// Only track one thread for testing
+static std::atomic<int> roi_tid(-1);
+
+// Small thread IDs, in the order threads first touch the runtime
+static std::atomic<int> next_tid(0);
+static __thread int rt_tid = -1;
+
+static inline int get_tid()
+{
+    if (rt_tid < 0) {
+        rt_tid = next_tid++;
+        assert(rt_tid < MAX_THREADS && "Too many threads for XFDetector runtime");
+    }
+    return rt_tid;
+}
+
+static inline bool is_in_roi(int tid)
+{
+    return roi_tid.load(std::memory_order_relaxed) == tid;
+}
+
+static void trace_write(trace_entry_t* trace)
+{
+    // A closed store run goes out with the entry that closed it
+    trace_entry_t out[2];
+    uint8_t buf[2 * TRACE_CODEC_MAX_SIZE];
+    size_t size = 0;
+    int write_rtn = 0;
+    pthread_mutex_lock(&fifo_lock);
+    unsigned count = coalescer.push(trace, out);
+    if (count) {
+        size = encoder.encode(out, count, buf);
+        write_rtn = write(trace_fifo_fd, buf, size);
+    }
+    pthread_mutex_unlock(&fifo_lock);
+    if ((unsigned)write_rtn < size) {
+        cout << "cannot write FIFO" << endl;
+        exit(0);
+    }
+}
+
+static void trace_flush()
+{
+    trace_entry_t out[1];
+    uint8_t buf[TRACE_CODEC_MAX_SIZE];
+    size_t size = 0;
+    int write_rtn = 0;
+    pthread_mutex_lock(&fifo_lock);
+    unsigned count = coalescer.flush(out);
+    if (count) {
+        size = encoder.encode(out, count, buf);
+        write_rtn = write(trace_fifo_fd, buf, size);
+    }
+    pthread_mutex_unlock(&fifo_lock);
+    // Called at exit, only report the failure
+    if ((unsigned)write_rtn < size)
+        cerr << "cannot write FIFO" << endl;
+}
+
+static void wait_on_signal(const char* signal)
+{
+    char buf[MAX_SIGNAL_LEN];
+    while (1) {
+        int signal_len = read(signal_fifo_fd, buf, MAX_SIGNAL_LEN);
+        if (signal_len < 0)
+            ERR("SignalFifo read failed.");
+        // remove the last character in case of \0 and \n
+        if (signal_len > 0 && !strncmp(buf, signal, signal_len-1))
+            return;
+    }
+}
+
+static void parse_failure_list(const char* file_name)
+{
+    FILE* infile = fopen(file_name, "r");
+    if (!infile)
+        ERR("Cannot open failure list: " << file_name);
+
+    int failure_id;
+    while (fscanf(infile, "%d", &failure_id) == 1) {
+        failure_set.insert(failure_id);
+    }
+    fclose(infile);
+}
+
+static void open_fifos(const char* exec_id)
+{
+    string suffix = exec_id ? string(".") + exec_id : string("");
+    string trace_name = string("/tmp/")
+        + (rt_stage == PRE_FAILURE ? PRE_FAILURE_FIFO : POST_FAILURE_FIFO) + suffix;
+    string signal_name = string("/tmp/") + SIGNAL_FIFO + suffix;
+
+    trace_fifo_fd = open(trace_name.c_str(), O_RDWR);
+    if (trace_fifo_fd < 0)
+        ERR("Trace FIFO open failed: " << trace_name);
+    signal_fifo_fd = open(signal_name.c_str(), O_RDWR);
+    if (signal_fifo_fd < 0)
+        ERR("Signal FIFO open failed: " << signal_name);
+}
+
+static void resolve_mem_funcs();
+
+static void rt_init()
+{
+    static bool initialized = false;
+    if (initialized) return;
+    initialized = true;
+
+    resolve_mem_funcs();
+
+    // Tracing is only enabled when launched by the detector
+    if (!getenv(XFD_RT_TRACE_ENV)) return;
+
+    if (getenv("POST_FAILURE")) {
+        rt_stage = POST_FAILURE;
+        read_enable = true;
+    } else {
+        rt_stage = PRE_FAILURE;
+        failure_enable = true;
+    }
+
+    const char* failure_list = getenv(XFD_RT_FAILURE_LIST_ENV);
+    if (failure_list && failure_enable) {
+        failure_list_enable = true;
+        parse_failure_list(failure_list);
+    }
+    const char* auto_failure = getenv(XFD_RT_AUTO_FAILURE_ENV);
+    if (auto_failure && failure_enable && !failure_sampler.parse(auto_failure))
+        ERR("Invalid auto failure injection option: " << auto_failure);
+    const char* resume_id = getenv(XFD_RT_RESUME_ID_ENV);
+    if (resume_id) resume_failure_id = atoi(resume_id);
+    coalescer.enabled = (getenv(XFD_RT_COALESCE_ENV) != NULL);
+
+    open_fifos(getenv(XFD_RT_EXEC_ID_ENV));
+    rt_enable = true;
+
+    fprintf(stderr, "===============================================\n");
+    fprintf(stderr, "This application is instrumented by XFDetector runtime\n");
+    fprintf(stderr, "%s-failure tracing enabled\n",
+            rt_stage == PRE_FAILURE ? "Pre" : "Post");
+    fprintf(stderr, "===============================================\n");
+}
+
+// Not from __tsan_init(), which runs from .preinit_array before the static
+// objects above are constructed, and their constructors would reset them
+static struct rt_initializer_t {
+    rt_initializer_t() {rt_init();}
+} rt_initializer;
+
+// Send the last coalesced store
+__attribute__((destructor))
+static void rt_destructor()
+{
+    if (rt_enable) trace_flush();
+}
+
+/* ================================================================== */
+// Trace generation, mirrors the analysis routines of the pintool
+/* ================================================================== */
+
+static inline void record_read(void* ip, const void* addr, uint64_t size)
+{
+    if (!rt_enable || !read_enable || !isPmemAddr(addr, size)) return;
+
+    int tid = get_tid();
+    // Only record trace in RoI
+    if (!is_in_roi(tid)) return;
+
+    trace_entry_t trace_entry;
+    trace_entry.tid = tid;
+    trace_entry.operation = READ;
+    trace_entry.src_addr = (addr_t)addr;
+    trace_entry.size = size;
+    trace_entry.instr_ptr = (addr_t)ip;
+    trace_write(&trace_entry);
+}
+
+static inline void record_write(void* ip, const void* addr, uint64_t size)
+{
+    if (!rt_enable || !isPmemAddr(addr, size)) return;
+
+    trace_entry_t trace_entry;
+    trace_entry.tid = get_tid();
+    trace_entry.operation = WRITE;
+    trace_entry.dst_addr = (addr_t)addr;
+    trace_entry.size = size;
+    trace_entry.instr_ptr = (addr_t)ip;
+    assert(0!=trace_entry.dst_addr && "Cannot write address=0");
+    trace_write(&trace_entry);
+}
+
+static void record_op(pm_op_t operation, void* ip,
+                        addr_t src_addr, addr_t dst_addr, uint64_t size)
+{
+    if (!rt_enable) return;
+
+    trace_entry_t trace_entry;
+    trace_entry.tid = get_tid();
+    trace_entry.operation = operation;
+    trace_entry.src_addr = src_addr;
+    trace_entry.dst_addr = dst_addr;
+    trace_entry.size = size;
+    trace_entry.instr_ptr = (addr_t)ip;
+    trace_write(&trace_entry);
+}
+
+#define CALLER_IP __builtin_return_address(0)
+
+// Call stack ID of a failure point
+static uint64_t stack_id()
+{
+    void* frames[16];
+    int count = backtrace(frames, sizeof(frames)/sizeof(frames[0]));
+    return FailureSampler::stack_id(frames, count);
+}
+
+static void inject_failure_point(void* ip)
+{
+    int tid = get_tid();
+    // Increment failure point ID even outside the RoI
+    cur_failure_id++;
+
+    // Only add failure points if in RoI
+    if (!is_in_roi(tid)) return;
+
+    // Only add fialure point if specified in failure list
+    // and not already completed before the last checkpoint
+    if ((failure_list_enable
+            && failure_set.find(cur_failure_id) == failure_set.end())
+            || cur_failure_id <= resume_failure_id) {
+        return;
+    }
+
+    // Other threads are not stopped, unlike in the pintool. Only the RoI
+    // thread is tested, and it blocks until the detector resumes it.
+    trace_entry_t trace_entry;
+    trace_entry.tid = tid;
+    trace_entry.operation = TRACE_END;
+    trace_entry.instr_ptr = (addr_t)ip;
+    trace_entry.failure_id = cur_failure_id;
+    trace_entry.src_addr = stack_id();
+    trace_write(&trace_entry);
+
+    // Wait until receives resumption singal
+    wait_on_signal(PIN_CONTINUE_SIGNAL);
+}
+
+// Failure point before an ordering point, if selected by the sampler
+static void ordering_failure_point(void* ip)
+{
+    if (!rt_enable || !failure_enable || !failure_sampler.enabled()) return;
+
+    // Only ordering points of the RoI thread are counted, so that the
+    // IDs do not depend on how other threads interleave with it
+    if (!is_in_roi(get_tid())) return;
+
+    if (failure_sampler.select(failure_sampler.needs_stack() ? stack_id() : 0)) {
+        inject_failure_point(ip);
+    } else {
+        // Keep the IDs of later failure points the same
+        cur_failure_id++;
+    }
+}
+
+extern "C" {
+
+void xfd_rt_map(const void* addr, size_t size)
+{
+    pm_range_table.add((addr_t)addr, size);
+    if (!rt_enable) return;
+
+    // The pintool reports both the call and the return of pmem_map_file()
+    record_op(PMEM_MAP_FILE, CALLER_IP, 0, 0, 0);
+
+    trace_entry_t trace_entry;
+    trace_entry.tid = get_tid();
+    trace_entry.operation = PMEM_MAP_FILE;
+    trace_entry.func_ret = true;
+    trace_entry.dst_addr = (addr_t)addr;
+    trace_entry.size = size;
+    trace_entry.instr_ptr = (addr_t)CALLER_IP;
+    trace_write(&trace_entry);
+}
+
+void xfd_rt_unmap(const void* addr, size_t size)
+{
+    pm_range_table.remove((addr_t)addr, size);
+    record_op(PMEM_UNMAP, CALLER_IP, (addr_t)addr, 0, size);
+}
+
+void xfd_rt_flush(const void* addr, size_t size)
+{
+    if (size == 0) return;
+    record_op(CLWB, CALLER_IP, (addr_t)addr, 0, size);
+}
+
+void xfd_rt_fence(void)
+{
+    ordering_failure_point(CALLER_IP);
+    record_op(SFENCE, CALLER_IP, 0, 0, 0);
+}
+
+void xfd_rt_pm_addr_add(uint64_t addr, uint64_t size)
+{
+    pm_range_table.add(addr, size);
+    record_op(PM_TRACE_PM_ADDR_ADD, CALLER_IP, 0, addr, size);
+}
+
+void xfd_rt_pm_addr_remove(uint64_t addr, uint64_t size)
+{
+    pm_range_table.remove(addr, size);
+    record_op(PM_TRACE_PM_ADDR_REMOVE, CALLER_IP, addr, 0, size);
+}
+
+void xfd_rt_tx_begin(void)
+{
+    record_op(PM_TRACE_TX_BEGIN, CALLER_IP, 0, 0, 0);
+}
+
+void xfd_rt_tx_end(void)
+{
+    ordering_failure_point(CALLER_IP);
+    record_op(PM_TRACE_TX_END, CALLER_IP, 0, 0, 0);
+}
+
+void xfd_rt_tx_addr_add(uint64_t addr, uint64_t size)
+{
+    ordering_failure_point(CALLER_IP);
+    record_op(PM_TRACE_TX_ADDR_ADD, CALLER_IP, 0, addr, size);
+}
+
+void xfd_rt_roi_begin(int stage)
+{
+    if (!rt_enable || stage != rt_stage) return;
+    int expected = -1;
+    roi_tid.compare_exchange_strong(expected, get_tid());
+}
+
+void xfd_rt_roi_end(int stage)
+{
+    if (!rt_enable || stage != rt_stage) return;
+    int expected = get_tid();
+    roi_tid.compare_exchange_strong(expected, -1);
+}
+
+void xfd_rt_skip_failure(int skip)
+{
+    // Counted as a failure point, same as in the pintool
+    cur_failure_id++;
+    skip_failure = skip;
+}
+
+void xfd_rt_failure_point(void)
+{
+    if (!rt_enable || !failure_enable) return;
+    inject_failure_point(CALLER_IP);
+}
+
+void xfd_rt_testing_complete(int stage)
+{
+    if (!rt_enable || stage != rt_stage) return;
+
+    record_op(TESTING_END, CALLER_IP, 0, 0, 0);
+    if (rt_stage == POST_FAILURE) {
+        // Terminate program
+        exit(1);
+    }
+}
+
+void xfd_rt_add_commit_var(const void* addr, unsigned size)
+{
+    record_op(_ADD_COMMIT_VAR, CALLER_IP, (addr_t)addr, 0, size);
+}
+
+void xfd_rt_skip_detection(int skip)
+{
+    record_op(skip ? PM_TRACE_DETECTION_SKIP_BEGIN : PM_TRACE_DETECTION_SKIP_END,
+                CALLER_IP, 0, 0, 0);
+}
+
+} // extern "C"
+
+/* ================================================================== */
+// PMDK API calls (-finstrument-functions)
+/* ================================================================== */
+
+#define FUNC_CACHE_SIZE 4096
+
+// Cache of function address -> whether it is a PMDK API function
+struct func_cache_entry_t {
+    std::atomic<uintptr_t> func;
+    std::atomic<int> is_internal;
+};
+static func_cache_entry_t func_cache[FUNC_CACHE_SIZE];
+
+static bool lookup_internal_func(void* func)
+{
+    Dl_info info;
+    // Static functions resolve to the closest exported symbol, skip them
+    if (!dladdr(func, &info) || !info.dli_sname || info.dli_saddr != func)
+        return false;
+    for (unsigned i = 0; i < NUM_PMDK_INTERNAL_FUNCS; ++i) {
+        if (!strcmp(info.dli_sname, pmdk_internal_func_names[i]))
+            return true;
+    }
+    return false;
+}
+
+static bool is_internal_func(void* func)
+{
+    uintptr_t key = (uintptr_t)func;
+    unsigned idx = (key >> 4) % FUNC_CACHE_SIZE;
+    for (unsigned probe = 0; probe < FUNC_CACHE_SIZE; ++probe) {
+        func_cache_entry_t* entry = &func_cache[(idx + probe) % FUNC_CACHE_SIZE];
+        uintptr_t cur = entry->func.load(std::memory_order_acquire);
+        if (cur == key) {
+            int is_internal = entry->is_internal.load(std::memory_order_acquire);
+            if (is_internal >= 0) return is_internal;
+            // Being inserted by another thread
+            return lookup_internal_func(func);
+        }
+        if (cur == 0) {
+            if (!entry->func.compare_exchange_strong(cur, key)) {
+                if (cur != key) continue;
+                return lookup_internal_func(func);
+            }
+            entry->is_internal.store(-1, std::memory_order_relaxed);
+            bool is_internal = lookup_internal_func(func);
+            entry->is_internal.store(is_internal, std::memory_order_release);
+            return is_internal;
+        }
+    }
+    // Cache is full
+    return lookup_internal_func(func);
+}
+
+extern "C" {
+
+__attribute__((no_instrument_function))
+void __cyg_profile_func_enter(void* func, void* call_site)
+{
+    if (rt_enable && is_internal_func(func))
+        record_op(PMDK_INTERNAL_CALL, call_site, 0, 0, 0);
+}
+
+__attribute__((no_instrument_function))
+void __cyg_profile_func_exit(void* func, void* call_site)
+{
+    if (rt_enable && is_internal_func(func))
+        record_op(PMDK_INTERNAL_RET, call_site, 0, 0, 0);
+}
+
+} // extern "C"
+
+/* ================================================================== */
+// Memory access callbacks (-fsanitize=thread)
+/* ================================================================== */
+
+extern "C" {
+
+void __tsan_init() {}
+
+void __tsan_func_entry(void* call_pc) {}
+void __tsan_func_exit() {}
+void __tsan_ignore_thread_begin() {}
+void __tsan_ignore_thread_end() {}
+void __tsan_vptr_read(void** vptr_p) {}
+void __tsan_vptr_update(void** vptr_p, void* new_val) {}
+
+#define XFD_TSAN_ACCESS(size) \
+    void __tsan_read##size(void* addr) \
+        { record_read(CALLER_IP, addr, size); } \
+    void __tsan_write##size(void* addr) \
+        { record_write(CALLER_IP, addr, size); } \
+    void __tsan_unaligned_read##size(void* addr) \
+        { record_read(CALLER_IP, addr, size); } \
+    void __tsan_unaligned_write##size(void* addr) \
+        { record_write(CALLER_IP, addr, size); } \
+    void __tsan_volatile_read##size(void* addr) \
+        { record_read(CALLER_IP, addr, size); } \
+    void __tsan_volatile_write##size(void* addr) \
+        { record_write(CALLER_IP, addr, size); } \
+    void __tsan_read##size##_pc(void* addr, void* pc) \
+        { record_read(pc, addr, size); } \
+    void __tsan_write##size##_pc(void* addr, void* pc) \
+        { record_write(pc, addr, size); }
+
+XFD_TSAN_ACCESS(1)
+XFD_TSAN_ACCESS(2)
+XFD_TSAN_ACCESS(4)
+XFD_TSAN_ACCESS(8)
+XFD_TSAN_ACCESS(16)
+
+void __tsan_read_range(void* addr, unsigned long size)
+{
+    if (size) record_read(CALLER_IP, addr, size);
+}
+
+void __tsan_write_range(void* addr, unsigned long size)
+{
+    if (size) record_write(CALLER_IP, addr, size);
+}
+
+/*
+ * Atomic operations. All of them are executed with sequential consistency,
+ * which is at least as strong as the order requested by the program.
+ */
+#define XFD_TSAN_ATOMIC_RMW(bits, type, op) \
+    type __tsan_atomic##bits##_##op(volatile type* a, type v, int mo) \
+    { \
+        record_read(CALLER_IP, (void*)a, sizeof(type)); \
+        record_write(CALLER_IP, (void*)a, sizeof(type)); \
+        return __atomic_##op(a, v, __ATOMIC_SEQ_CST); \
+    }
+
+#define XFD_TSAN_ATOMIC(bits, type) \
+    type __tsan_atomic##bits##_load(const volatile type* a, int mo) \
+    { \
+        record_read(CALLER_IP, (void*)a, sizeof(type)); \
+        return __atomic_load_n(a, __ATOMIC_SEQ_CST); \
+    } \
+    void __tsan_atomic##bits##_store(volatile type* a, type v, int mo) \
+    { \
+        record_write(CALLER_IP, (void*)a, sizeof(type)); \
+        __atomic_store_n(a, v, __ATOMIC_SEQ_CST); \
+    } \
+    type __tsan_atomic##bits##_exchange(volatile type* a, type v, int mo) \
+    { \
+        record_read(CALLER_IP, (void*)a, sizeof(type)); \
+        record_write(CALLER_IP, (void*)a, sizeof(type)); \
+        return __atomic_exchange_n(a, v, __ATOMIC_SEQ_CST); \
+    } \
+    XFD_TSAN_ATOMIC_RMW(bits, type, fetch_add) \
+    XFD_TSAN_ATOMIC_RMW(bits, type, fetch_sub) \
+    XFD_TSAN_ATOMIC_RMW(bits, type, fetch_and) \
+    XFD_TSAN_ATOMIC_RMW(bits, type, fetch_or) \
+    XFD_TSAN_ATOMIC_RMW(bits, type, fetch_xor) \
+    XFD_TSAN_ATOMIC_RMW(bits, type, fetch_nand) \
+    int __tsan_atomic##bits##_compare_exchange_strong(volatile type* a, \
+                type* c, type v, int mo, int fmo) \
+    { \
+        record_read(CALLER_IP, (void*)a, sizeof(type)); \
+        bool success = __atomic_compare_exchange_n(a, c, v, false, \
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+        if (success) record_write(CALLER_IP, (void*)a, sizeof(type)); \
+        return success; \
+    } \
+    int __tsan_atomic##bits##_compare_exchange_weak(volatile type* a, \
+                type* c, type v, int mo, int fmo) \
+    { \
+        record_read(CALLER_IP, (void*)a, sizeof(type)); \
+        bool success = __atomic_compare_exchange_n(a, c, v, true, \
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+        if (success) record_write(CALLER_IP, (void*)a, sizeof(type)); \
+        return success; \
+    } \
+    type __tsan_atomic##bits##_compare_exchange_val(volatile type* a, \
+                type c, type v, int mo, int fmo) \
+    { \
+        record_read(CALLER_IP, (void*)a, sizeof(type)); \
+        bool success = __atomic_compare_exchange_n(a, &c, v, false, \
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+        if (success) record_write(CALLER_IP, (void*)a, sizeof(type)); \
+        return c; \
+    }
+
+XFD_TSAN_ATOMIC(8, char)
+XFD_TSAN_ATOMIC(16, short)
+XFD_TSAN_ATOMIC(32, int)
+XFD_TSAN_ATOMIC(64, long)
+XFD_TSAN_ATOMIC(128, __int128)
+
+void __tsan_atomic_thread_fence(int mo)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void __tsan_atomic_signal_fence(int mo)
+{
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+} // extern "C"
+
+/* ================================================================== */
+// libc memory functions, not compiler-instrumented
+/* ================================================================== */
+
+typedef void* (*memcpy_func_t)(void*, const void*, size_t);
+typedef void* (*memset_func_t)(void*, int, size_t);
+
+static memcpy_func_t real_memcpy = NULL;
+static memcpy_func_t real_memmove = NULL;
+static memset_func_t real_memset = NULL;
+
+static void resolve_mem_funcs()
+{
+    real_memcpy = (memcpy_func_t)dlsym(RTLD_NEXT, "memcpy");
+    real_memmove = (memcpy_func_t)dlsym(RTLD_NEXT, "memmove");
+    real_memset = (memset_func_t)dlsym(RTLD_NEXT, "memset");
+}
+
+// Used before the libc functions are resolved, must not become libc calls
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+static void* fallback_memmove(void* dst, const void* src, size_t n)
+{
+    volatile char* d = (volatile char*)dst;
+    const volatile char* s = (const volatile char*)src;
+    if (d < s) {
+        for (size_t i = 0; i < n; ++i) d[i] = s[i];
+    } else {
+        for (size_t i = n; i > 0; --i) d[i-1] = s[i-1];
+    }
+    return dst;
+}
+
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+static void* fallback_memset(void* dst, int c, size_t n)
+{
+    volatile char* d = (volatile char*)dst;
+    for (size_t i = 0; i < n; ++i) d[i] = (char)c;
+    return dst;
+}
+
+static inline void* rt_memmove(void* ip, void* dst, const void* src, size_t n,
+                                memcpy_func_t real_func)
+{
+    if (n) {
+        record_read(ip, src, n);
+        record_write(ip, dst, n);
+    }
+    return real_func ? real_func(dst, src, n) : fallback_memmove(dst, src, n);
+}
+
+static inline void* rt_memset(void* ip, void* dst, int c, size_t n)
+{
+    if (n) record_write(ip, dst, n);
+    return real_memset ? real_memset(dst, c, n) : fallback_memset(dst, c, n);
+}
+
+extern "C" {
+
+void* memcpy(void* dst, const void* src, size_t n)
+{
+    return rt_memmove(CALLER_IP, dst, src, n, real_memcpy);
+}
+
+void* memmove(void* dst, const void* src, size_t n)
+{
+    return rt_memmove(CALLER_IP, dst, src, n, real_memmove);
+}
+
+void* memset(void* dst, int c, size_t n)
+{
+    return rt_memset(CALLER_IP, dst, c, n);
+}
+
+void* __tsan_memcpy(void* dst, const void* src, size_t n)
+{
+    return rt_memmove(CALLER_IP, dst, src, n, real_memcpy);
+}
+
+void* __tsan_memmove(void* dst, const void* src, size_t n)
+{
+    return rt_memmove(CALLER_IP, dst, src, n, real_memmove);
+}
+
+void* __tsan_memset(void* dst, int c, size_t n)
+{
+    return rt_memset(CALLER_IP, dst, c, n);
+}
+
+} // extern "C"
@@ -0,0 +1,50 @@
+/*
+ * Dedup keys of the findings of ShadowPM: the copies checking post-failure
+ * executions key their findings on the failure point they were made for.
+ */
+#include "xfdetector.hh"
+
+// Defined by xfdetector.cc in the detector
+int exec_id = -1;
+
+#define ADDR 0x10000000000ULL
+
+int main()
+{
+    ShadowPM shadow_mem;
+    trace_entry_t write;
+    write.operation = WRITE;
+    write.tid = 0;
+    write.dst_addr = ADDR;
+    write.size = 8;
+    write.instr_ptr = 0x401000;
+    shadow_mem.add_write_addr_IP_mapping(&write);
+
+    // Two failure points after the same writes
+    shadow_mem.failure_stack = 0x1234;
+    ShadowPM* first = new ShadowPM(shadow_mem);
+    shadow_mem.failure_stack = 0x5678;
+    ShadowPM* second = new ShadowPM(shadow_mem);
+    assert(first->failure_stack == 0x1234);
+    assert(second->failure_stack == 0x5678);
+
+    uint64_t first_key = first->finding_key(ADDR, 8, 0);
+    uint64_t second_key = second->finding_key(ADDR, 8, 0);
+    assert(first_key != second_key);
+
+    // Copies of a copy, as checked by several post-failure workers
+    ShadowPM third(*first);
+    assert(third.finding_key(ADDR, 8, 0) == first_key);
+
+    // The reason and the writers are part of the key
+    assert(first->finding_key(ADDR, 8, 1) != first_key);
+    write.instr_ptr = 0x402000;
+    third.add_write_addr_IP_mapping(&write);
+    assert(third.finding_key(ADDR, 8, 0) != first_key);
+
+    delete first;
+    delete second;
+
+    cout << "shadow_pm_test: OK" << endl;
+    return 0;
+}
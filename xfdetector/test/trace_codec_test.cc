@@ -0,0 +1,84 @@
+/*
+ * Round trip of the packed trace format of trace_codec.hh: every operation
+ * and the edge values of each field are encoded, then decoded in one call
+ * and byte by byte, which splits every entry across calls.
+ */
+#include "trace.hh"
+#include <limits.h>
+
+static vector<trace_entry_t> make_traces()
+{
+    const addr_t addrs[] = {0, 1, 0x10000000000ULL, UINT64_MAX, UINT64_MAX - 1, 0};
+    const size_t sizes[] = {0, 1, 64, SIZE_MAX};
+    const addr_t ips[] = {0, UINT64_MAX, 0x400000, 1};
+    const int tids[] = {0, 1, INT_MAX, 0};
+    const int failure_ids[] = {-1, 0, INT_MAX, INT_MIN};
+
+    vector<trace_entry_t> traces;
+    unsigned i = 0;
+    for (int op = INVALID; op <= PM_TRACE_DETECTION_SKIP_END; ++op) {
+        for (unsigned j = 0; j < 8; ++j, ++i) {
+            trace_entry_t trace;
+            trace.operation = (pm_op_t)op;
+            trace.func_ret = j & 1;
+            trace.non_temporal = (j >> 1) & 1;
+            trace.tid = tids[i % 4];
+            trace.src_addr = addrs[i % 6];
+            trace.dst_addr = addrs[(i + 3) % 6];
+            trace.size = sizes[i % 4];
+            trace.instr_ptr = ips[(i / 2) % 4];
+            trace.failure_id = failure_ids[(i / 3) % 4];
+            traces.push_back(trace);
+        }
+    }
+    return traces;
+}
+
+static void check_equal(const vector<trace_entry_t>& in, const vector<trace_entry_t>& out)
+{
+    assert(in.size() == out.size());
+    for (size_t i = 0; i < in.size(); ++i) {
+        assert(in[i].operation == out[i].operation);
+        assert(in[i].func_ret == out[i].func_ret);
+        assert(in[i].non_temporal == out[i].non_temporal);
+        assert(in[i].tid == out[i].tid);
+        assert(in[i].src_addr == out[i].src_addr);
+        assert(in[i].dst_addr == out[i].dst_addr);
+        assert(in[i].size == out[i].size);
+        assert(in[i].instr_ptr == out[i].instr_ptr);
+        assert(in[i].failure_id == out[i].failure_id);
+    }
+}
+
+int main()
+{
+    vector<trace_entry_t> traces = make_traces();
+    vector<uint8_t> buf(traces.size() * TRACE_CODEC_MAX_SIZE);
+
+    TraceEncoder encoder;
+    size_t size = encoder.encode(traces.data(), traces.size(), buf.data());
+    assert(size > 0 && size <= buf.size());
+
+    // Whole buffer at once
+    TraceDecoder decoder;
+    vector<trace_entry_t> out;
+    decoder.decode(buf.data(), size, &out);
+    check_equal(traces, out);
+
+    // One byte at a time
+    decoder.reset();
+    out.clear();
+    for (size_t i = 0; i < size; ++i) decoder.decode(&buf[i], 1, &out);
+    check_equal(traces, out);
+
+    // The state starts over after a reset of both sides
+    encoder.reset();
+    decoder.reset();
+    out.clear();
+    size = encoder.encode(traces.data(), 1, buf.data());
+    decoder.decode(buf.data(), size, &out);
+    check_equal(vector<trace_entry_t>(traces.begin(), traces.begin() + 1), out);
+
+    cout << "trace_codec_test: OK (" << traces.size() << " entries)" << endl;
+    return 0;
+}
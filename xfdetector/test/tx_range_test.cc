@@ -0,0 +1,119 @@
+/*
+ * Merging and splitting of the transaction-scoped ranges of tx_range.hh
+ * with disjoint, adjacent, overlapping and contained ranges.
+ */
+#include "common.hh"
+#include "tx_range.hh"
+
+static void check_set(const TxRangeSet& set, const vector<tx_range_t>& expected)
+{
+    size_t i = 0;
+    for (auto& range : set) {
+        assert(i < expected.size());
+        assert(range.lower == expected[i].lower);
+        assert(range.upper == expected[i].upper);
+        ++i;
+    }
+    assert(i == expected.size());
+}
+
+static void check_value(const TxRangeMap& map, addr_t addr, size_t size, bool found, addr_t expected = 0)
+{
+    addr_t value = 0;
+    assert(map.lookup_first(addr, size, &value) == found);
+    if (found) assert(value == expected);
+}
+
+static void test_set()
+{
+    TxRangeSet set;
+    assert(set.empty());
+    assert(!set.contains(0x100, 1));
+
+    // Disjoint ranges stay apart and sorted
+    set.add(0x300, 0x10);
+    set.add(0x100, 0x10);
+    check_set(set, {{0x100, 0x10f}, {0x300, 0x30f}});
+    assert(set.contains(0x100, 0x10));
+    assert(!set.contains(0x100, 0x11));
+    assert(!set.contains(0x200, 1));
+
+    // Adjacent on either side are joined
+    set.add(0x110, 0x10);
+    set.add(0x2f0, 0x10);
+    check_set(set, {{0x100, 0x11f}, {0x2f0, 0x30f}});
+
+    // Contained changes nothing
+    set.add(0x104, 4);
+    check_set(set, {{0x100, 0x11f}, {0x2f0, 0x30f}});
+
+    // Overlapping extends the range
+    set.add(0x118, 0x10);
+    check_set(set, {{0x100, 0x127}, {0x2f0, 0x30f}});
+
+    // Bridging joins all of the ranges in between
+    set.add(0x400, 0x10);
+    set.add(0x120, 0x2f0);
+    check_set(set, {{0x100, 0x40f}});
+    assert(set.contains(0x100, 0x310));
+    assert(!set.contains(0xff, 2));
+
+    // Covering several ranges at once
+    set.clear();
+    assert(set.empty());
+    set.add(0x10, 1);
+    set.add(0x20, 1);
+    set.add(0x30, 1);
+    set.add(0x8, 0x40);
+    check_set(set, {{0x8, 0x47}});
+}
+
+static void test_map()
+{
+    TxRangeMap map;
+    check_value(map, 0x100, 8, false);
+
+    // Disjoint
+    map.update(0x100, 0x10, 1);
+    map.update(0x200, 0x10, 2);
+    check_value(map, 0x100, 0x10, true, 1);
+    check_value(map, 0x200, 1, true, 2);
+    check_value(map, 0x110, 0xf0, false);
+    // Lowest mapped address of a range spanning both
+    check_value(map, 0x0, 0x300, true, 1);
+
+    // Adjacent ranges keep their own values
+    map.update(0x110, 0x10, 3);
+    check_value(map, 0x10f, 1, true, 1);
+    check_value(map, 0x110, 1, true, 3);
+
+    // Contained splits the range in three
+    map.update(0x104, 4, 4);
+    check_value(map, 0x100, 4, true, 1);
+    check_value(map, 0x104, 4, true, 4);
+    check_value(map, 0x108, 8, true, 1);
+
+    // Overlapping keeps the parts outside of the new range
+    map.update(0x10c, 8, 5);
+    check_value(map, 0x108, 4, true, 1);
+    check_value(map, 0x10c, 8, true, 5);
+    check_value(map, 0x114, 0xc, true, 3);
+
+    // Covering several ranges overwrites all of them
+    map.update(0x0, 0x1000, 6);
+    check_value(map, 0x100, 1, true, 6);
+    check_value(map, 0x20f, 1, true, 6);
+    check_value(map, 0x1000, 1, false);
+
+    map.clear();
+    check_value(map, 0x100, 1, false);
+}
+
+int main()
+{
+    test_set();
+    test_map();
+
+    cout << "tx_range_test: OK" << endl;
+    return 0;
+}